@@ -0,0 +1,389 @@
+/* Micro-benchmarks for the drawing, text and conversion primitives and
+ * for whole quiz frames, at several resolutions and answer counts.
+ *
+ * Usage: bench [--time SECONDS] [--font PATH] [--questions N]
+ *        bench --generate-quiz N [ANSWERS]
+ *
+ * Results go to stdout as JSON, progress to stderr. --generate-quiz
+ * prints a synthetic quiz bank in the quiz file format instead. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <json-c/json.h>
+#include "config.h"
+#include "quiz.h"
+#include "render.h"
+#include "text.h"
+#include "video.h"
+#include "yuv.h"
+
+/* Bumped when result fields change meaning */
+#define BENCH_FORMAT_VERSION 1
+
+static const int resolutions[][2] = {{540, 960}, {720, 1280}, {1080, 1920}};
+static const int answer_counts[] = {2, 4, 6};
+
+/* State for one timed call; each benchmark uses the fields it needs */
+typedef struct {
+    Canvas canvas;
+    RenderContext *rc;
+    TextContext *text;
+    const char *string;
+    const LayoutConfig *layout;
+    const AnimationConfig *animation;
+    QuizData *quiz;
+    int frames_per_question;
+    int fps;
+    uint8_t *rgb;
+    uint8_t *yuv[3];
+    int yuv_linesize[3];
+    yuv_row_fn row_fn;
+    int x, y, w, h, radius;
+    long calls;
+} BenchArgs;
+
+typedef void (*BenchFn)(BenchArgs *args);
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Call fn in growing batches until min_seconds have passed.
+ * Returns nanoseconds per call. */
+static double time_calls(BenchFn fn, BenchArgs *args, double min_seconds, long *calls) {
+    fn(args);  /* Warm caches, fault in buffers and glyphs */
+
+    long total = 0, batch = 1;
+    double start = now(), elapsed;
+    do {
+        for (long i = 0; i < batch; i++) {
+            fn(args);
+        }
+        total += batch;
+        elapsed = now() - start;
+        if (batch < (1L << 20)) batch *= 2;
+    } while (elapsed < min_seconds);
+
+    *calls = total;
+    return elapsed * 1e9 / total;
+}
+
+static void bench_fill(BenchArgs *a) {
+    video_fill_rgb_color(&a->canvas, a->rc->colors.background);
+}
+
+static void bench_rect(BenchArgs *a) {
+    Color c = a->rc->colors.answer_button_normal;
+    video_draw_rect(&a->canvas, a->x, a->y, a->w, a->h, c.r, c.g, c.b);
+}
+
+static void bench_rounded_rect(BenchArgs *a) {
+    video_draw_rounded_rect_alpha(&a->canvas, a->x, a->y, a->w, a->h, a->radius,
+                                  a->rc->colors.answer_button_normal, 0.6f);
+}
+
+static void bench_timer_bar(BenchArgs *a) {
+    float progress = (float)(a->calls++ % 100) / 100.0f;
+    video_draw_timer_bar(&a->canvas, progress, a->h, &a->rc->colors);
+}
+
+static void bench_text_render(BenchArgs *a) {
+    Color c = a->rc->colors.answer_text;
+    text_render_alpha(a->text, &a->canvas, a->string, a->x, a->y, c.r, c.g, c.b, 0.8f);
+}
+
+static void bench_text_measure(BenchArgs *a) {
+    a->calls += text_measure_width(a->text, a->string);
+}
+
+static void bench_convert(BenchArgs *a) {
+    if (a->row_fn) {
+        yuv_convert_rgb24_with(a->row_fn, a->rgb, a->canvas.width * 3, a->yuv, a->yuv_linesize,
+                               a->canvas.width, a->canvas.height, YUV_MATRIX_BT709);
+    } else {
+        yuv_convert_rgb24(a->rgb, a->canvas.width * 3, a->yuv, a->yuv_linesize,
+                          a->canvas.width, a->canvas.height, YUV_MATRIX_BT709);
+    }
+}
+
+/* Frames in timeline order, moving on to the next question after the
+ * reveal, the way a render worker walks a segment */
+static void bench_quiz_frame(BenchArgs *a) {
+    int total = a->frames_per_question * a->quiz->num_questions;
+    int n = (int)(a->calls++ % total);
+    quiz_render_frame(a->rc, a->quiz, n / a->frames_per_question,
+                      (float)(n % a->frames_per_question) / a->fps,
+                      &a->canvas, a->layout, a->animation);
+}
+
+/* Append one result; pixels is per call (0 when it does not apply) */
+static void report(struct json_object *results, const char *name, const Canvas *canvas,
+                   int answers, double pixels, BenchFn fn, BenchArgs *args,
+                   double min_seconds) {
+    long calls;
+    args->calls = 0;
+    double ns = time_calls(fn, args, min_seconds, &calls);
+
+    struct json_object *result = json_object_new_object();
+    json_object_object_add(result, "name", json_object_new_string(name));
+    json_object_object_add(result, "format", json_object_new_string(
+        canvas->format == CANVAS_YUV420P ? "yuv420p" : "rgb24"));
+    json_object_object_add(result, "width", json_object_new_int(canvas->width));
+    json_object_object_add(result, "height", json_object_new_int(canvas->height));
+    if (answers > 0) {
+        json_object_object_add(result, "answers", json_object_new_int(answers));
+    }
+    json_object_object_add(result, "calls", json_object_new_int64(calls));
+    json_object_object_add(result, "ns_per_frame", json_object_new_double(ns));
+    json_object_object_add(result, "mpixels_per_s",
+                           pixels > 0 ? json_object_new_double(pixels * 1e3 / ns) : NULL);
+    json_object_array_add(results, result);
+
+    fprintf(stderr, "  %-32s %-7s %4dx%-4d %9.0f ns", name,
+            canvas->format == CANVAS_YUV420P ? "yuv420p" : "rgb24",
+            canvas->width, canvas->height, ns);
+    if (answers > 0) fprintf(stderr, "  %d answers", answers);
+    if (pixels > 0) fprintf(stderr, "  %.0f MPixel/s", pixels * 1e3 / ns);
+    fprintf(stderr, "\n");
+}
+
+/* Deterministic filler words, so runs compare across releases */
+static const char *words[] = {
+    "which", "planet", "river", "capital", "largest", "element", "painter", "year",
+    "ocean", "mountain", "language", "famous", "invented", "smallest", "country", "first"
+};
+
+static void random_text(char *out, size_t size, unsigned *seed, int num_words) {
+    out[0] = '\0';
+    for (int i = 0; i < num_words; i++) {
+        *seed = *seed * 1103515245u + 12345u;
+        const char *word = words[(*seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+        size_t len = strlen(out);
+        snprintf(out + len, size - len, "%s%s", i ? " " : "", word);
+    }
+}
+
+/* Quiz bank in the quiz file format: mostly standard questions, every
+ * fifth one multi-answer so the hint line is drawn too */
+static struct json_object *generate_quiz(int num_questions, int num_answers) {
+    unsigned seed = 1;
+    struct json_object *root = json_object_new_object();
+    struct json_object *config = json_object_new_object();
+    json_object_object_add(config, "question_duration", json_object_new_int(5));
+    json_object_object_add(config, "reveal_duration", json_object_new_int(2));
+    json_object_object_add(root, "config", config);
+
+    struct json_object *questions = json_object_new_array();
+    for (int q = 0; q < num_questions; q++) {
+        char text[MAX_QUESTION_LEN];
+        struct json_object *question = json_object_new_object();
+        int multi = q % 5 == 4 && num_answers > 2;
+        json_object_object_add(question, "type",
+                               json_object_new_string(multi ? "multi" : "standard"));
+        random_text(text, 64, &seed, 3 + q % 4);
+        json_object_object_add(question, "question", json_object_new_string(text));
+
+        struct json_object *answers = json_object_new_array();
+        for (int i = 0; i < num_answers; i++) {
+            random_text(text, 48, &seed, 1 + (q + i) % 3);
+            json_object_array_add(answers, json_object_new_string(text));
+        }
+        json_object_object_add(question, "answers", answers);
+
+        struct json_object *correct = json_object_new_array();
+        json_object_array_add(correct, json_object_new_int(q % num_answers));
+        if (multi) {
+            json_object_array_add(correct, json_object_new_int((q + 1) % num_answers));
+        }
+        json_object_object_add(question, "correct", correct);
+        json_object_array_add(questions, question);
+    }
+    json_object_object_add(root, "questions", questions);
+    return root;
+}
+
+/* Every primitive and a full frame on one canvas */
+static int bench_canvas(struct json_object *results, RenderContext *rc, Canvas *canvas,
+                        int num_questions, double min_seconds) {
+    int width = canvas->width, height = canvas->height;
+
+    /* Full-size layout drawn at this resolution, as --draft does */
+    AppConfig defaults = config_get_default();
+    LayoutConfig layout = defaults.layout;
+    layout.scale = (float)width / defaults.video.width;
+    int px = (int)(layout.button_margin * layout.scale);
+
+    BenchArgs args = {.canvas = *canvas, .rc = rc, .layout = &layout,
+                      .animation = &defaults.animation, .fps = defaults.video.fps};
+
+    report(results, "video_fill_rgb_color", canvas, 0, (double)width * height,
+           bench_fill, &args, min_seconds);
+
+    args.x = px;
+    args.y = (int)(layout.answer_y_start * layout.scale);
+    args.w = width - 2 * px;
+    args.h = (int)(layout.button_height * layout.scale);
+    args.radius = (int)(layout.button_radius * layout.scale);
+    report(results, "video_draw_rect", canvas, 0, (double)args.w * args.h,
+           bench_rect, &args, min_seconds);
+    report(results, "video_draw_rounded_rect_alpha", canvas, 0, (double)args.w * args.h,
+           bench_rounded_rect, &args, min_seconds);
+
+    args.h = (int)(layout.timer_bar_height * layout.scale);
+    report(results, "video_draw_timer_bar", canvas, 0, (double)width * args.h,
+           bench_timer_bar, &args, min_seconds);
+
+    args.text = render_context_text(rc, (int)(layout.answer_font_size * layout.scale));
+    if (!args.text) {
+        return -1;
+    }
+    args.string = "C) Which planet is closest to the Sun?";
+    int x0, y0, x1, y1;
+    text_measure_box(args.text, args.string, &x0, &y0, &x1, &y1);
+    args.x = px;
+    args.y = height / 2;
+    report(results, "text_render_alpha", canvas, 0, (double)(x1 - x0) * (y1 - y0),
+           bench_text_render, &args, min_seconds);
+    report(results, "text_measure_width", canvas, 0, 0,
+           bench_text_measure, &args, min_seconds);
+
+    for (size_t i = 0; i < sizeof(answer_counts) / sizeof(answer_counts[0]); i++) {
+        QuizData quiz = {0};
+        struct json_object *bank = generate_quiz(num_questions, answer_counts[i]);
+        int ret = quiz_parse(&quiz, bank);
+        json_object_put(bank);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to build synthetic quiz\n");
+            return -1;
+        }
+
+        args.quiz = &quiz;
+        args.frames_per_question = (quiz.question_duration + quiz.reveal_duration) * args.fps;
+        report(results, "quiz_render_frame", canvas, answer_counts[i], (double)width * height,
+               bench_quiz_frame, &args, min_seconds);
+        quiz_free(&quiz);
+        /* Sprites are keyed by question address, which the next quiz may
+         * reuse, so drop them before it is benchmarked */
+        sprite_cache_bind(&rc->sprites, NULL, 0);
+    }
+    return 0;
+}
+
+/* RGB24 -> YUV420P for a whole frame, with the selected kernel and with
+ * each one compiled in */
+static void bench_conversion(struct json_object *results, int width, int height,
+                             uint8_t *rgb, uint8_t *const yuv[3], const int linesize[3],
+                             double min_seconds) {
+    BenchArgs args = {.rgb = rgb};
+    canvas_init_rgb(&args.canvas, rgb, width, height);
+    memcpy(args.yuv, yuv, sizeof(args.yuv));
+    memcpy(args.yuv_linesize, linesize, sizeof(args.yuv_linesize));
+
+    report(results, "yuv_convert_rgb24", &args.canvas, 0, (double)width * height,
+           bench_convert, &args, min_seconds);
+
+    const struct { const char *name; yuv_row_fn fn; } kernels[] = {
+        {"yuv_convert_rgb24/scalar", yuv_row_scalar},
+        {"yuv_convert_rgb24/sse2", yuv_row_sse2},
+        {"yuv_convert_rgb24/avx2", yuv_row_avx2},
+    };
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (!kernels[i].fn) continue;
+        args.row_fn = kernels[i].fn;
+        report(results, kernels[i].name, &args.canvas, 0, (double)width * height,
+               bench_convert, &args, min_seconds);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double min_seconds = 0.25;
+    AppConfig defaults = config_get_default();
+    const char *font_path = defaults.font_path;
+    int num_questions = 50;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            min_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--font") == 0 && i + 1 < argc) {
+            font_path = argv[++i];
+        } else if (strcmp(argv[i], "--questions") == 0 && i + 1 < argc) {
+            num_questions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--generate-quiz") == 0 && i + 1 < argc) {
+            int count = atoi(argv[++i]);
+            int answers = i + 1 < argc ? atoi(argv[++i]) : 4;
+            if (count < 1 || answers < 2 || answers > MAX_ANSWERS) {
+                fprintf(stderr, "Need at least one question and 2-%d answers\n", MAX_ANSWERS);
+                return 1;
+            }
+            struct json_object *bank = generate_quiz(count, answers);
+            printf("%s\n", json_object_to_json_string_ext(bank, JSON_C_TO_STRING_PRETTY));
+            json_object_put(bank);
+            return 0;
+        } else {
+            fprintf(stderr, "Usage: %s [--time SECONDS] [--font PATH] [--questions N]\n"
+                    "       %s --generate-quiz N [ANSWERS]\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+    if (num_questions < 1) num_questions = 1;
+
+    yuv_init();
+    ColorScheme colors;
+    config_resolve_colors(&defaults, &colors);
+    RenderContext rc;
+    if (render_context_init(&rc, font_path, &colors) < 0) {
+        fprintf(stderr, "Failed to load font %s\n", font_path);
+        return 1;
+    }
+
+    struct json_object *root = json_object_new_object();
+    struct json_object *results = json_object_new_array();
+    json_object_object_add(root, "version", json_object_new_int(BENCH_FORMAT_VERSION));
+    json_object_object_add(root, "yuv_kernel", json_object_new_string(yuv_kernel_name()));
+    json_object_object_add(root, "min_seconds", json_object_new_double(min_seconds));
+    json_object_object_add(root, "questions", json_object_new_int(num_questions));
+    json_object_object_add(root, "results", results);
+
+    int ret = 0;
+    for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]) && ret == 0; r++) {
+        int width = resolutions[r][0], height = resolutions[r][1];
+        fprintf(stderr, "%dx%d\n", width, height);
+
+        /* One frame in each canvas format, like a render slot */
+        uint8_t *rgb = malloc((size_t)width * height * 3);
+        uint8_t *yuv = malloc((size_t)width * height * 3 / 2);
+        if (!rgb || !yuv) {
+            fprintf(stderr, "Failed to allocate %dx%d frame\n", width, height);
+            free(rgb);
+            free(yuv);
+            ret = -1;
+            break;
+        }
+        uint8_t *planes[3] = {yuv, yuv + width * height, yuv + width * height * 5 / 4};
+        int linesize[3] = {width, width / 2, width / 2};
+
+        Canvas canvas;
+        canvas_init_yuv(&canvas, planes, linesize, width, height, YUV_MATRIX_BT709);
+        ret = bench_canvas(results, &rc, &canvas, num_questions, min_seconds);
+        if (ret == 0) {
+            canvas_init_rgb(&canvas, rgb, width, height);
+            ret = bench_canvas(results, &rc, &canvas, num_questions, min_seconds);
+        }
+        if (ret == 0) {
+            bench_conversion(results, width, height, rgb, planes, linesize, min_seconds);
+        }
+
+        free(rgb);
+        free(yuv);
+    }
+
+    if (ret == 0) {
+        printf("%s\n", json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY));
+    }
+    json_object_put(root);
+    render_context_free(&rc);
+    return ret == 0 ? 0 : 1;
+}
@@ -2,6 +2,8 @@
 #define AUDIO_H
 
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
 
 /* Audio source types */
 typedef enum {
@@ -17,27 +19,85 @@ typedef struct {
     const char *voice_model;  /* Path to voice model (for TTS) */
     float speed;              /* 0.5 - 2.0 */
     int sample_rate;          /* e.g., 22050, 44100 */
+    const char *cache_dir;    /* Synthesized speech cache (NULL or "" = off) */
+    int64_t cache_max_bytes;  /* Least recently used entries go past this */
 } AudioConfig;
 
+/* audio_load_wav_ex flags */
+#define AUDIO_LOAD_S16 0x1   /* Keep int16 samples in samples_s16: half the memory */
+
 /* Audio data structure */
 typedef struct {
-    float *samples;      /* PCM audio samples (interleaved if stereo) */
+    float *samples;      /* PCM audio samples (interleaved if stereo), or NULL */
+    int16_t *samples_s16; /* Same, for sources loaded with AUDIO_LOAD_S16 */
     int num_samples;     /* Total samples (multiply by channels) */
     int sample_rate;     /* Samples per second */
     int channels;        /* 1 = mono, 2 = stereo */
     float duration;      /* Duration in seconds */
+    void *mapping;       /* File mapping samples_s16 points into, or NULL */
+    size_t mapping_size;
 } AudioSource;
 
-/* Initialize audio system with configuration */
+/* Receives decoded audio as interleaved float chunks at the file's rate.
+ * A negative return stops decoding. */
+typedef int (*AudioChunkFn)(void *user, const float *samples, int frames,
+                            int sample_rate, int channels);
+
+/* One user of the audio system with its own Piper process.
+ * Contexts share nothing but the on-disk cache, so each thread that
+ * synthesizes speech owns one. */
+typedef struct {
+    AudioConfig config;
+    int initialized;
+    pid_t piper_pid;          /* 0 until the first cache miss */
+    FILE *piper_in;           /* JSON requests to Piper, one per line */
+    FILE *piper_out;          /* Path of each finished WAV, one per line */
+    char *piper_dir;          /* Private directory Piper writes replies to */
+    unsigned int piper_requests;
+} AudioContext;
+
+/* Validate the configuration and prepare the cache directory */
+int audio_context_init(AudioContext *ctx, const AudioConfig *config);
+
+/* Generate audio from text using the context's TTS */
+AudioSource *audio_context_tts(AudioContext *ctx, const char *text);
+
+/* Stop the context's Piper process */
+void audio_context_free(AudioContext *ctx);
+
+/* Initialize the process-wide audio context */
 int audio_init(const AudioConfig *config);
 
-/* Generate audio from text using configured TTS */
+/* Generate audio from text using the process-wide context */
 AudioSource *audio_generate_tts(const char *text);
 
 /* Load audio from WAV file */
 AudioSource *audio_load_wav(const char *filepath);
 
-/* Get duration of audio (without loading full data) */
+/* Load audio with AUDIO_LOAD_* flags. 16-bit PCM WAV is read from a file
+ * mapping without the demuxer; with AUDIO_LOAD_S16 it is not even copied. */
+AudioSource *audio_load_wav_ex(const char *filepath, int flags);
+
+/* Decode a file chunk by chunk, e.g. straight into an encoder, without
+ * holding the whole file in memory. PCM WAV takes the mapped fast path.
+ * Returns 0 on success, -1 on error or when fn stopped decoding. */
+int audio_decode_stream(const char *filepath, AudioChunkFn fn, void *user);
+
+/* Duration of a file from its headers, without decoding samples.
+ * Returns -1 if the file cannot be probed. */
+float audio_probe_duration(const char *filepath);
+
+/* Probe count files on up to threads threads (0 = one per core).
+ * durations[i] is -1 where probing failed. */
+void audio_probe_durations(const char *const *paths, int count, float *durations,
+                           int threads);
+
+/* Duration of text the context synthesized before, from the TTS cache
+ * entry's header. Returns -1 if it is not cached. */
+float audio_context_tts_duration(AudioContext *ctx, const char *text);
+
+/* Duration of a file (probed), of cached speech, or else an estimate
+ * from the text length */
 float audio_get_duration(const char *text_or_file);
 
 /* Free audio source */
@@ -0,0 +1,136 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <pthread.h>
+#include "config.h"
+#include "quiz.h"
+#include "render.h"
+#include "render_pool.h"
+#include "segment_pool.h"
+#include "video.h"
+
+typedef enum {
+    BATCH_JOB_PENDING,
+    BATCH_JOB_STARTING,      /* A worker is loading the quiz and opening the output */
+    BATCH_JOB_RUNNING,
+    BATCH_JOB_DONE,
+    BATCH_JOB_FAILED
+} BatchJobStatus;
+
+typedef enum {
+    BATCH_EVENT_QUEUED,      /* Accepted by batch_submit */
+    BATCH_EVENT_STARTED,     /* Quiz loaded and output opened */
+    BATCH_EVENT_PROGRESS,    /* A segment finished encoding */
+    BATCH_EVENT_FINISHED     /* Output closed, job done or failed */
+} BatchEvent;
+
+/* One video of a batch: the base configuration with the job's overrides,
+ * split into segments that any worker can encode */
+typedef struct {
+    int id;
+    AppConfig config;
+    struct json_object *quiz_json;  /* Inline quiz, used instead of quiz_file */
+    ColorScheme colors;
+    QuizData quiz;
+    VideoEncoder output;
+
+    Segment *segments;
+    int num_segments;
+    int frames_per_question;
+    int total_frames;
+
+    /* Scheduling state, guarded by the batch lock */
+    BatchJobStatus status;
+    int next_claim;          /* Next segment a worker will take */
+    int next_mux;            /* Next segment to write to the output */
+    int in_flight;           /* Segments being encoded */
+    int muxing;              /* A worker is writing segments */
+    int frames_done;         /* Frames of segments finished so far */
+    int failed;
+    char error[128];
+    int closed;              /* Finished and reported; may be dropped */
+    int queued_behind;       /* Jobs waiting to start when it was submitted */
+
+    double start_time;
+    double seconds;          /* Wall time from first claim to close */
+
+    void *user;              /* Owner data for the event callback */
+} BatchJob;
+
+/* Called for each job event from a worker thread. All but FINISHED come
+ * with the batch lock held and must not block; FINISHED, the last call
+ * for a job, comes without it and may wait briefly. */
+typedef void (*BatchEventFn)(BatchJob *job, BatchEvent event);
+
+struct Batch;
+
+/* Thread with fonts, glyph atlas and frame buffer kept for the whole batch */
+typedef struct {
+    struct Batch *batch;
+    pthread_t thread;
+    int started;
+    RenderContext rc;
+    RenderSlot buffer;
+    int buffer_width, buffer_height, buffer_rgb;
+    int last_job;                /* Id of the job the sprite cache was built for */
+} BatchWorker;
+
+/* Many quizzes rendered in one process. Workers take segments in job
+ * order across all jobs, so several videos are in flight at once and no
+ * core idles while a job drains. Whichever worker finishes the next
+ * segment of a job writes it (and any that queued up behind it) to that
+ * job's output. */
+typedef struct Batch {
+    BatchJob **jobs;
+    int num_jobs;
+    int capacity;
+    int next_job;            /* First job that may still have segments to claim */
+    int next_id;
+
+    int max_running;         /* Jobs open at once (0 = no limit) */
+    int running;
+    int serving;             /* Workers wait for more jobs instead of exiting */
+    int starting;            /* Jobs being opened; their segments are still to come */
+    BatchEventFn on_event;
+
+    BatchWorker *workers;
+    int num_workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;     /* A job was added or finished */
+    char *report_path;
+} Batch;
+
+/* Empty batch with no workers */
+void batch_init(Batch *batch);
+
+/* Build a job from a manifest entry on top of the base config:
+ * {"quiz_file": "..." or "quiz": {<inline quiz>}, "output": "...",
+ *  "config": {<config.json overrides>}} */
+BatchJob *batch_job_new(const AppConfig *base, struct json_object *entry);
+
+/* Read a manifest and build one job per entry on top of the base config.
+ * Manifest: {"report": "path", "jobs": [<entry>, ...]} */
+int batch_load(Batch *batch, const char *manifest_file, const AppConfig *base);
+
+/* Load fonts once per worker and start rendering the queued jobs */
+int batch_start(Batch *batch, const AppConfig *base);
+
+/* Queue a job made by batch_job_new; the batch owns it from now on,
+ * and frees it on failure too */
+int batch_submit(Batch *batch, BatchJob *job);
+
+/* Jobs open and jobs submitted but not started yet */
+void batch_counts(Batch *batch, int *running, int *queued);
+
+/* Stop waiting for new jobs, finish the queued ones and join the workers */
+void batch_wait(Batch *batch);
+
+/* Encode every job and write the status report.
+ * Returns the number of failed jobs, or -1 if the batch could not start. */
+int batch_run(Batch *batch, const AppConfig *base);
+
+/* Free jobs and workers */
+void batch_free(Batch *batch);
+
+#endif // BATCH_H
@@ -0,0 +1,87 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <stdint.h>
+#include "colors.h"
+#include "yuv.h"
+
+/* Pixel layout of a drawing target */
+typedef enum {
+    CANVAS_RGB24,     /* Packed 24-bit RGB, converted to YUV before encoding */
+    CANVAS_YUV420P,   /* Planar YUV drawn directly into the encoder frame */
+    CANVAS_RGBA       /* Premultiplied RGBA layer, used to build sprites */
+} CanvasFormat;
+
+/* Pixel rectangle [x0, x1) x [y0, y1) */
+typedef struct {
+    int x0, y0;
+    int x1, y1;
+} CanvasRect;
+
+/* Drawing target shared by all primitives */
+typedef struct {
+    CanvasFormat format;
+    int width;
+    int height;
+    uint8_t *data[3];     /* RGB/RGBA: data[0] only; YUV: Y, U, V planes */
+    int linesize[3];
+    YuvMatrix matrix;     /* Converts palette colors in YUV mode */
+    CanvasRect clip;      /* Primitives only touch pixels inside this */
+} Canvas;
+
+/* Wrap a packed RGB24 buffer */
+static inline void canvas_init_rgb(Canvas *canvas, uint8_t *rgb_buffer,
+                                   int width, int height) {
+    Canvas c = {CANVAS_RGB24, width, height, {rgb_buffer, NULL, NULL},
+                {width * 3, 0, 0}, YUV_MATRIX_BT709, {0, 0, width, height}};
+    *canvas = c;
+}
+
+/* Wrap a premultiplied RGBA buffer */
+static inline void canvas_init_rgba(Canvas *canvas, uint8_t *rgba_buffer,
+                                    int width, int height) {
+    Canvas c = {CANVAS_RGBA, width, height, {rgba_buffer, NULL, NULL},
+                {width * 4, 0, 0}, YUV_MATRIX_BT709, {0, 0, width, height}};
+    *canvas = c;
+}
+
+/* Wrap YUV420P planes (e.g. an AVFrame) */
+static inline void canvas_init_yuv(Canvas *canvas, uint8_t *const data[3],
+                                   const int linesize[3], int width, int height,
+                                   YuvMatrix matrix) {
+    Canvas c = {CANVAS_YUV420P, width, height, {data[0], data[1], data[2]},
+                {linesize[0], linesize[1], linesize[2]}, matrix,
+                {0, 0, width, height}};
+    *canvas = c;
+}
+
+/* Restrict drawing to a rectangle (NULL clears the clip). On YUV canvases
+ * the rectangle must be even-aligned so chroma samples are not split. */
+static inline void canvas_set_clip(Canvas *canvas, const CanvasRect *rect) {
+    CanvasRect full = {0, 0, canvas->width, canvas->height};
+    if (!rect) {
+        canvas->clip = full;
+        return;
+    }
+    canvas->clip.x0 = rect->x0 > 0 ? rect->x0 : 0;
+    canvas->clip.y0 = rect->y0 > 0 ? rect->y0 : 0;
+    canvas->clip.x1 = rect->x1 < full.x1 ? rect->x1 : full.x1;
+    canvas->clip.y1 = rect->y1 < full.y1 ? rect->y1 : full.y1;
+}
+
+/* Blend src over dst with alpha in 0..256 */
+static inline void canvas_blend_u8(uint8_t *dst, uint8_t src, int alpha) {
+    *dst = (uint8_t)(*dst + (((src - *dst) * alpha + 128) >> 8));
+}
+
+/* Composite a color with coverage alpha (0..256) over a premultiplied
+ * RGBA pixel */
+static inline void canvas_blend_rgba(uint8_t *px, Color color, int alpha) {
+    int inv = 256 - alpha;
+    px[0] = (uint8_t)((color.r * alpha + px[0] * inv + 128) >> 8);
+    px[1] = (uint8_t)((color.g * alpha + px[1] * inv + 128) >> 8);
+    px[2] = (uint8_t)((color.b * alpha + px[2] * inv + 128) >> 8);
+    px[3] = (uint8_t)((255 * alpha + px[3] * inv + 128) >> 8);
+}
+
+#endif // CANVAS_H
@@ -41,11 +41,8 @@ extern const ColorScheme COLOR_SCHEME_COLORBLIND;
 extern const ColorScheme COLOR_SCHEME_COLORBLIND_ALTERNATIVE;
 extern const ColorScheme COLOR_SCHEME_DEFAULT;
 
-/* Active color scheme (can be changed at runtime) */
-extern ColorScheme active_colors;
-
-/* Initialize with a specific scheme */
-void colors_init(const ColorScheme *scheme);
+/* Initialize a scheme from a predefined one (NULL selects the default) */
+void colors_init(ColorScheme *colors, const ColorScheme *scheme);
 
 /* Helper to create Color from RGB values */
 static inline Color rgb(uint8_t r, uint8_t g, uint8_t b) {
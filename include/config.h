@@ -1,7 +1,10 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "audio.h"
+#include "canvas.h"
 #include "colors.h"
+#include "yuv.h"
 
 /* Layout configuration */
 typedef struct {
@@ -20,6 +23,10 @@ typedef struct {
 
     /* Timer bar */
     int timer_bar_height;
+
+    /* Sizes above are for the full-size frame and drawn multiplied by
+     * this (below 1 for draft renders) */
+    float scale;
 } LayoutConfig;
 
 /* Video configuration */
@@ -27,8 +34,108 @@ typedef struct {
     int width;
     int height;
     int fps;
+    YuvMatrix color_matrix;  /* RGB->YUV matrix ("bt601" or "bt709") */
+    CanvasFormat render_format;  /* Draw in "yuv420p" directly or "rgb24" */
 } VideoSettings;
 
+/* How frames move from the renderer to the encoder */
+typedef enum {
+    RENDER_MODE_POOL,        /* Worker threads render and convert whole frames */
+    RENDER_MODE_PIPELINE     /* Render, convert and encode stages on their own threads */
+} RenderMode;
+
+/* Render threading configuration */
+typedef struct {
+    RenderMode mode;     /* "pool" or "pipeline" */
+    int threads;         /* Render worker threads (0 = one per CPU) */
+    int queue_depth;     /* Frame buffers per worker (per stage in pipeline mode) */
+} RenderSettings;
+
+/* How the encoder spreads work over its own threads */
+typedef enum {
+    ENCODER_THREADS_AUTO,    /* Let the codec choose */
+    ENCODER_THREADS_FRAME,   /* Several frames in flight (more latency) */
+    ENCODER_THREADS_SLICE    /* Slices of one frame in parallel */
+} EncoderThreadType;
+
+/* Encoder configuration */
+typedef struct {
+    char preset[32];         /* x264 preset ("ultrafast" ... "veryslow") */
+    char tune[32];           /* x264 tune ("stillimage", "animation", "" = none) */
+    int crf;                 /* Constant quality 0-51 (used when bitrate is 0) */
+    int bitrate;             /* Target bitrate in kbit/s (0 = use crf) */
+    int keyint;              /* Frames between keyframes */
+    int b_frames;            /* Max consecutive B-frames */
+    int threads;             /* Encoder threads (0 = codec default) */
+    EncoderThreadType thread_type;
+    int segment_questions;   /* Questions per parallel encoder segment (0 = one encoder) */
+} EncoderSettings;
+
+/* Voiceover track muxed next to the video */
+typedef struct {
+    AudioSourceType source;  /* "none", "piper" (speak each question) or
+                                "file" (each question's "audio" WAV) */
+    const char *voice_model; /* Piper voice model */
+    float speed;             /* Speech speed, 0.5 - 2.0 */
+    int sample_rate;         /* AAC track sample rate */
+    int bitrate;             /* AAC bitrate in kbit/s */
+    const char *cache_dir;   /* Cache of synthesized speech ("" = off) */
+    int cache_max_mb;        /* Cache size limit */
+    int tts_workers;         /* Clips prepared at once while frames render */
+    int speak_answers;       /* Piper also reads the correct answer at the reveal */
+} AudioSettings;
+
+/* Limits for --serve mode */
+typedef struct {
+    int max_jobs;            /* Jobs rendering at once */
+    int max_queued;          /* Jobs waiting to start before new ones are refused */
+} ServerSettings;
+
+/* Container of the output */
+typedef enum {
+    OUTPUT_CONTAINER_AUTO,   /* From the file name; fragmented MP4 on a pipe */
+    OUTPUT_CONTAINER_MP4,    /* Regular MP4, needs a seekable file */
+    OUTPUT_CONTAINER_FMP4,   /* Fragmented MP4, playable while it is written */
+    OUTPUT_CONTAINER_MPEGTS
+} OutputContainer;
+
+/* Where streamed output starts a new fragment */
+typedef enum {
+    OUTPUT_FRAGMENT_KEYFRAME,  /* At every keyframe */
+    OUTPUT_FRAGMENT_QUESTION   /* At each question, which starts on a keyframe */
+} OutputFragment;
+
+/* What is done with the rendered frames */
+typedef enum {
+    OUTPUT_SINK_ENCODER,     /* H.264 in MP4 or MPEG-TS, with the voiceover */
+    OUTPUT_SINK_NULL,        /* Dropped, to time rendering on its own */
+    OUTPUT_SINK_Y4M,         /* Raw YUV4MPEG2 for another encoder */
+    OUTPUT_SINK_IMAGES       /* One PNG or JPEG per frame */
+} OutputSink;
+
+/* Most extra renditions one run writes */
+#define OUTPUT_MAX_RENDITIONS 4
+
+/* An extra, smaller copy of the video scaled from the rendered frames */
+typedef struct {
+    int width;
+    int height;
+    EncoderSettings encoder; /* The main encoder settings with this
+                                rendition's overrides */
+    char file[256];
+} RenditionSettings;
+
+/* Output muxing. The file may be "-" for stdout or "fd:N" for an
+ * inherited descriptor; those are written as a stream. The images sink
+ * takes a name like "frames/%05d.png", or numbers the frames itself. */
+typedef struct {
+    OutputSink sink;
+    OutputContainer container;
+    OutputFragment fragment;
+    RenditionSettings renditions[OUTPUT_MAX_RENDITIONS];
+    int num_renditions;
+} OutputSettings;
+
 /* Animation configuration */
 typedef struct {
     float question_fade_duration;  /* Seconds for question fade-in */
@@ -42,20 +149,46 @@ typedef struct {
     VideoSettings video;
     LayoutConfig layout;
     AnimationConfig animation;
+    RenderSettings render;
+    EncoderSettings encoder;
+    ServerSettings server;
+    AudioSettings audio;
+    OutputSettings output;
     const char *color_scheme;  /* "grayscale", "colorblind", "default" */
     const char *font_path;
     const char *quiz_file;
     const char *output_file;
 } AppConfig;
 
+struct json_object;
+
 /* Load configuration from JSON file */
 int config_load(AppConfig *config, const char *config_file);
 
+/* Apply the settings present in a parsed config object on top of the
+ * current ones (same layout as config.json) */
+void config_apply_json(AppConfig *config, struct json_object *root);
+
+/* Deep copy, so the copy can be overridden and freed on its own */
+int config_copy(AppConfig *dst, const AppConfig *src);
+
+/* Sink for "encoder", "null", "y4m" or "images" */
+int config_parse_sink(const char *name, OutputSink *sink);
+
 /* Free configuration resources */
 void config_free(AppConfig *config);
 
-/* Apply loaded configuration (set active colors, etc.) */
-int config_apply(const AppConfig *config);
+/* Apply loaded configuration (resolve the color scheme, etc.) */
+int config_apply(const AppConfig *config, ColorScheme *colors);
+
+/* Resolve the color scheme name without printing the configuration */
+int config_resolve_colors(const AppConfig *config, ColorScheme *colors);
+
+/* Turn the config into a quick preview: 1/divisor of the size with
+ * every layout metric scaled to match, about half the frame rate, the
+ * fastest encoder preset, no extra renditions, and ".draft" added to
+ * the output file name */
+int config_make_draft(AppConfig *config, int divisor);
 
 /* Get default configuration */
 AppConfig config_get_default(void);
@@ -0,0 +1,18 @@
+#ifndef FRAME_SINK_H
+#define FRAME_SINK_H
+
+#include "video.h"
+
+/* Sinks besides the H.264 encoder in video.c, picked by video_init
+ * from VideoConfig.sink */
+
+/* Drops every frame; renders at full speed with no encoder in the loop */
+extern const FrameSink frame_sink_null;
+
+/* Raw YUV4MPEG2 to a file, "-" or "fd:N", for any encoder that reads it */
+extern const FrameSink frame_sink_y4m;
+
+/* One PNG or JPEG file per frame, chosen by the file extension */
+extern const FrameSink frame_sink_images;
+
+#endif // FRAME_SINK_H
@@ -0,0 +1,68 @@
+#ifndef GLYPH_ATLAS_H
+#define GLYPH_ATLAS_H
+
+#include <stdint.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/* Size of one atlas page (8-bit coverage) */
+#define GLYPH_ATLAS_PAGE_SIZE 1024
+
+/* Rasterized glyph stored in the atlas */
+typedef struct {
+    int face_id;             /* Identifies the font the glyph came from */
+    int pixel_size;          /* Pixel size the glyph was rasterized at */
+    uint32_t codepoint;      /* Unicode codepoint */
+
+    const uint8_t *bitmap;   /* Coverage, points into an atlas page */
+    int pitch;               /* Bytes per bitmap row */
+    int width;               /* Bitmap width in pixels */
+    int rows;                /* Bitmap height in pixels */
+    int left;                /* Horizontal bearing (bitmap_left) */
+    int top;                 /* Vertical bearing (bitmap_top) */
+    int advance;             /* Pen advance in pixels */
+} Glyph;
+
+/* One page of packed glyph bitmaps (shelf packing) */
+typedef struct {
+    uint8_t *pixels;
+    int cursor_x;            /* Next free column on the current shelf */
+    int shelf_y;             /* Top of the current shelf */
+    int shelf_height;        /* Tallest glyph on the current shelf */
+} GlyphAtlasPage;
+
+/* Glyph cache keyed by (face, pixel size, codepoint) */
+typedef struct {
+    Glyph **chunks;          /* Glyph storage, never moves once allocated */
+    int num_chunks;
+    int count;               /* Glyphs stored */
+
+    int *index;              /* Open-addressing table of glyph numbers (-1 = empty) */
+    int index_capacity;      /* Power of two */
+
+    GlyphAtlasPage *pages;
+    int num_pages;
+} GlyphAtlas;
+
+/* Initialize an empty atlas */
+int glyph_atlas_init(GlyphAtlas *atlas);
+
+/* Look up a glyph, rasterizing it with FreeType on first use.
+ * The face must already be set to pixel_size. The returned pointer stays
+ * valid until the atlas is cleared or freed. */
+const Glyph *glyph_atlas_get(GlyphAtlas *atlas, FT_Face face, int face_id,
+                             int pixel_size, uint32_t codepoint);
+
+/* Rasterize a range of codepoints up front (e.g. printable ASCII) */
+void glyph_atlas_preload(GlyphAtlas *atlas, FT_Face face, int face_id,
+                         int pixel_size, uint32_t first, uint32_t last);
+
+/* Forget every glyph and release the pages; the next lookups rasterize
+ * again. Glyphs of one size cannot be removed on their own, as they share
+ * shelves with the others. */
+void glyph_atlas_clear(GlyphAtlas *atlas);
+
+/* Free all pages and glyphs */
+void glyph_atlas_free(GlyphAtlas *atlas);
+
+#endif // GLYPH_ATLAS_H
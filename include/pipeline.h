@@ -0,0 +1,77 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "config.h"
+#include "quiz.h"
+#include "render.h"
+#include "render_pool.h"
+
+/* Bounded single-producer/single-consumer queue of frame buffers.
+ * head and tail sit on separate cache lines so the two threads do not
+ * bounce one line between them. */
+typedef struct {
+    RenderSlot **items;
+    unsigned int mask;                      /* Capacity - 1 (power of two) */
+    _Alignas(64) atomic_uint head;          /* Next item to pop (consumer) */
+    _Alignas(64) atomic_uint tail;          /* Next free cell (producer) */
+} FrameRing;
+
+/* Time a stage spent waiting on its input queue */
+typedef struct {
+    unsigned long stalls;    /* Pops that found the queue empty */
+    double wait_seconds;     /* Total time spent waiting */
+} PipelineStageStats;
+
+/* Render, RGB->YUV conversion and encoding as three overlapping stages.
+ * A fixed set of frame buffers circulates free -> rendered -> converted ->
+ * free, always in the same order, so each buffer keeps its retained scene
+ * and partial repaints stay effective. The encode stage is the caller. */
+typedef struct {
+    /* Job, read-only while stages run */
+    QuizData *quiz;
+    const AppConfig *config;
+    int frames_per_question;
+    int total_frames;
+
+    RenderContext rc;
+    RenderSlot *slots;
+    int num_slots;
+
+    FrameRing free_frames;   /* encode -> render */
+    FrameRing rendered;      /* render -> convert */
+    FrameRing converted;     /* convert -> encode */
+
+    pthread_t render_thread;
+    pthread_t convert_thread;
+    int render_started;
+    int convert_started;
+
+    atomic_int stop;
+    atomic_int failed;
+    int next_out;            /* Next frame to hand to the encoder */
+
+    PipelineStageStats render_stats;   /* Waiting for a free buffer */
+    PipelineStageStats convert_stats;  /* Waiting for a rendered frame */
+    PipelineStageStats encode_stats;   /* Waiting for a converted frame */
+} Pipeline;
+
+/* Allocate frame buffers and start the render and convert stages */
+int pipeline_init(Pipeline *pipeline, const AppConfig *config,
+                  const ColorScheme *colors, QuizData *quiz);
+
+/* Wait for the next converted frame in presentation order.
+ * Returns NULL after the last frame or if a stage failed. */
+const RenderSlot *pipeline_next(Pipeline *pipeline);
+
+/* Give the slot from pipeline_next back to the render stage */
+void pipeline_release(Pipeline *pipeline, const RenderSlot *slot);
+
+/* Print per-stage stall counters */
+void pipeline_print_stats(const Pipeline *pipeline);
+
+/* Stop the stages and free everything */
+void pipeline_free(Pipeline *pipeline);
+
+#endif // PIPELINE_H
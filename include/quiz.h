@@ -3,10 +3,13 @@
 
 #include <stdint.h>
 #include "config.h"
+#include "canvas.h"
+#include "render.h"
 /* Maximum lengths */
 #define MAX_QUESTION_LEN 256
 #define MAX_ANSWER_LEN 128
 #define MAX_ANSWERS 6
+#define MAX_AUDIO_PATH_LEN 256
 
 typedef enum {
     QUIZ_TYPE_STANDARD,
@@ -22,6 +25,7 @@ typedef struct {
     int correct_answers[MAX_ANSWERS];
     int num_correct;
     int num_answers;
+    char audio_file[MAX_AUDIO_PATH_LEN];  /* Voiceover WAV ("" = none) */
 } QuizQuestion;
 
 /* Quiz configuration */
@@ -32,16 +36,21 @@ typedef struct {
     int reveal_duration;
 } QuizData;
 
+struct json_object;
+
 /* Load quiz from JSON file */
 int quiz_load(QuizData *quiz, const char *json_file);
 
+/* Load quiz from an already parsed object (same layout as the file) */
+int quiz_parse(QuizData *quiz, struct json_object *root);
+
 /* Free quiz data */
 void quiz_free(QuizData *quiz);
 
 /* Render quiz frame at specific time */
-int quiz_render_frame(QuizData *quiz, int question_index,
+int quiz_render_frame(RenderContext *rc, QuizData *quiz, int question_index,
                       float time_in_question,
-                      uint8_t *rgb_buffer, int width, int height,
+                      Canvas *canvas,
                       const LayoutConfig *layout,
                       const AnimationConfig *animation);
 
@@ -0,0 +1,61 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include "colors.h"
+#include "glyph_atlas.h"
+#include "scene.h"
+#include "sprite.h"
+#include "text.h"
+
+/* Font sizes a context keeps a face for; beyond that the least recently
+ * used face is replaced */
+#define RENDER_MAX_FACES 8
+
+/* Canvas buffers a context keeps a retained scene for */
+#define RENDER_MAX_SCENES 8
+
+/* Long-lived rendering state, created once per job.
+ * Owns the FreeType library, the font file loaded into memory, one face
+ * per pixel size, the color scheme and the render caches. Contexts share
+ * nothing, so separate renders can run in parallel with one context each. */
+typedef struct {
+    FT_Library library;
+    uint8_t *font_data;          /* Font file contents */
+    size_t font_data_size;
+    int font_id;                 /* Atlas key for the font */
+
+    TextContext faces[RENDER_MAX_FACES];
+    int num_faces;
+    unsigned long face_used[RENDER_MAX_FACES];
+    unsigned long face_clock;
+
+    ColorScheme colors;
+    GlyphAtlas atlas;
+    SpriteCache sprites;         /* Pre-composited elements of the current question */
+    /* Last frame drawn into each buffer, for partial repaints */
+    Scene scenes[RENDER_MAX_SCENES];
+    unsigned long scene_used[RENDER_MAX_SCENES];
+    unsigned long scene_clock;
+} RenderContext;
+
+/* Load the font and set up caches */
+int render_context_init(RenderContext *rc, const char *font_path,
+                        const ColorScheme *colors);
+
+/* Get the text context for a pixel size, creating the face on first use.
+ * The returned context is valid until the next call, which may replace
+ * it with another size. */
+TextContext *render_context_text(RenderContext *rc, int font_size);
+
+/* Get the retained scene for a canvas buffer. A buffer seen for the first
+ * time takes over the least recently used scene and is drawn in full. */
+Scene *render_context_scene(RenderContext *rc, const Canvas *canvas);
+
+/* Release fonts and caches */
+void render_context_free(RenderContext *rc);
+
+#endif // RENDER_H
@@ -0,0 +1,96 @@
+#ifndef RENDER_POOL_H
+#define RENDER_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "config.h"
+#include "quiz.h"
+#include "render.h"
+
+/* Upper bound on render threads */
+#define RENDER_POOL_MAX_WORKERS 64
+
+/* One frame buffer. Frame n always uses slot n % num_slots, so slots double
+ * as the reorder buffer between the workers and the encoder. */
+typedef struct {
+    int frame;               /* Frame held by the slot */
+    int question;            /* Question index of that frame */
+    int ready;               /* Rendered and waiting for the encoder */
+
+    uint8_t *rgb;            /* RGB canvas (rgb24 render format only) */
+    uint8_t *yuv[3];         /* Finished YUV420P frame */
+    int linesize[3];
+
+    /* RGB regions painted but not yet converted to YUV */
+    CanvasRect dirty[SCENE_MAX_DIRTY];
+    int num_dirty;
+} RenderSlot;
+
+struct RenderPool;
+
+/* Render thread with its own fonts, caches and scenes */
+typedef struct {
+    struct RenderPool *pool;
+    int index;
+    pthread_t thread;
+    int started;
+    RenderContext rc;
+} RenderWorker;
+
+/* Renders a quiz on several threads and hands frames out in order.
+ * Worker w renders frames w, w + N, w + 2N, ... so it always reuses the
+ * same slots, which keeps partial repaints effective per buffer. */
+typedef struct RenderPool {
+    /* Job, read-only while workers run */
+    QuizData *quiz;
+    const AppConfig *config;
+    int frames_per_question;
+    int total_frames;
+
+    RenderWorker *workers;
+    int num_workers;
+    RenderSlot *slots;
+    int num_slots;
+
+    pthread_mutex_t lock;
+    pthread_cond_t slot_ready;   /* A worker finished a frame */
+    pthread_cond_t slot_free;    /* The encoder released a frame */
+    int next_out;                /* Next frame to hand to the encoder */
+    int stop;
+    int failed;
+} RenderPool;
+
+/* Allocate a slot's YUV planes (plus an RGB canvas when use_rgb is set) */
+int render_slot_init(RenderSlot *slot, int width, int height, int use_rgb);
+
+/* Render frame n of a quiz into a slot's canvas without converting it */
+int render_slot_paint(RenderSlot *slot, RenderContext *rc, const AppConfig *config,
+                      QuizData *quiz, int frames_per_question, int n);
+
+/* Convert the regions painted since the last conversion to YUV
+ * (nothing to do for slots drawn in YUV) */
+void render_slot_convert(RenderSlot *slot, const AppConfig *config);
+
+/* Paint and convert in one go. RGB frames are converted to YUV only where
+ * the scene repainted. */
+int render_slot_draw(RenderSlot *slot, RenderContext *rc, const AppConfig *config,
+                     QuizData *quiz, int frames_per_question, int n);
+
+/* Free a slot's buffers */
+void render_slot_free(RenderSlot *slot);
+
+/* Create worker contexts and frame buffers and start rendering */
+int render_pool_init(RenderPool *pool, const AppConfig *config,
+                     const ColorScheme *colors, QuizData *quiz);
+
+/* Wait for the next frame in presentation order.
+ * Returns NULL after the last frame or if rendering failed. */
+const RenderSlot *render_pool_next(RenderPool *pool);
+
+/* Give the slot from render_pool_next back to the workers */
+void render_pool_release(RenderPool *pool, const RenderSlot *slot);
+
+/* Stop the workers and free everything */
+void render_pool_free(RenderPool *pool);
+
+#endif // RENDER_POOL_H
@@ -0,0 +1,64 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdint.h>
+#include "canvas.h"
+#include "colors.h"
+#include "sprite.h"
+
+/* Limits for one frame */
+#define SCENE_MAX_ITEMS 32
+#define SCENE_MAX_DIRTY 16
+
+typedef enum {
+    SCENE_FILL,              /* Whole canvas in a solid color */
+    SCENE_RECT,              /* Solid rectangle */
+    SCENE_SPRITE             /* Sprite blitted with a fade alpha */
+} SceneItemType;
+
+/* One drawing operation of a frame */
+typedef struct {
+    SceneItemType type;
+    CanvasRect rect;         /* Canvas area the item can touch */
+    Color color;             /* FILL/RECT */
+    const Sprite *sprite;    /* SPRITE */
+    uint32_t sprite_id;      /* Tells rebuilt sprites in a reused slot apart */
+    int alpha;               /* SPRITE fade, 0..256 */
+} SceneItem;
+
+/* Retained display list for one canvas buffer.
+ * Each frame is described as a list of items; scene_draw compares it with
+ * the list last drawn into the same buffer and repaints only the regions
+ * that changed, reusing the previous frame's pixels everywhere else. */
+typedef struct {
+    SceneItem items[SCENE_MAX_ITEMS];   /* Frame being described */
+    int num_items;
+    SceneItem prev[SCENE_MAX_ITEMS];    /* Frame currently in the buffer */
+    int num_prev;
+
+    /* Buffer the previous list was drawn into */
+    const uint8_t *buffer;
+    int width, height;
+    CanvasFormat format;
+    int valid;
+
+    /* Regions repainted by the last scene_draw (even-aligned) */
+    CanvasRect dirty[SCENE_MAX_DIRTY];
+    int num_dirty;
+} Scene;
+
+/* Start describing a new frame */
+void scene_begin(Scene *scene);
+
+/* Append items (dropped with a warning past SCENE_MAX_ITEMS) */
+void scene_fill(Scene *scene, Color color);
+void scene_rect(Scene *scene, int x, int y, int width, int height, Color color);
+void scene_sprite(Scene *scene, const Sprite *sprite, float alpha);
+
+/* Repaint the regions that differ from the previous frame in this buffer */
+void scene_draw(Scene *scene, Canvas *canvas);
+
+/* Forget the buffer contents so the next frame is drawn in full */
+void scene_invalidate(Scene *scene);
+
+#endif // SCENE_H
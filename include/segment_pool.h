@@ -0,0 +1,77 @@
+#ifndef SEGMENT_POOL_H
+#define SEGMENT_POOL_H
+
+#include <pthread.h>
+#include "config.h"
+#include "quiz.h"
+#include "render.h"
+#include "render_pool.h"
+#include "video.h"
+
+/* A run of whole questions rendered and encoded by one worker */
+typedef struct {
+    int first_question;
+    int num_questions;
+    int first_frame;         /* Output frame number of the first frame */
+    int num_frames;
+    int done;                /* Encoded and waiting to be muxed */
+    VideoSegment encoder;
+} Segment;
+
+struct SegmentPool;
+
+/* Thread that renders and encodes whole segments with its own fonts,
+ * caches and frame buffer */
+typedef struct {
+    struct SegmentPool *pool;
+    pthread_t thread;
+    int started;
+    RenderContext rc;
+    RenderSlot buffer;
+} SegmentWorker;
+
+/* Encodes a quiz as independent segments on several threads.
+ * Workers claim segments in order, each encoding into its own encoder
+ * instance; the caller muxes finished segments in presentation order.
+ * Workers stay at most queue_depth segments per thread ahead of the
+ * muxer so buffered packets stay bounded. */
+typedef struct SegmentPool {
+    /* Job, read-only while workers run */
+    QuizData *quiz;
+    const AppConfig *config;
+    const VideoEncoder *output;  /* Segment encoders copy its settings */
+    int frames_per_question;
+    int total_frames;
+
+    SegmentWorker *workers;
+    int num_workers;
+    Segment *segments;
+    int num_segments;
+    int max_ahead;               /* Segments encoded ahead of the muxer */
+
+    pthread_mutex_t lock;
+    pthread_cond_t segment_done; /* A worker finished a segment */
+    pthread_cond_t segment_free; /* The muxer released a segment */
+    int next_claim;              /* Next segment a worker will take */
+    int next_out;                /* Next segment to hand to the muxer */
+    int stop;
+    int failed;
+} SegmentPool;
+
+/* Split the quiz into segments of config->encoder.segment_questions
+ * questions and start encoding them */
+int segment_pool_init(SegmentPool *pool, const AppConfig *config,
+                      const ColorScheme *colors, QuizData *quiz,
+                      const VideoEncoder *output);
+
+/* Wait for the next segment in presentation order.
+ * Returns NULL after the last segment or if encoding failed. */
+Segment *segment_pool_next(SegmentPool *pool);
+
+/* Free the segment's encoder and let workers move further ahead */
+void segment_pool_release(SegmentPool *pool, Segment *segment);
+
+/* Stop the workers and free everything */
+void segment_pool_free(SegmentPool *pool);
+
+#endif // SEGMENT_POOL_H
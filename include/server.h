@@ -0,0 +1,51 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "batch.h"
+#include "config.h"
+
+/* Largest request a client may send */
+#define SERVER_MAX_REQUEST (4 * 1024 * 1024)
+
+/* Connections still sending their request; more wait in the backlog */
+#define SERVER_MAX_PENDING 64
+
+/* A connection whose request has not fully arrived */
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t len;
+    size_t capacity;
+    double deadline;         /* Monotonic seconds; rejected after this */
+} ServerClient;
+
+/* Render daemon on a Unix domain socket. Workers keep fonts, glyph atlases
+ * and frame buffers loaded between requests.
+ *
+ * A client connects and sends one JSON job, the same as a batch manifest
+ * entry, terminated by a newline or by closing its write side:
+ *   {"quiz": {...} or "quiz_file": "...", "output": "...", "config": {...}}
+ * The server answers with one JSON event per line ("queued", "started",
+ * "progress", then "done" or "failed"; "rejected" if the queue is full)
+ * and closes the connection after the last one. */
+typedef struct {
+    Batch batch;
+    const AppConfig *config;
+    char *socket_path;
+    int listen_fd;
+    /* Requests are read from all of these and the listen socket in one
+     * poll, so a slow client never holds up the others */
+    ServerClient clients[SERVER_MAX_PENDING];
+    int num_clients;
+} Server;
+
+/* Bind the socket and start the render workers */
+int server_init(Server *server, const char *socket_path, const AppConfig *config);
+
+/* Accept jobs until SIGINT or SIGTERM, then finish the accepted ones */
+int server_run(Server *server);
+
+/* Close the socket and free the workers */
+void server_free(Server *server);
+
+#endif // SERVER_H
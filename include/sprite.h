@@ -0,0 +1,68 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include <stdint.h>
+#include "canvas.h"
+
+/* Slots per sprite cache (enough for every element of one question) */
+#define SPRITE_CACHE_SLOTS 32
+
+/* Pre-composited element stored premultiplied in the canvas format it is
+ * blitted to. RGB sprites hold premultiplied RGB plus coverage; YUV sprites
+ * hold premultiplied Y/U/V plus coverage at luma and chroma resolution.
+ * YUV sprites start on an even pixel so chroma samples line up. */
+typedef struct {
+    CanvasFormat format;
+    int x, y;                /* Canvas position of the top-left pixel */
+    int width, height;
+
+    uint8_t *data[3];        /* RGB: data[0] only; YUV: Y, U, V planes */
+    int linesize[3];
+    uint8_t *alpha[2];       /* Coverage: [0] per pixel, [1] per chroma sample */
+    int alpha_linesize[2];
+    uint32_t id;             /* Changes whenever a cache slot is rebuilt */
+} Sprite;
+
+/* Sprites for one owner (e.g. a question), dropped when the owner or the
+ * render key (layout, colors, canvas format) changes */
+typedef struct {
+    const void *owner;
+    uint32_t key;
+    uint32_t next_id;
+    Sprite slots[SPRITE_CACHE_SLOTS];
+    int valid[SPRITE_CACHE_SLOTS];
+} SpriteCache;
+
+/* Allocate a transparent premultiplied RGBA layer to draw an element into.
+ * The rectangle is widened to even bounds (at least 2x2) in place. */
+int sprite_layer_alloc(Canvas *layer, int *x, int *y, int *width, int *height);
+
+/* Free a layer from sprite_layer_alloc */
+void sprite_layer_free(Canvas *layer);
+
+/* Convert a finished layer placed at (x, y) to a sprite for the target
+ * canvas format */
+int sprite_init(Sprite *sprite, const Canvas *layer, int x, int y,
+                CanvasFormat format, YuvMatrix matrix);
+
+/* Composite a sprite onto a canvas of the same format, scaled by a global
+ * fade alpha (0..1) */
+void sprite_blit(Canvas *canvas, const Sprite *sprite, float alpha);
+
+/* Free sprite planes */
+void sprite_free(Sprite *sprite);
+
+/* Bind the cache to an owner and key, dropping stale sprites */
+void sprite_cache_bind(SpriteCache *cache, const void *owner, uint32_t key);
+
+/* Get a built sprite, or NULL if the slot is empty */
+Sprite *sprite_cache_get(SpriteCache *cache, int slot);
+
+/* Convert a layer into a cache slot and return the sprite */
+Sprite *sprite_cache_store(SpriteCache *cache, int slot, const Canvas *layer,
+                           int x, int y, CanvasFormat format, YuvMatrix matrix);
+
+/* Free all cached sprites */
+void sprite_cache_free(SpriteCache *cache);
+
+#endif // SPRITE_H
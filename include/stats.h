@@ -0,0 +1,42 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* Stages timed per call */
+typedef enum {
+    STATS_RENDER,           /* quiz_render_frame into a frame buffer */
+    STATS_CONVERT,          /* RGB24 -> YUV420P of the repainted regions */
+    STATS_ENCODE_SEND,      /* avcodec_send_frame of a video frame */
+    STATS_ENCODE_RECEIVE,   /* avcodec_receive_packet of a video packet */
+    STATS_MUX_WRITE,        /* Writing one packet to the output */
+    STATS_NUM_STAGES
+} StatsStage;
+
+/* Per-stage latency histograms, bytes written and encoder queue depth for
+ * one run. The collector is process-wide and off until stats_enable, so
+ * the single-video command line turns it on and batch jobs never do.
+ * Recording is lock-free and safe from any thread. */
+
+/* Start collecting; the run's wall clock starts here */
+void stats_enable(void);
+
+/* Timestamp for stats_stop, or 0 when neither stats nor tracing is on */
+uint64_t stats_start(void);
+
+/* Record the time since stats_start for a stage; also a trace span
+ * while tracing */
+void stats_stop(StatsStage stage, uint64_t start);
+
+/* Count bytes written to the output */
+void stats_add_bytes(uint64_t bytes);
+
+/* Sample the number of frames sent to a video encoder and not yet
+ * received back as packets */
+void stats_encoder_queue(int depth);
+
+/* Print the summary and write it as JSON to json_file (NULL for none).
+ * frames is the number of frames the run produced. */
+int stats_report(int frames, const char *json_file);
+
+#endif // STATS_H
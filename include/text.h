@@ -1,26 +1,37 @@
 #ifndef TEXT_H
 #define TEXT_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include "canvas.h"
+#include "glyph_atlas.h"
 
 typedef struct {
-  FT_Library library;
   FT_Face face;
   int font_size;
+  int face_id;        /* Atlas key for this font */
+  GlyphAtlas *atlas;  /* Rasterized glyph cache (owned by the RenderContext) */
 } TextContext;
 
-int text_init(TextContext *ctx, const char *font_path, int font_size);
+/* Create a face at font_size from a font file already loaded in memory */
+int text_init(TextContext *ctx, FT_Library library,
+              const uint8_t *font_data, size_t font_data_size,
+              int font_size, int face_id, GlyphAtlas *atlas);
 
-int text_render_alpha(TextContext *ctx, uint8_t *rgb_buffer, int buffer_width,
-                int buffer_height, const char *text, int x, int y,
+int text_render_alpha(TextContext *ctx, Canvas *canvas,
+                const char *text, int x, int y,
                 uint8_t r, uint8_t g, uint8_t b, float alpha);
 
 int text_measure_width(TextContext *ctx, const char *text);
 
-int text_render_centered_alpha(TextContext *ctx, uint8_t *rgb_buffer,
-                         int buffer_width, int buffer_height,
+/* Ink bounds [x0,x1) x [y0,y1) of a string relative to its pen origin
+ * on the baseline (y0 is negative above the baseline) */
+void text_measure_box(TextContext *ctx, const char *text,
+                      int *x0, int *y0, int *x1, int *y1);
+
+int text_render_centered_alpha(TextContext *ctx, Canvas *canvas,
                          const char *text, int y,
                          uint8_t r, uint8_t g, uint8_t b, float alpha);
 
@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Chrome trace-event recorder (chrome://tracing, Perfetto).
+ * Spans are kept in per-thread buffers and written as complete ("X")
+ * events by trace_close. Like stats it is process-wide and only the
+ * single-video command line opens it. trace_active is set before any
+ * worker thread starts and cleared after they are all joined, so a
+ * span costs one load and a branch while tracing is off. */
+
+extern int trace_active;
+
+/* Monotonic nanoseconds, the clock stats_start uses too */
+uint64_t trace_now(void);
+
+/* Start tracing into json_file */
+int trace_open(const char *json_file);
+
+/* Name the calling thread's track; name must be a string literal */
+void trace_thread_name(const char *name);
+
+/* Record a span on the calling thread; name must be a string literal */
+void trace_span(const char *name, uint64_t start, uint64_t end);
+
+/* Timestamp for trace_end, or 0 while tracing is off */
+static inline uint64_t trace_begin(void) {
+    return trace_active ? trace_now() : 0;
+}
+
+/* End a span started with trace_begin */
+static inline void trace_end(const char *name, uint64_t start) {
+    if (start) {
+        trace_span(name, start, trace_now());
+    }
+}
+
+/* Write the trace file and free the buffers; all traced threads must
+ * have exited */
+int trace_close(void);
+
+#endif // TRACE_H
@@ -1,53 +1,193 @@
 #ifndef VIDEO_H
 #define VIDEO_H
 
+#include <stdio.h>
+#include <pthread.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/opt.h>
 #include <libswscale/swscale.h>
 #include "colors.h"
+#include "canvas.h"
+#include "config.h"
+#include "yuv.h"
 
 /* Video configuration structure */
 typedef struct{
   int width;
   int height;
   int fps;
-  const char *output_filename;
+  YuvMatrix color_matrix;
+  EncoderSettings encoder;
+  int segmented;      /* Frames come from VideoSegment encoders */
+  int audio_sample_rate;  /* Mono AAC track (0 = video only) */
+  int audio_bitrate;      /* kbit/s */
+  OutputContainer container;
+  int fragment_frames;    /* Fragmented output: a fragment every this many
+                             frames, each opening on a forced IDR (0 = at keyframes) */
+  const char *output_filename;  /* Path, "-" (stdout) or "fd:N" */
+  OutputSink sink;        /* Where frames go; only the encoder sink muxes
+                             audio and takes segments */
+  const RenditionSettings *renditions;  /* Smaller copies of every frame,
+                                           each to its own file */
+  int num_renditions;
 } VideoConfig;
 
-/* Initialize video encoder */
-int video_init(VideoConfig *config);
+struct VideoRendition;
+struct VideoEncoder;
+
+/* One kind of output. write takes enc->frame as frame enc->frame_count;
+ * close flushes and finishes the output when finish is set, and always
+ * frees what open allocated (it is also called after a failed open). */
+typedef struct {
+  const char *name;
+  int (*open)(struct VideoEncoder *enc, const VideoConfig *config);
+  int (*write)(struct VideoEncoder *enc);
+  void (*close)(struct VideoEncoder *enc, int finish);
+} FrameSink;
+
+/* One output file and its encoder. Encoders share nothing, so several
+ * outputs can be written side by side from different threads. */
+typedef struct VideoEncoder {
+  VideoConfig settings;
+  const FrameSink *sink;
+  AVFormatContext *format_ctx;
+  AVCodecContext *codec_ctx;
+  AVStream *video_stream;
+  AVFrame *frame;
+  AVPacket *packet;
+  int frame_count;
+  int queued_frames;         /* Sent to the video encoder, no packet back yet */
+  int header_written;
+  int streaming;             /* Written to a pipe, fragment by fragment */
+  int fragment_frames;       /* Frames per fragment (0 = not cut by frame count) */
+  YuvMatrix color_matrix;
+
+  /* Audio track, when audio_sample_rate is set */
+  AVCodecContext *audio_ctx;
+  AVStream *audio_stream;
+  AVFrame *audio_frame;      /* Samples waiting for a full encoder frame */
+  int audio_fill;
+  int64_t audio_samples;     /* Samples sent to the audio encoder */
+
+  /* Raw and image sinks */
+  FILE *raw_file;            /* YUV4MPEG2 stream */
+  struct SwsContext *image_scaler;  /* To the image codec's pixel format */
+  AVFrame *image_frame;
+  char image_pattern[1024];  /* File name with one %d for the frame number */
+
+  /* Outputs scaled from each frame this encoder is given */
+  struct VideoRendition *renditions;
+  int num_renditions;
+} VideoEncoder;
+
+/* Extra output fed from the main encoder's frames. Its thread scales each
+ * frame with swscale and encodes it, so renditions run alongside the main
+ * encoder and each other; the frame is only rendered once. */
+typedef struct VideoRendition {
+  VideoEncoder output;
+  struct SwsContext *scaler;
+  pthread_t thread;
+  int started;
+
+  /* Work handed over by the main encoder, guarded by lock */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  AVFrame *source;           /* Reference to the frame to scale, or empty */
+  float *audio;              /* Voiceover samples not yet encoded */
+  int audio_count;
+  int audio_capacity;
+  int stop;
+  int failed;
+} VideoRendition;
+
+/* Independent encoder for a run of consecutive frames. Segments open with
+ * an IDR and reference nothing outside themselves, so their packets can be
+ * concatenated into the output without re-encoding. Requires an encoder
+ * initialized with segmented set; segments may be encoded on any thread. */
+typedef struct {
+  AVCodecContext *codec_ctx;
+  AVFrame *frame;
+  AVPacket **packets;      /* Encoded packets, timestamps local to the segment */
+  int num_packets;
+  int capacity;
+  int first_frame;         /* Output frame number of the first frame */
+  int frame_count;         /* Frames sent to the encoder */
+  int queued_frames;       /* Sent, no packet back yet */
+  int fragment_frames;     /* Force an IDR at these output frame multiples */
+} VideoSegment;
+
+/* Open the output file (or stream) and its sink, and one more output
+ * with its own thread for each rendition. Renditions get their frames
+ * from the video_write_frame_* calls, so they cannot be segmented. */
+int video_init(VideoEncoder *enc, const VideoConfig *config);
 
 /* Write a single frame with solid color */
-int video_write_frame(uint8_t r, uint8_t g, uint8_t b);
+int video_write_frame(VideoEncoder *enc, uint8_t r, uint8_t g, uint8_t b);
 
 /* Write a frame from RGB buffer */
-int video_write_frame_rgb(uint8_t *rgb_buffer);
+int video_write_frame_rgb(VideoEncoder *enc, uint8_t *rgb_buffer);
+
+/* Write a frame from RGB buffer, converting only the given even-aligned
+ * regions; the rest of the frame keeps the previous frame's YUV */
+int video_write_frame_rgb_rects(VideoEncoder *enc, uint8_t *rgb_buffer,
+                                const CanvasRect *rects, int num_rects);
 
-/* FIll RGB buffer with color */
-void video_fill_rgb_color(uint8_t *rgb_buffer, int width, int height, Color color);
+/* Write a frame from YUV420P planes (copied into the encoder frame) */
+int video_write_frame_planes(VideoEncoder *enc, uint8_t *const data[3],
+                             const int linesize[3]);
 
-/* Fill RGB buffer with solid color */
-void video_fill_rgb(uint8_t *rgb_buffer, int width, int height,
-                    uint8_t r, uint8_t g, uint8_t b);
+/* Get a canvas over the encoder's YUV420P frame for drawing directly
+ * (call once per frame, before drawing) */
+int video_get_canvas(VideoEncoder *enc, Canvas *canvas);
+
+/* Encode the frame drawn through video_get_canvas */
+int video_write_frame_yuv(VideoEncoder *enc);
+
+/* Fill canvas with color */
+void video_fill_rgb_color(Canvas *canvas, Color color);
+
+/* Fill canvas with solid color */
+void video_fill_rgb(Canvas *canvas, uint8_t r, uint8_t g, uint8_t b);
 
 /* Get total frames written */
-int video_get_frame_count(void);
+int video_get_frame_count(const VideoEncoder *enc);
 
-/* Draw filled rectangle on RGB buffer */
-void video_draw_rect(uint8_t *rgb_buffer, int buffer_width, int buffer_height,
-                     int x, int y, int width, int height,
+/* Draw filled rectangle on canvas */
+void video_draw_rect(Canvas *canvas, int x, int y, int width, int height,
                      uint8_t r, uint8_t g, uint8_t b);
 
 /* Draw timer bar (progress indicator) */
-void video_draw_timer_bar(uint8_t *rgb_buffer, int buffer_width, int buffer_height,
-                          float progress, int bar_height);
+void video_draw_timer_bar(Canvas *canvas, float progress, int bar_height,
+                          const ColorScheme *colors);
 
 /* Draw filled rectangle with rounded corners */
-void video_draw_rounded_rect_alpha(uint8_t *rgb_buffer, int buffer_width, int buffer_height,
-                              int x, int y, int width, int height, int radius,
-                              Color color, float alpha);
+void video_draw_rounded_rect_alpha(Canvas *canvas,
+                                   int x, int y, int width, int height, int radius,
+                                   Color color, float alpha);
+
+/* Open an encoder for a segment starting at output frame first_frame */
+int video_segment_init(const VideoEncoder *enc, VideoSegment *seg, int first_frame);
+
+/* Encode one frame from YUV420P planes into the segment */
+int video_segment_write_planes(VideoSegment *seg, uint8_t *const data[3],
+                               const int linesize[3]);
+
+/* Flush the segment encoder after its last frame */
+int video_segment_finish(VideoSegment *seg);
+
+/* Mux a finished segment's packets, rebased onto the output timeline.
+ * Segments must be written in order from a single thread. */
+int video_write_segment(VideoEncoder *enc, VideoSegment *seg);
+
+/* Free the segment encoder and any packets not yet written */
+void video_segment_free(VideoSegment *seg);
+
+/* Append mono float samples at audio_sample_rate to the audio track.
+ * The track starts at time zero and is encoded in full AAC frames, so
+ * calls may pass any number of samples. Renditions get the same track. */
+int video_write_audio(VideoEncoder *enc, const float *samples, int count);
 
-/*Close video encoder and write file*/
-void video_close(void);
+/*Close video encoder and write file, after finishing its renditions*/
+void video_close(VideoEncoder *enc);
 #endif // VIDEO_H
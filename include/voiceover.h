@@ -0,0 +1,77 @@
+#ifndef VOICEOVER_H
+#define VOICEOVER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "audio.h"
+#include "config.h"
+#include "quiz.h"
+#include "video.h"
+
+typedef enum {
+    VOICEOVER_CLIP_PENDING,
+    VOICEOVER_CLIP_READY,
+    VOICEOVER_CLIP_FAILED
+} VoiceoverClipState;
+
+/* A stretch of speech placed at a fixed point of the track */
+typedef struct {
+    int question;
+    char *text;                  /* Spoken by Piper, or NULL */
+    const char *file;            /* Loaded from disk, or NULL */
+    int64_t start;               /* Track sample the clip starts on */
+    int64_t max_length;          /* Samples until the next clip's slot */
+    float *samples;              /* Mono samples at sample_rate */
+    int length;
+    VoiceoverClipState state;
+} VoiceoverClip;
+
+struct Voiceover;
+
+typedef struct {
+    struct Voiceover *vo;
+    pthread_t thread;
+    int started;
+    AudioContext audio;          /* Own Piper process */
+} VoiceoverWorker;
+
+/* Spoken track for a quiz: a clip per question (and per reveal with
+ * speak_answers), each starting on its first frame and cut off where the
+ * next one's slot starts. Everything else is silence. Clips are prepared
+ * by a pool of workers while the video renders; voiceover_write only
+ * waits when it reaches a clip that is not ready yet. */
+typedef struct Voiceover {
+    int enabled;
+    VoiceoverClip *clips;        /* In track order */
+    int num_clips;
+    int next_clip;               /* First clip not fully written */
+    int sample_rate;
+    int fps;
+    int64_t written;             /* Track samples sent to the encoder */
+
+    VoiceoverWorker *workers;
+    int num_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t clip_done;    /* A worker finished a clip */
+    int next_claim;              /* Next clip a worker will prepare */
+    int stop;
+} Voiceover;
+
+/* Start preparing every clip on audio.tts_workers threads. With no audio
+ * source configured the voiceover stays empty and voiceover_write does
+ * nothing. The quiz must outlive the voiceover. */
+int voiceover_init(Voiceover *vo, const AppConfig *config, const QuizData *quiz);
+
+/* Whether there is a track to mux */
+int voiceover_enabled(const Voiceover *vo);
+
+/* Send the track up to the end of video frame number frames - 1, so audio
+ * is interleaved with the video written so far. Waits for clips that are
+ * still being prepared; one that could not be is written as silence.
+ * Fails only if the encoder does. */
+int voiceover_write(Voiceover *vo, VideoEncoder *video, int frames);
+
+/* Stop the workers and free the clips */
+void voiceover_free(Voiceover *vo);
+
+#endif // VOICEOVER_H
@@ -0,0 +1,63 @@
+#ifndef YUV_H
+#define YUV_H
+
+#include <stdint.h>
+
+/* RGB -> YUV matrix (limited/TV range output) */
+typedef enum {
+    YUV_MATRIX_BT601,
+    YUV_MATRIX_BT709
+} YuvMatrix;
+
+/* 8.8 fixed-point conversion coefficients */
+typedef struct {
+    int16_t y[3];  /* R, G, B weights for luma */
+    int16_t u[3];  /* R, G, B weights for Cb */
+    int16_t v[3];  /* R, G, B weights for Cr */
+} YuvCoeffs;
+
+/* Converts one pair of RGB24 rows into two luma rows and one chroma row */
+typedef void (*yuv_row_fn)(const uint8_t *rgb0, const uint8_t *rgb1,
+                           uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                           int width, const YuvCoeffs *k);
+
+/* Select the fastest kernel for this CPU (cpuid). Safe to call repeatedly
+ * and from several threads at once. */
+void yuv_init(void);
+
+/* Name of the selected kernel ("avx2", "sse2" or "scalar") */
+const char *yuv_kernel_name(void);
+
+/* Coefficients for a matrix */
+const YuvCoeffs *yuv_coeffs(YuvMatrix matrix);
+
+/* Parse "bt601"/"bt709" (returns -1 if unknown) */
+int yuv_matrix_from_name(const char *name, YuvMatrix *matrix);
+
+/* Convert one RGB color */
+void yuv_from_rgb(YuvMatrix matrix, uint8_t r, uint8_t g, uint8_t b,
+                  uint8_t *y, uint8_t *u, uint8_t *v);
+
+/* Convert a packed RGB24 image to YUV420P with 2x2 chroma averaging */
+void yuv_convert_rgb24(const uint8_t *rgb, int rgb_stride,
+                       uint8_t *const dst[3], const int dst_stride[3],
+                       int width, int height, YuvMatrix matrix);
+
+/* Convert only the rectangle at (x, y) of the image; x and y must be even.
+ * rgb and dst point at the image origin. */
+void yuv_convert_rgb24_rect(const uint8_t *rgb, int rgb_stride,
+                            uint8_t *const dst[3], const int dst_stride[3],
+                            int x, int y, int width, int height, YuvMatrix matrix);
+
+/* Same conversion forced onto a specific row kernel (reference/benchmarks) */
+void yuv_convert_rgb24_with(yuv_row_fn row_fn,
+                            const uint8_t *rgb, int rgb_stride,
+                            uint8_t *const dst[3], const int dst_stride[3],
+                            int width, int height, YuvMatrix matrix);
+
+/* Individual row kernels; SIMD ones are NULL when not compiled in */
+extern const yuv_row_fn yuv_row_scalar;
+extern const yuv_row_fn yuv_row_sse2;
+extern const yuv_row_fn yuv_row_avx2;
+
+#endif // YUV_H
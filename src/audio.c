@@ -1,23 +1,528 @@
+#define _GNU_SOURCE   /* pipe2 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libswresample/swresample.h>
+#include <json-c/json.h>
 #include "audio.h"
+#include "trace.h"
 
-/* Global audio configuration */
-static AudioConfig global_audio_config = {0};
-static int audio_initialized = 0;
+/* Context behind audio_init/audio_generate_tts/audio_cleanup */
+static AudioContext default_context = {0};
 
-int audio_init(const AudioConfig *config) {
+extern char **environ;
+
+/* Seconds Piper has to answer one sentence before it is restarted */
+#define PIPER_REPLY_TIMEOUT 60
+
+static AudioSource *load_pcm_wav(const char *filepath, int flags);
+
+/* Synthesized speech cache. Entries are named by a hash of everything
+ * that affects synthesis and hold the decoded PCM, so a hit skips both
+ * Piper and the WAV decode. Entries are written to a temp file and
+ * renamed into place; a hit bumps the mtime, which eviction treats as
+ * the last use. */
+#define TTS_CACHE_VERSION 1
+#define TTS_CACHE_TEMP_PREFIX "tmp-"
+#define TTS_CACHE_TEMP_MAX_AGE 3600   /* Seconds before an orphaned temp file goes */
+
+typedef struct {
+    char magic[4];               /* "QVTC" */
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t num_samples;
+    uint32_t key_length;         /* Key bytes follow, then the samples */
+} TtsCacheHeader;
+
+typedef struct {
+    char name[64];
+    off_t size;
+    struct timespec used;        /* mtime, bumped on every hit */
+} TtsCacheEntry;
+
+static int tts_cache_enabled(const AudioConfig *config) {
+    return config->cache_dir && config->cache_dir[0];
+}
+
+/* mkdir -p */
+static int make_dirs(const char *path) {
+    char buf[PATH_MAX];
+    if (snprintf(buf, sizeof(buf), "%s", path) >= (int)sizeof(buf)) {
+        return -1;
+    }
+    for (char *p = buf + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(buf, 0755) < 0 && errno != EEXIST) return -1;
+            *p = '/';
+        }
+    }
+    if (mkdir(buf, 0755) < 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+static uint64_t fnv1a(const char *data, size_t len, uint64_t hash) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Everything that changes the synthesized audio. The voice model's size
+ * and mtime are included because a retrained model keeps its path. */
+static char *tts_cache_key(const AudioConfig *config, const char *text, size_t *length) {
+    long long model_size = 0, model_mtime = 0;
+    struct stat st;
+    if (stat(config->voice_model, &st) == 0) {
+        model_size = st.st_size;
+        model_mtime = st.st_mtime;
+    }
+
+    const char *fmt = "%s\n%s\n%lld\n%lld\n%.3f\n%d";
+    int len = snprintf(NULL, 0, fmt, text, config->voice_model,
+                       model_size, model_mtime, config->speed,
+                       config->sample_rate);
+    char *key = malloc(len + 1);
+    if (!key) {
+        return NULL;
+    }
+    snprintf(key, len + 1, fmt, text, config->voice_model,
+             model_size, model_mtime, config->speed,
+             config->sample_rate);
+    *length = len;
+    return key;
+}
+
+static void tts_cache_path(const AudioConfig *config, const char *key, size_t length,
+                           char *path, size_t size) {
+    uint64_t h1 = fnv1a(key, length, 14695981039346656037ULL);
+    uint64_t h2 = fnv1a(key, length, h1 ^ 0x9e3779b97f4a7c15ULL);
+    snprintf(path, size, "%s/%016llx%016llx.pcm", config->cache_dir,
+             (unsigned long long)h1, (unsigned long long)h2);
+}
+
+/* Read an entry's header and check it was made for exactly this key */
+static int tts_cache_read_header(FILE *file, const char *key, size_t length,
+                                 TtsCacheHeader *header) {
+    if (fread(header, sizeof(*header), 1, file) != 1 ||
+        memcmp(header->magic, "QVTC", 4) != 0 || header->version != TTS_CACHE_VERSION ||
+        header->key_length != length || header->channels == 0 || header->sample_rate == 0) {
+        return -1;
+    }
+
+    char *stored = malloc(length);
+    int match = stored && fread(stored, 1, length, file) == length &&
+                memcmp(stored, key, length) == 0;
+    free(stored);
+    return match ? 0 : -1;
+}
+
+/* Read an entry after checking it was made for exactly this key */
+static AudioSource *tts_cache_read(FILE *file, const char *key, size_t length) {
+    TtsCacheHeader header;
+    if (tts_cache_read_header(file, key, length, &header) < 0) {
+        return NULL;
+    }
+
+    AudioSource *audio = calloc(1, sizeof(AudioSource));
+    if (!audio) {
+        return NULL;
+    }
+    audio->samples = malloc((size_t)header.num_samples * sizeof(float));
+    if (!audio->samples ||
+        fread(audio->samples, sizeof(float), header.num_samples, file) != header.num_samples) {
+        audio_free(audio);
+        return NULL;
+    }
+    audio->num_samples = header.num_samples;
+    audio->sample_rate = header.sample_rate;
+    audio->channels = header.channels;
+    audio->duration = (float)header.num_samples / header.channels / header.sample_rate;
+    return audio;
+}
+
+static AudioSource *tts_cache_load(const char *path, const char *key, size_t length) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    AudioSource *audio = tts_cache_read(file, key, length);
+    fclose(file);
+
+    if (audio) {
+        /* Mark as recently used */
+        utimensat(AT_FDCWD, path, NULL, 0);
+    }
+    return audio;
+}
+
+static int compare_entry_age(const void *a, const void *b) {
+    const TtsCacheEntry *ea = a, *eb = b;
+    if (ea->used.tv_sec != eb->used.tv_sec) {
+        return (ea->used.tv_sec > eb->used.tv_sec) - (ea->used.tv_sec < eb->used.tv_sec);
+    }
+    return (ea->used.tv_nsec > eb->used.tv_nsec) - (ea->used.tv_nsec < eb->used.tv_nsec);
+}
+
+/* Delete least recently used entries until the cache fits its limit */
+static void tts_cache_evict(const AudioConfig *config) {
+    DIR *dir = opendir(config->cache_dir);
+    if (!dir) {
+        return;
+    }
+
+    TtsCacheEntry *entries = NULL;
+    int count = 0, capacity = 0;
+    int64_t total = 0;
+    time_t now = time(NULL);
+    char path[PATH_MAX];
+
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        size_t len = strlen(de->d_name);
+        int is_entry = len > 4 && len < sizeof(entries->name) &&
+                       strcmp(de->d_name + len - 4, ".pcm") == 0;
+        int is_temp = strncmp(de->d_name, TTS_CACHE_TEMP_PREFIX,
+                              strlen(TTS_CACHE_TEMP_PREFIX)) == 0;
+        if (!is_entry && !is_temp) continue;
+
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", config->cache_dir, de->d_name);
+        if (stat(path, &st) < 0) continue;
+
+        /* Left behind by a process that died mid-write */
+        if (is_temp) {
+            if (now - st.st_mtime > TTS_CACHE_TEMP_MAX_AGE) unlink(path);
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            TtsCacheEntry *grown = realloc(entries, capacity * sizeof(TtsCacheEntry));
+            if (!grown) break;
+            entries = grown;
+        }
+        memcpy(entries[count].name, de->d_name, len + 1);
+        entries[count].size = st.st_size;
+        entries[count].used = st.st_mtim;
+        total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    if (total > config->cache_max_bytes) {
+        qsort(entries, count, sizeof(TtsCacheEntry), compare_entry_age);
+        for (int i = 0; i < count && total > config->cache_max_bytes; i++) {
+            snprintf(path, sizeof(path), "%s/%s", config->cache_dir, entries[i].name);
+            if (unlink(path) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+    free(entries);
+}
+
+/* Write an entry under a temp name and rename it into place, so readers
+ * never see a partial file */
+static void tts_cache_store(const AudioConfig *config, const char *path,
+                            const char *key, size_t length, const AudioSource *audio) {
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s/" TTS_CACHE_TEMP_PREFIX "XXXXXX",
+             config->cache_dir);
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        return;
+    }
+    fchmod(fd, 0644);
+    FILE *file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(temp);
+        return;
+    }
+
+    TtsCacheHeader header = {
+        .magic = {'Q', 'V', 'T', 'C'},
+        .version = TTS_CACHE_VERSION,
+        .sample_rate = audio->sample_rate,
+        .channels = audio->channels,
+        .num_samples = audio->num_samples,
+        .key_length = length
+    };
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(key, 1, length, file) == length &&
+             fwrite(audio->samples, sizeof(float), audio->num_samples, file) ==
+                 (size_t)audio->num_samples;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp, path) < 0) {
+        unlink(temp);
+        return;
+    }
+    tts_cache_evict(config);
+}
+
+/* Whether an executable is on PATH (no shell involved) */
+static int find_in_path(const char *name) {
+    const char *path = getenv("PATH");
+    char candidate[PATH_MAX];
+    while (path && *path) {
+        const char *end = strchr(path, ':');
+        size_t len = end ? (size_t)(end - path) : strlen(path);
+        if (len > 0 && snprintf(candidate, sizeof(candidate), "%.*s/%s",
+                                (int)len, path, name) < (int)sizeof(candidate) &&
+            access(candidate, X_OK) == 0) {
+            return 1;
+        }
+        path = end ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+/* Remove replies left behind by failed requests, then the directory */
+static void piper_remove_dir(AudioContext *ctx) {
+    DIR *dir = opendir(ctx->piper_dir);
+    if (dir) {
+        struct dirent *entry;
+        char path[PATH_MAX];
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            snprintf(path, sizeof(path), "%s/%s", ctx->piper_dir, entry->d_name);
+            unlink(path);
+        }
+        closedir(dir);
+    }
+    rmdir(ctx->piper_dir);
+    free(ctx->piper_dir);
+    ctx->piper_dir = NULL;
+}
+
+/* EOF on stdin lets Piper finish and exit; force kills one that stopped
+ * answering */
+static void piper_stop(AudioContext *ctx, int force) {
+    if (force && ctx->piper_pid > 0) {
+        kill(ctx->piper_pid, SIGKILL);
+    }
+    if (ctx->piper_in) {
+        fclose(ctx->piper_in);
+        ctx->piper_in = NULL;
+    }
+    if (ctx->piper_out) {
+        fclose(ctx->piper_out);
+        ctx->piper_out = NULL;
+    }
+    if (ctx->piper_pid > 0) {
+        waitpid(ctx->piper_pid, NULL, 0);
+        ctx->piper_pid = 0;
+    }
+    if (ctx->piper_dir) {
+        piper_remove_dir(ctx);
+    }
+}
+
+static int piper_start(AudioContext *ctx) {
+    const AudioConfig *config = &ctx->config;
+
+    /* Replies are written into a directory only this context uses */
+    const char *tmp = getenv("TMPDIR");
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/quizvid-piper-XXXXXX", tmp && *tmp ? tmp : "/tmp");
+    if (!mkdtemp(dir) || !(ctx->piper_dir = strdup(dir))) {
+        fprintf(stderr, "Failed to create a directory for Piper replies\n");
+        return -1;
+    }
+
+    /* Close-on-exec from the start: another context's Piper spawned from
+     * a different thread must never inherit this one's stdin */
+    int to_piper[2], from_piper[2];
+    if (pipe2(to_piper, O_CLOEXEC) < 0) {
+        piper_remove_dir(ctx);
+        return -1;
+    }
+    if (pipe2(from_piper, O_CLOEXEC) < 0) {
+        close(to_piper[0]);
+        close(to_piper[1]);
+        piper_remove_dir(ctx);
+        return -1;
+    }
+
+    /* With --json-input Piper synthesizes each line as soon as it is read
+     * and prints the path of the WAV file it wrote, one line per request.
+     * (--output_file would read stdin to EOF before writing anything.) */
+    char length_scale[32];   /* Piper uses length_scale, inverse of speed */
+    snprintf(length_scale, sizeof(length_scale), "%.2f", 1.0f / config->speed);
+    char *const argv[] = {
+        "piper", "--model", (char *)config->voice_model,
+        "--length_scale", length_scale, "--json-input",
+        "--output_dir", ctx->piper_dir, NULL
+    };
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, to_piper[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, from_piper[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    /* A dead Piper must show up as a write error, not kill the render;
+     * the child gets the default disposition back */
+    signal(SIGPIPE, SIG_IGN);
+    posix_spawnattr_t attr;
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigdefault(&attr, &sigpipe);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    int ret = posix_spawnp(&ctx->piper_pid, "piper", &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(to_piper[0]);
+    close(from_piper[1]);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to start piper: %s\n", strerror(ret));
+        close(to_piper[1]);
+        close(from_piper[0]);
+        ctx->piper_pid = 0;
+        piper_remove_dir(ctx);
+        return -1;
+    }
+
+    ctx->piper_in = fdopen(to_piper[1], "w");
+    ctx->piper_out = fdopen(from_piper[0], "r");
+    if (!ctx->piper_in || !ctx->piper_out) {
+        if (!ctx->piper_in) close(to_piper[1]);
+        if (!ctx->piper_out) close(from_piper[0]);
+        piper_stop(ctx, 1);
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t read_le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Read Piper's answer to one request: the path it wrote, on one line.
+ * The descriptor is read directly (never through stdio buffers) so poll
+ * sees everything Piper has sent. */
+static int piper_read_reply(AudioContext *ctx, char *path, size_t size) {
+    int fd = fileno(ctx->piper_out);
+    double deadline = monotonic_seconds() + PIPER_REPLY_TIMEOUT;
+    size_t len = 0;
+
+    for (;;) {
+        int wait_ms = (int)((deadline - monotonic_seconds()) * 1000);
+        if (wait_ms <= 0) {
+            fprintf(stderr, "Piper did not answer within %d s\n", PIPER_REPLY_TIMEOUT);
+            return -1;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, wait_ms);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) continue;
+
+        char c;
+        ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            return -1;   /* Piper exited */
+        }
+        if (c == '\n') {
+            path[len] = '\0';
+            return len > 0 ? 0 : -1;
+        }
+        if (c != '\r' && len + 1 < size) {
+            path[len++] = c;
+        }
+    }
+}
+
+/* One request as a JSON line; json-c does the escaping */
+static char *piper_request(const char *text, const char *output_file) {
+    struct json_object *request = json_object_new_object();
+    json_object_object_add(request, "text", json_object_new_string(text));
+    json_object_object_add(request, "output_file", json_object_new_string(output_file));
+    const char *json = json_object_to_json_string_ext(request, JSON_C_TO_STRING_PLAIN);
+    size_t len = strlen(json);
+    char *line = malloc(len + 2);
+    if (line) {
+        memcpy(line, json, len);
+        line[len] = '\n';
+        line[len + 1] = '\0';
+    }
+    json_object_put(request);
+    return line;
+}
+
+/* Synthesize one sentence; restarts Piper once if it died or stalled */
+static AudioSource *piper_speak(AudioContext *ctx, const char *text) {
+    AudioSource *audio = NULL;
+    for (int attempt = 0; attempt < 2 && !audio; attempt++) {
+        if (!ctx->piper_pid && piper_start(ctx) < 0) {
+            break;
+        }
+
+        char output_file[PATH_MAX], reply[PATH_MAX];
+        snprintf(output_file, sizeof(output_file), "%s/%u.wav",
+                 ctx->piper_dir, ctx->piper_requests++);
+        char *line = piper_request(text, output_file);
+        if (!line) {
+            break;
+        }
+        int sent = fputs(line, ctx->piper_in) != EOF && fflush(ctx->piper_in) != EOF;
+        free(line);
+
+        if (sent && piper_read_reply(ctx, reply, sizeof(reply)) == 0) {
+            audio = load_pcm_wav(reply, 0);
+            unlink(reply);
+            if (!audio) {
+                fprintf(stderr, "Could not read Piper reply %s\n", reply);
+            }
+        }
+        if (!audio) {
+            piper_stop(ctx, 1);
+        }
+    }
+    return audio;
+}
+
+int audio_context_init(AudioContext *ctx, const AudioConfig *config) {
+    memset(ctx, 0, sizeof(*ctx));
     if (!config) {
         fprintf(stderr, "Audio config is NULL\n");
         return -1;
     }
 
-    global_audio_config = *config;
+    ctx->config = *config;
 
     /* Validate configuration */
     if (config->type == AUDIO_SOURCE_TTS_PIPER) {
@@ -32,228 +537,649 @@ int audio_init(const AudioConfig *config) {
             return -1;
         }
 
-        /* Check if piper binary exists */
-        if (system("which piper > /dev/null 2>&1") != 0) {
+        /* Check if piper binary exists; it starts on the first cache miss */
+        if (!find_in_path("piper")) {
             fprintf(stderr, "Piper TTS not installed. Install with: sudo apt install piper-tts\n");
             return -1;
         }
     }
 
-    audio_initialized = 1;
-    printf("Audio system initialized: %s\n",
-           config->type == AUDIO_SOURCE_TTS_PIPER ? "Piper TTS" :
-           config->type == AUDIO_SOURCE_FILE ? "File loading" : "Unknown");
+    if (config->type == AUDIO_SOURCE_TTS_PIPER && tts_cache_enabled(config) &&
+        make_dirs(config->cache_dir) < 0) {
+        fprintf(stderr, "Cannot create TTS cache %s, caching disabled\n", config->cache_dir);
+        ctx->config.cache_dir = NULL;
+    }
 
+    ctx->initialized = 1;
     return 0;
 }
 
-AudioSource *audio_generate_tts(const char *text) {
-    if (!audio_initialized) {
+AudioSource *audio_context_tts(AudioContext *ctx, const char *text) {
+    const AudioConfig *config = &ctx->config;
+    if (!ctx->initialized) {
         fprintf(stderr, "Audio system not initialized\n");
         return NULL;
     }
 
-    if (global_audio_config.type != AUDIO_SOURCE_TTS_PIPER) {
+    if (config->type != AUDIO_SOURCE_TTS_PIPER) {
         fprintf(stderr, "TTS not configured\n");
         return NULL;
     }
 
-    /* Create temporary file for output */
-    char temp_file[] = "/tmp/quizvid_audio_XXXXXX.wav";
-    int fd = mkstemps(temp_file, 4);
-    if (fd == -1) {
-        fprintf(stderr, "Failed to create temporary file\n");
-        return NULL;
+    /* A cached result skips Piper and the WAV decode */
+    char *key = NULL;
+    size_t key_length = 0;
+    char cache_path[PATH_MAX];
+    if (tts_cache_enabled(config) &&
+        (key = tts_cache_key(config, text, &key_length)) != NULL) {
+        tts_cache_path(config, key, key_length, cache_path, sizeof(cache_path));
+        AudioSource *cached = tts_cache_load(cache_path, key, key_length);
+        if (cached) {
+            free(key);
+            return cached;
+        }
     }
-    close(fd);
-
-    /* Build piper command */
-    char cmd[2048];
-    snprintf(cmd, sizeof(cmd),
-             "echo \"%s\" | piper --model %s --output_file %s --length_scale %.2f > /dev/null 2>&1",
-             text, global_audio_config.voice_model, temp_file,
-             1.0f / global_audio_config.speed); /* Piper uses length_scale, inverse of speed */
 
-    /* Execute piper */
-    int ret = system(cmd);
-    if (ret != 0) {
+    uint64_t start = trace_begin();
+    AudioSource *audio = piper_speak(ctx, text);
+    trace_end("piper_tts", start);
+    if (!audio) {
         fprintf(stderr, "Piper TTS failed\n");
-        unlink(temp_file);
+        free(key);
         return NULL;
     }
 
-    /* Load generated WAV file */
-    AudioSource *audio = audio_load_wav(temp_file);
+    if (key) {
+        tts_cache_store(config, cache_path, key, key_length, audio);
+    }
+    free(key);
+    return audio;
+}
 
-    /* Clean up temp file */
-    unlink(temp_file);
+void audio_context_free(AudioContext *ctx) {
+    piper_stop(ctx, 0);
+    ctx->initialized = 0;
+}
 
-    return audio;
+int audio_init(const AudioConfig *config) {
+    /* A model or speed change needs a new Piper process */
+    audio_context_free(&default_context);
+    if (audio_context_init(&default_context, config) < 0) {
+        return -1;
+    }
+
+    printf("Audio system initialized: %s\n",
+           config->type == AUDIO_SOURCE_TTS_PIPER ? "Piper TTS" :
+           config->type == AUDIO_SOURCE_FILE ? "File loading" : "Unknown");
+    return 0;
 }
 
-AudioSource *audio_load_wav(const char *filepath) {
+AudioSource *audio_generate_tts(const char *text) {
+    return audio_context_tts(&default_context, text);
+}
+
+/* Called with each converted chunk: interleaved samples in the format
+ * decode_file was asked for */
+typedef int (*DecodeChunkFn)(void *user, const uint8_t *data, int frames,
+                             int sample_rate, int channels);
+
+/* Convert a decoded frame (or, with frame NULL, what the resampler still
+ * holds) and hand it on */
+static int convert_chunk(SwrContext *swr, const AVFrame *frame, int channels,
+                         enum AVSampleFormat out_fmt, int sample_rate,
+                         uint8_t **buffer, int *capacity,
+                         DecodeChunkFn fn, void *user) {
+    int frames = swr_get_out_samples(swr, frame ? frame->nb_samples : 0);
+    if (frames <= 0) {
+        return 0;
+    }
+    int bytes = frames * channels * av_get_bytes_per_sample(out_fmt);
+    if (bytes > *capacity) {
+        uint8_t *grown = realloc(*buffer, bytes);
+        if (!grown) return -1;
+        *buffer = grown;
+        *capacity = bytes;
+    }
+
+    uint8_t *out = *buffer;
+    int count = frame ? swr_convert(swr, &out, frames, (const uint8_t **)frame->extended_data,
+                                    frame->nb_samples)
+                      : swr_convert(swr, &out, frames, NULL, 0);
+    if (count < 0) {
+        return -1;
+    }
+    return count > 0 ? fn(user, *buffer, count, sample_rate, channels) : 0;
+}
+
+/* Decode the first audio stream of a file in chunks, converted to
+ * interleaved out_fmt at the file's own rate and channel count. Only one
+ * frame's worth of samples is held at a time. */
+static int decode_file(const char *filepath, enum AVSampleFormat out_fmt,
+                       DecodeChunkFn fn, void *user) {
     AVFormatContext *fmt_ctx = NULL;
     AVCodecContext *codec_ctx = NULL;
-    const AVCodec *codec = NULL;
     SwrContext *swr_ctx = NULL;
-    AudioSource *audio = NULL;
-    int audio_stream_index = -1;
+    AVPacket *packet = NULL;
+    AVFrame *frame = NULL;
+    uint8_t *buffer = NULL;
+    int capacity = 0;
+    int ret = -1;
 
     /* Open file */
     if (avformat_open_input(&fmt_ctx, filepath, NULL, NULL) < 0) {
         fprintf(stderr, "Failed to open audio file: %s\n", filepath);
-        return NULL;
+        return -1;
     }
 
     if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
         fprintf(stderr, "Failed to find stream info\n");
-        avformat_close_input(&fmt_ctx);
-        return NULL;
+        goto done;
     }
 
-    /* Find audio stream */
-    for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++) {
-        if (fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-            audio_stream_index = i;
-            break;
+    /* Find audio stream and its decoder */
+    int stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (stream_index < 0) {
+        fprintf(stderr, "No audio stream found\n");
+        goto done;
+    }
+    AVStream *stream = fmt_ctx->streams[stream_index];
+
+    const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec) {
+        fprintf(stderr, "Codec not found\n");
+        goto done;
+    }
+    codec_ctx = avcodec_alloc_context3(codec);
+    if (!codec_ctx ||
+        avcodec_parameters_to_context(codec_ctx, stream->codecpar) < 0 ||
+        avcodec_open2(codec_ctx, codec, NULL) < 0) {
+        fprintf(stderr, "Failed to open codec\n");
+        goto done;
+    }
+
+    int sample_rate = codec_ctx->sample_rate;
+    int channels = codec_ctx->ch_layout.nb_channels;
+    if (sample_rate <= 0 || channels <= 0) {
+        fprintf(stderr, "Invalid audio format in %s\n", filepath);
+        goto done;
+    }
+
+    /* Only the sample format changes; rate and layout stay as they are */
+    if (swr_alloc_set_opts2(&swr_ctx, &codec_ctx->ch_layout, out_fmt, sample_rate,
+                            &codec_ctx->ch_layout, codec_ctx->sample_fmt, sample_rate,
+                            0, NULL) < 0 || swr_init(swr_ctx) < 0) {
+        fprintf(stderr, "Failed to initialize resampler\n");
+        goto done;
+    }
+
+    packet = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (!packet || !frame) {
+        goto done;
+    }
+
+    /* Read and decode audio; a NULL packet at the end drains the decoder */
+    int eof = 0;
+    while (!eof) {
+        int err = av_read_frame(fmt_ctx, packet);
+        if (err < 0) {
+            eof = 1;
+        } else if (packet->stream_index != stream_index) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        err = avcodec_send_packet(codec_ctx, eof ? NULL : packet);
+        av_packet_unref(packet);
+        if (err < 0 && !eof) {
+            continue;   /* Skip a corrupt packet */
+        }
+
+        while (avcodec_receive_frame(codec_ctx, frame) >= 0) {
+            err = convert_chunk(swr_ctx, frame, channels, out_fmt, sample_rate,
+                                &buffer, &capacity, fn, user);
+            av_frame_unref(frame);
+            if (err < 0) goto done;
         }
     }
+    if (convert_chunk(swr_ctx, NULL, channels, out_fmt, sample_rate,
+                      &buffer, &capacity, fn, user) < 0) {
+        goto done;
+    }
+    ret = 0;
 
-    if (audio_stream_index == -1) {
-        fprintf(stderr, "No audio stream found\n");
-        avformat_close_input(&fmt_ctx);
-        return NULL;
+done:
+    free(buffer);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    swr_free(&swr_ctx);
+    avcodec_free_context(&codec_ctx);
+    avformat_close_input(&fmt_ctx);
+    return ret;
+}
+
+typedef struct {
+    AudioChunkFn fn;
+    void *user;
+} StreamTarget;
+
+static int stream_chunk(void *user, const uint8_t *data, int frames,
+                        int sample_rate, int channels) {
+    StreamTarget *target = user;
+    return target->fn(target->user, (const float *)data, frames, sample_rate, channels);
+}
+
+/* Frames per chunk when streaming PCM WAV from its mapping */
+#define PCM_STREAM_FRAMES 4096
+
+/* Hand out a mapped 16-bit PCM file as float chunks */
+static int stream_pcm(const AudioSource *pcm, AudioChunkFn fn, void *user) {
+    float *chunk = malloc((size_t)PCM_STREAM_FRAMES * pcm->channels * sizeof(float));
+    if (!chunk) {
+        fprintf(stderr, "Failed to allocate audio chunk\n");
+        return -1;
+    }
+    int total = pcm->num_samples / pcm->channels;
+    int ret = 0;
+    for (int start = 0; start < total && ret == 0; start += PCM_STREAM_FRAMES) {
+        int frames = total - start < PCM_STREAM_FRAMES ? total - start : PCM_STREAM_FRAMES;
+        const int16_t *in = pcm->samples_s16 + (size_t)start * pcm->channels;
+        for (int i = 0; i < frames * pcm->channels; i++) {
+            chunk[i] = in[i] / 32768.0f;
+        }
+        ret = fn(user, chunk, frames, pcm->sample_rate, pcm->channels) < 0 ? -1 : 0;
+    }
+    free(chunk);
+    return ret;
+}
+
+int audio_decode_stream(const char *filepath, AudioChunkFn fn, void *user) {
+    /* Plain PCM WAV is read from a file mapping, like audio_load_wav_ex */
+    AudioSource *pcm = load_pcm_wav(filepath, AUDIO_LOAD_S16);
+    if (pcm) {
+        int ret = stream_pcm(pcm, fn, user);
+        audio_free(pcm);
+        return ret;
     }
 
-    AVStream *audio_stream = fmt_ctx->streams[audio_stream_index];
+    StreamTarget target = {fn, user};
+    return decode_file(filepath, AV_SAMPLE_FMT_FLT, stream_chunk, &target);
+}
 
-    /* Find decoder */
-    codec = avcodec_find_decoder(audio_stream->codecpar->codec_id);
-    if (!codec) {
-        fprintf(stderr, "Codec not found\n");
-        avformat_close_input(&fmt_ctx);
-        return NULL;
+/* Collects decoded chunks into a buffer that doubles as it fills */
+typedef struct {
+    AudioSource *audio;
+    int sample_size;             /* sizeof(float) or sizeof(int16_t) */
+    size_t capacity;             /* In samples */
+} LoadTarget;
+
+static int load_chunk(void *user, const uint8_t *data, int frames,
+                      int sample_rate, int channels) {
+    LoadTarget *target = user;
+    AudioSource *audio = target->audio;
+    audio->sample_rate = sample_rate;
+    audio->channels = channels;
+
+    size_t needed = (size_t)audio->num_samples + (size_t)frames * channels;
+    if (needed > INT_MAX) {
+        fprintf(stderr, "Audio file too long\n");
+        return -1;
+    }
+    if (needed > target->capacity) {
+        size_t capacity = target->capacity ? target->capacity : 65536;
+        while (capacity < needed) capacity *= 2;
+        void **storage = target->sample_size == sizeof(float) ? (void **)&audio->samples
+                                                              : (void **)&audio->samples_s16;
+        void *grown = realloc(*storage, capacity * target->sample_size);
+        if (!grown) {
+            fprintf(stderr, "Failed to allocate sample buffer\n");
+            return -1;
+        }
+        *storage = grown;
+        target->capacity = capacity;
     }
 
-    /* Allocate codec context */
-    codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        fprintf(stderr, "Failed to allocate codec context\n");
-        avformat_close_input(&fmt_ctx);
+    uint8_t *base = target->sample_size == sizeof(float) ? (uint8_t *)audio->samples
+                                                         : (uint8_t *)audio->samples_s16;
+    memcpy(base + (size_t)audio->num_samples * target->sample_size, data,
+           (size_t)frames * channels * target->sample_size);
+    audio->num_samples = (int)needed;
+    return 0;
+}
+
+/* Canonical 16-bit PCM WAV read straight from a file mapping, skipping the
+ * demuxer and resampler. Returns NULL for anything else (compressed,
+ * other sample sizes, broken headers), which then goes through
+ * libavformat. With AUDIO_LOAD_S16 the samples are not copied at all. */
+static AudioSource *load_pcm_wav(const char *filepath, int flags) {
+    int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return NULL;
     }
-
-    if (avcodec_parameters_to_context(codec_ctx, audio_stream->codecpar) < 0) {
-        fprintf(stderr, "Failed to copy codec parameters\n");
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 44) {
+        close(fd);
         return NULL;
     }
-
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-        fprintf(stderr, "Failed to open codec\n");
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
+    size_t size = (size_t)st.st_size;
+    uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
         return NULL;
     }
 
-    /* Calculate duration */
-    float duration = (float)fmt_ctx->duration / AV_TIME_BASE;
-    int sample_rate = codec_ctx->sample_rate;
-    int channels = codec_ctx->ch_layout.nb_channels;
+    int channels = 0, sample_rate = 0, pcm16 = 0;
+    const uint8_t *data = NULL;
+    size_t data_size = 0;
+    if (memcmp(map, "RIFF", 4) == 0 && memcmp(map + 8, "WAVE", 4) == 0) {
+        size_t pos = 12;
+        while (pos + 8 <= size) {
+            uint32_t chunk_size = read_le32(map + pos + 4);
+            const uint8_t *body = map + pos + 8;
+            size_t available = size - pos - 8;
+
+            if (memcmp(map + pos, "fmt ", 4) == 0 && chunk_size >= 16 && available >= 16) {
+                int format = read_le16(body);
+                /* WAVE_FORMAT_EXTENSIBLE carries the real format in its subtype */
+                if (format == 0xFFFE && chunk_size >= 40 && available >= 40) {
+                    format = read_le16(body + 24);
+                }
+                channels = read_le16(body + 2);
+                sample_rate = (int)read_le32(body + 4);
+                pcm16 = format == 1 && read_le16(body + 14) == 16 &&
+                        read_le16(body + 12) == channels * 2;
+            } else if (memcmp(map + pos, "data", 4) == 0) {
+                /* Streamed WAVs leave the size unset; take the rest of the file */
+                data = body;
+                data_size = chunk_size < available && chunk_size != 0 ? chunk_size : available;
+                break;
+            }
+            pos += 8 + (size_t)chunk_size + (chunk_size & 1);
+        }
+    }
 
-    /* Allocate audio source */
-    audio = calloc(1, sizeof(AudioSource));
+    size_t num_samples = data_size / 2;
+    num_samples -= channels > 0 ? num_samples % channels : 0;
+    AudioSource *audio = NULL;
+    if (data && pcm16 && channels > 0 && sample_rate > 0 && num_samples <= INT_MAX) {
+        audio = calloc(1, sizeof(AudioSource));
+    }
     if (!audio) {
-        fprintf(stderr, "Failed to allocate AudioSource\n");
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
+        munmap(map, size);
         return NULL;
     }
-
+    audio->num_samples = (int)num_samples;
     audio->sample_rate = sample_rate;
     audio->channels = channels;
-    audio->duration = duration;
-    audio->num_samples = (int)(duration * sample_rate * channels);
-    audio->samples = calloc(audio->num_samples, sizeof(float));
+    audio->duration = (float)num_samples / channels / sample_rate;
 
-    if (!audio->samples) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (flags & AUDIO_LOAD_S16) {
+        /* RIFF chunks are word aligned, so the samples are too */
+        madvise(map, size, MADV_SEQUENTIAL);
+        audio->samples_s16 = (int16_t *)data;
+        audio->mapping = map;
+        audio->mapping_size = size;
+        return audio;
+    }
+#endif
+
+    if (flags & AUDIO_LOAD_S16) {
+        audio->samples_s16 = malloc(num_samples ? num_samples * sizeof(int16_t) : 1);
+    } else {
+        audio->samples = malloc(num_samples ? num_samples * sizeof(float) : 1);
+    }
+    if (!audio->samples && !audio->samples_s16) {
         fprintf(stderr, "Failed to allocate sample buffer\n");
+        munmap(map, size);
         free(audio);
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
         return NULL;
     }
+    for (size_t i = 0; i < num_samples; i++) {
+        int16_t value = (int16_t)read_le16(data + i * 2);
+        if (audio->samples_s16) {
+            audio->samples_s16[i] = value;
+        } else {
+            audio->samples[i] = value / 32768.0f;
+        }
+    }
+    munmap(map, size);
+    return audio;
+}
 
-    /* Setup resampler to convert to float32 */
-    swr_ctx = swr_alloc();
-    av_opt_set_chlayout(swr_ctx, "in_chlayout", &codec_ctx->ch_layout, 0);
-    av_opt_set_chlayout(swr_ctx, "out_chlayout", &codec_ctx->ch_layout, 0);
-    av_opt_set_int(swr_ctx, "in_sample_rate", codec_ctx->sample_rate, 0);
-    av_opt_set_int(swr_ctx, "out_sample_rate", codec_ctx->sample_rate, 0);
-    av_opt_set_sample_fmt(swr_ctx, "in_sample_fmt", codec_ctx->sample_fmt, 0);
-    av_opt_set_sample_fmt(swr_ctx, "out_sample_fmt", AV_SAMPLE_FMT_FLT, 0);
+AudioSource *audio_load_wav_ex(const char *filepath, int flags) {
+    AudioSource *audio = load_pcm_wav(filepath, flags);
+    if (!audio) {
+        audio = calloc(1, sizeof(AudioSource));
+        if (!audio) {
+            fprintf(stderr, "Failed to allocate AudioSource\n");
+            return NULL;
+        }
 
-    if (swr_init(swr_ctx) < 0) {
-        fprintf(stderr, "Failed to initialize resampler\n");
-        free(audio->samples);
-        free(audio);
-        avcodec_free_context(&codec_ctx);
-        avformat_close_input(&fmt_ctx);
-        return NULL;
+        LoadTarget target = {
+            .audio = audio,
+            .sample_size = (flags & AUDIO_LOAD_S16) ? sizeof(int16_t) : sizeof(float)
+        };
+        if (decode_file(filepath, (flags & AUDIO_LOAD_S16) ? AV_SAMPLE_FMT_S16 : AV_SAMPLE_FMT_FLT,
+                        load_chunk, &target) < 0) {
+            audio_free(audio);
+            return NULL;
+        }
+        if (audio->num_samples == 0) {
+            fprintf(stderr, "No audio decoded from %s\n", filepath);
+            audio_free(audio);
+            return NULL;
+        }
+
+        /* Give back what the doubling over-allocated */
+        if (audio->samples) {
+            float *shrunk = realloc(audio->samples, (size_t)audio->num_samples * sizeof(float));
+            if (shrunk) audio->samples = shrunk;
+        } else {
+            int16_t *shrunk = realloc(audio->samples_s16,
+                                      (size_t)audio->num_samples * sizeof(int16_t));
+            if (shrunk) audio->samples_s16 = shrunk;
+        }
+        audio->duration = (float)audio->num_samples / audio->channels / audio->sample_rate;
     }
 
-    /* Read and decode audio */
-    AVPacket *packet = av_packet_alloc();
-    AVFrame *frame = av_frame_alloc();
-    int sample_offset = 0;
+    printf("Loaded audio: %.2fs, %d Hz, %d channels\n",
+           audio->duration, audio->sample_rate, audio->channels);
 
-    while (av_read_frame(fmt_ctx, packet) >= 0) {
-        if (packet->stream_index == audio_stream_index) {
-            if (avcodec_send_packet(codec_ctx, packet) >= 0) {
-                while (avcodec_receive_frame(codec_ctx, frame) >= 0) {
-                    /* Convert to float32 */
-                    uint8_t *output_buffer = (uint8_t *)audio->samples +
-                                            (sample_offset * sizeof(float));
+    return audio;
+}
 
-                    int out_samples = swr_convert(swr_ctx, &output_buffer,
-                                                 frame->nb_samples,
-                                                 (const uint8_t **)frame->data,
-                                                 frame->nb_samples);
+AudioSource *audio_load_wav(const char *filepath) {
+    return audio_load_wav_ex(filepath, 0);
+}
 
-                    sample_offset += out_samples * channels;
-                }
+/* Duration from a WAV header, for formats where every block holds the
+ * same number of samples. Returns -1 to leave the file to libavformat. */
+static double probe_wav_header(FILE *file) {
+    uint8_t riff[12];
+    if (fread(riff, 1, sizeof(riff), file) != sizeof(riff) ||
+        memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        return -1.0;
+    }
+    struct stat st;
+    if (fstat(fileno(file), &st) < 0) {
+        return -1.0;
+    }
+
+    int sample_rate = 0, block_align = 0, fixed_blocks = 0;
+    for (;;) {
+        uint8_t chunk[8];
+        if (fread(chunk, 1, sizeof(chunk), file) != sizeof(chunk)) {
+            return -1.0;
+        }
+        uint32_t size = read_le32(chunk + 4);
+        uint32_t padding = size & 1;
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            uint8_t fmt[40] = {0};
+            size_t wanted = size < sizeof(fmt) ? size : sizeof(fmt);
+            if (fread(fmt, 1, wanted, file) != wanted) {
+                return -1.0;
+            }
+            int format = read_le16(fmt);
+            if (format == 0xFFFE && size >= 40) {
+                format = read_le16(fmt + 24);   /* WAVE_FORMAT_EXTENSIBLE subtype */
+            }
+            sample_rate = (int)read_le32(fmt + 4);
+            block_align = read_le16(fmt + 12);
+            /* PCM, IEEE float, A-law, mu-law: one frame per block */
+            fixed_blocks = format == 1 || format == 3 || format == 6 || format == 7;
+            size -= wanted;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!fixed_blocks || sample_rate <= 0 || block_align <= 0) {
+                return -1.0;
+            }
+            /* Streamed WAVs leave the size unset; take the rest of the file */
+            off_t available = st.st_size - ftello(file);
+            if (size == 0 || size == 0xFFFFFFFF || (off_t)size > available) {
+                size = available > 0 ? (uint32_t)available : 0;
             }
+            return (double)(size / block_align) / sample_rate;
+        }
+
+        if (fseeko(file, (off_t)size + padding, SEEK_CUR) < 0) {
+            return -1.0;
         }
-        av_packet_unref(packet);
     }
+}
 
-    /* Cleanup */
-    av_frame_free(&frame);
-    av_packet_free(&packet);
-    swr_free(&swr_ctx);
-    avcodec_free_context(&codec_ctx);
+float audio_probe_duration(const char *filepath) {
+    FILE *file = fopen(filepath, "rb");
+    if (!file) {
+        return -1.0f;
+    }
+    double seconds = probe_wav_header(file);
+    fclose(file);
+    if (seconds >= 0.0) {
+        return (float)seconds;
+    }
+
+    /* Other formats: container or stream headers, no decoding */
+    AVFormatContext *fmt_ctx = NULL;
+    if (avformat_open_input(&fmt_ctx, filepath, NULL, NULL) < 0) {
+        return -1.0f;
+    }
+    if (fmt_ctx->duration == AV_NOPTS_VALUE &&
+        avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+        avformat_close_input(&fmt_ctx);
+        return -1.0f;
+    }
+
+    seconds = -1.0;
+    int index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (index >= 0 && fmt_ctx->streams[index]->duration != AV_NOPTS_VALUE) {
+        const AVStream *stream = fmt_ctx->streams[index];
+        seconds = stream->duration * av_q2d(stream->time_base);
+    } else if (index >= 0 && fmt_ctx->duration != AV_NOPTS_VALUE) {
+        seconds = (double)fmt_ctx->duration / AV_TIME_BASE;
+    }
     avformat_close_input(&fmt_ctx);
+    return (float)seconds;
+}
 
-    printf("Loaded audio: %.2fs, %d Hz, %d channels\n",
-           audio->duration, audio->sample_rate, audio->channels);
+float audio_context_tts_duration(AudioContext *ctx, const char *text) {
+    const AudioConfig *config = &ctx->config;
+    if (!ctx->initialized || config->type != AUDIO_SOURCE_TTS_PIPER ||
+        !tts_cache_enabled(config)) {
+        return -1.0f;
+    }
 
-    return audio;
+    size_t key_length;
+    char *key = tts_cache_key(config, text, &key_length);
+    if (!key) {
+        return -1.0f;
+    }
+    char path[PATH_MAX];
+    tts_cache_path(config, key, key_length, path, sizeof(path));
+
+    float seconds = -1.0f;
+    FILE *file = fopen(path, "rb");
+    if (file) {
+        TtsCacheHeader header;
+        if (tts_cache_read_header(file, key, key_length, &header) == 0) {
+            seconds = (float)header.num_samples / header.channels / header.sample_rate;
+        }
+        fclose(file);
+    }
+    free(key);
+    return seconds;
+}
+
+/* Files shared by the probe threads */
+typedef struct {
+    const char *const *paths;
+    float *durations;
+    int count;
+    atomic_int next;
+} ProbeBatch;
+
+static void *probe_worker(void *arg) {
+    ProbeBatch *batch = arg;
+    trace_thread_name("audio_probe");
+    int i;
+    while ((i = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+        batch->durations[i] = audio_probe_duration(batch->paths[i]);
+    }
+    return NULL;
+}
+
+void audio_probe_durations(const char *const *paths, int count, float *durations,
+                           int threads) {
+    ProbeBatch batch = {paths, durations, count, 0};
+    atomic_init(&batch.next, 0);
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > count) threads = count;
+
+    /* The calling thread probes too */
+    pthread_t *workers = threads > 1 ? malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    for (int t = 0; workers && t < threads - 1; t++) {
+        if (pthread_create(&workers[t], NULL, probe_worker, &batch) != 0) {
+            break;
+        }
+        started++;
+    }
+    probe_worker(&batch);
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
 }
 
 float audio_get_duration(const char *text_or_file) {
-    /* Quick estimate: ~150 words per minute, ~5 chars per word */
-    /* This is rough - better to generate audio and measure */
     if (!text_or_file) return 0.0f;
 
+    /* A file: read its headers */
+    struct stat st;
+    if (stat(text_or_file, &st) == 0 && S_ISREG(st.st_mode)) {
+        float seconds = audio_probe_duration(text_or_file);
+        return seconds >= 0.0f ? seconds : 0.0f;
+    }
+
+    /* Text synthesized before: the cache entry knows */
+    float cached = audio_context_tts_duration(&default_context, text_or_file);
+    if (cached >= 0.0f) {
+        return cached;
+    }
+
+    /* Quick estimate: ~150 words per minute, ~5 chars per word */
     size_t len = strlen(text_or_file);
     float words = len / 5.0f;
     float minutes = words / 150.0f;
     float seconds = minutes * 60.0f;
 
     /* Adjust for speed */
-    if (audio_initialized && global_audio_config.speed > 0.0f) {
-        seconds /= global_audio_config.speed;
+    if (default_context.initialized && default_context.config.speed > 0.0f) {
+        seconds /= default_context.config.speed;
     }
 
     return seconds;
@@ -266,10 +1192,16 @@ void audio_free(AudioSource *audio) {
         free(audio->samples);
         audio->samples = NULL;
     }
+    if (audio->mapping) {
+        munmap(audio->mapping, audio->mapping_size);
+    } else {
+        free(audio->samples_s16);
+    }
+    audio->samples_s16 = NULL;
 
     free(audio);
 }
 
 void audio_cleanup(void) {
-    audio_initialized = 0;
+    audio_context_free(&default_context);
 }
@@ -0,0 +1,655 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <json-c/json.h>
+#include "batch.h"
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *copy_string(const char *str) {
+    size_t len = strlen(str) + 1;
+    char *dup = malloc(len);
+    if (dup) {
+        memcpy(dup, str, len);
+    }
+    return dup;
+}
+
+/* Replace one of the config's owned strings */
+static int set_config_string(const char **field, const char *value) {
+    char *dup = copy_string(value);
+    if (!dup) {
+        return -1;
+    }
+    free((void *)*field);
+    *field = dup;
+    return 0;
+}
+
+/* Record the first error of a job */
+static void job_fail(BatchJob *job, const char *fmt, ...) {
+    if (job->failed) {
+        return;
+    }
+    job->failed = 1;
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(job->error, sizeof(job->error), fmt, args);
+    va_end(args);
+}
+
+/* Load the quiz, split it into segments and open the output of a job
+ * claim_segment marked STARTING. Runs without the batch lock, as no other
+ * worker touches a starting job. */
+static void open_job(BatchJob *job) {
+    config_resolve_colors(&job->config, &job->colors);
+
+    if (job->quiz_json) {
+        if (quiz_parse(&job->quiz, job->quiz_json) < 0) {
+            job_fail(job, "invalid inline quiz");
+            return;
+        }
+    } else if (quiz_load(&job->quiz, job->config.quiz_file) < 0) {
+        job_fail(job, "could not load quiz %s", job->config.quiz_file);
+        return;
+    }
+
+    job->frames_per_question = (job->quiz.question_duration + job->quiz.reveal_duration) *
+                               job->config.video.fps;
+    job->total_frames = job->frames_per_question * job->quiz.num_questions;
+    if (job->total_frames <= 0) {
+        job_fail(job, "quiz has no frames");
+        return;
+    }
+
+    /* Without a segment size the whole job is one segment */
+    int per_segment = job->config.encoder.segment_questions > 0 ?
+                      job->config.encoder.segment_questions : job->quiz.num_questions;
+    job->num_segments = (job->quiz.num_questions + per_segment - 1) / per_segment;
+    job->segments = calloc(job->num_segments, sizeof(Segment));
+    if (!job->segments) {
+        job_fail(job, "out of memory");
+        return;
+    }
+    for (int i = 0; i < job->num_segments; i++) {
+        Segment *segment = &job->segments[i];
+        segment->first_question = i * per_segment;
+        segment->num_questions = job->quiz.num_questions - segment->first_question;
+        if (segment->num_questions > per_segment) segment->num_questions = per_segment;
+        segment->first_frame = segment->first_question * job->frames_per_question;
+        segment->num_frames = segment->num_questions * job->frames_per_question;
+    }
+
+    if (job->config.audio.source != AUDIO_SOURCE_NONE) {
+        fprintf(stderr, "Job %d: voiceover is not supported in batch mode, writing video only\n",
+                job->id);
+    }
+
+    VideoConfig video_config = {
+        .width = job->config.video.width,
+        .height = job->config.video.height,
+        .fps = job->config.video.fps,
+        .color_matrix = job->config.video.color_matrix,
+        .encoder = job->config.encoder,
+        .segmented = job->num_segments > 1,
+        .container = job->config.output.container,
+        .fragment_frames = job->config.output.fragment == OUTPUT_FRAGMENT_QUESTION ?
+            job->frames_per_question : 0,
+        .output_filename = job->config.output_file
+    };
+    /* Parallelism comes from running many segments at once */
+    if (video_config.encoder.threads == 0) {
+        video_config.encoder.threads = 1;
+    }
+
+    if (video_init(&job->output, &video_config) < 0) {
+        job_fail(job, "could not open output %s", job->config.output_file);
+        return;
+    }
+}
+
+/* Close the output and drop the job's render data. Runs once per job,
+ * after its last segment, on whichever thread got there. */
+static void finish_job(Batch *batch, BatchJob *job) {
+    for (int i = 0; i < job->num_segments; i++) {
+        video_segment_free(&job->segments[i].encoder);
+    }
+    free(job->segments);
+    job->segments = NULL;
+
+    if (job->output.format_ctx) {
+        video_close(&job->output);
+        if (job->failed) {
+            unlink(job->config.output_file);
+        }
+    }
+    quiz_free(&job->quiz);
+
+    job->seconds = now_seconds() - job->start_time;
+    printf("[job %d] %s: %s (%.1f s)\n", job->id, job->config.output_file,
+           job->failed ? job->error : "done", job->seconds);
+
+    if (batch->on_event) {
+        batch->on_event(job, BATCH_EVENT_FINISHED);
+    }
+}
+
+/* Count the job as finished so the next one can start.
+ * Called with the batch lock held, after finish_job. */
+static void close_job(Batch *batch, BatchJob *job) {
+    job->closed = 1;
+    batch->running--;
+    pthread_cond_broadcast(&batch->work);
+}
+
+/* Open a job outside the lock, then publish its segments to the workers
+ * or close it if it could not start */
+static void start_job(Batch *batch, BatchJob *job) {
+    open_job(job);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->starting--;
+    if (job->failed) {
+        job->status = BATCH_JOB_FAILED;
+        pthread_mutex_unlock(&batch->lock);
+
+        finish_job(batch, job);
+        pthread_mutex_lock(&batch->lock);
+        close_job(batch, job);
+    } else {
+        job->status = BATCH_JOB_RUNNING;
+        if (batch->on_event) {
+            batch->on_event(job, BATCH_EVENT_STARTED);
+        }
+        pthread_cond_broadcast(&batch->work);
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void free_job(BatchJob *job) {
+    quiz_free(&job->quiz);
+    config_free(&job->config);
+    if (job->quiz_json) {
+        json_object_put(job->quiz_json);
+    }
+    free(job);
+}
+
+/* Add a job at the end of the queue. Called with the batch lock held. */
+static int append_job(Batch *batch, BatchJob *job) {
+    if (batch->num_jobs == batch->capacity) {
+        int capacity = batch->capacity ? batch->capacity * 2 : 16;
+        BatchJob **jobs = realloc(batch->jobs, capacity * sizeof(BatchJob *));
+        if (!jobs) {
+            return -1;
+        }
+        batch->jobs = jobs;
+        batch->capacity = capacity;
+    }
+
+    job->id = ++batch->next_id;
+    job->status = BATCH_JOB_PENDING;
+    batch->jobs[batch->num_jobs++] = job;
+    return 0;
+}
+
+/* Free jobs that are over so a long-running server does not keep them.
+ * Called with the batch lock held. */
+static void drop_closed_jobs(Batch *batch) {
+    int kept = 0;
+    for (int i = 0; i < batch->num_jobs; i++) {
+        if (batch->jobs[i]->closed) {
+            free_job(batch->jobs[i]);
+        } else {
+            batch->jobs[kept++] = batch->jobs[i];
+        }
+    }
+    batch->num_jobs = kept;
+    batch->next_job = 0;
+}
+
+/* Pick the next segment in job order. A job that comes up and may start
+ * is marked STARTING and returned in *out_job without a segment; the
+ * caller starts it with start_job after dropping the lock.
+ * Called with the batch lock held. */
+static Segment *claim_segment(Batch *batch, BatchJob **out_job) {
+    for (int j = batch->next_job; j < batch->num_jobs; j++) {
+        BatchJob *job = batch->jobs[j];
+
+        if (job->status == BATCH_JOB_PENDING) {
+            /* Jobs start in order, so everything after this one waits too */
+            if (batch->max_running > 0 && batch->running >= batch->max_running) {
+                break;
+            }
+            job->start_time = now_seconds();
+            job->status = BATCH_JOB_STARTING;
+            batch->running++;
+            batch->starting++;
+            *out_job = job;
+            return NULL;
+        }
+
+        /* Its segments are published once it has started */
+        if (job->status == BATCH_JOB_STARTING) {
+            continue;
+        }
+
+        if (job->status == BATCH_JOB_RUNNING && !job->failed &&
+            job->next_claim < job->num_segments) {
+            job->in_flight++;
+            *out_job = job;
+            return &job->segments[job->next_claim++];
+        }
+
+        /* Nothing left to claim here, ever */
+        if (j == batch->next_job) {
+            batch->next_job++;
+        }
+    }
+    return NULL;
+}
+
+/* Point the worker's context and buffer at a job */
+static int prepare_worker(BatchWorker *worker, const BatchJob *job) {
+    const VideoSettings *video = &job->config.video;
+    int use_rgb = (video->render_format == CANVAS_RGB24);
+
+    if (worker->buffer_width != video->width || worker->buffer_height != video->height ||
+        worker->buffer_rgb != use_rgb) {
+        render_slot_free(&worker->buffer);
+        worker->buffer_width = worker->buffer_height = 0;
+        if (render_slot_init(&worker->buffer, video->width, video->height, use_rgb) < 0) {
+            return -1;
+        }
+        worker->buffer_width = video->width;
+        worker->buffer_height = video->height;
+        worker->buffer_rgb = use_rgb;
+
+        /* The new buffer may sit where an old one had a retained scene */
+        for (int i = 0; i < RENDER_MAX_SCENES; i++) {
+            scene_invalidate(&worker->rc.scenes[i]);
+        }
+    }
+
+    /* Sprites are keyed by question address, which a later job's quiz
+     * may reuse, so they never carry over between jobs */
+    if (worker->last_job != job->id) {
+        sprite_cache_bind(&worker->rc.sprites, NULL, 0);
+        colors_init(&worker->rc.colors, &job->colors);
+        worker->last_job = job->id;
+    }
+    return 0;
+}
+
+static int encode_segment(BatchWorker *worker, BatchJob *job, Segment *segment) {
+    if (prepare_worker(worker, job) < 0) {
+        return -1;
+    }
+    if (video_segment_init(&job->output, &segment->encoder, segment->first_frame) < 0) {
+        return -1;
+    }
+
+    int end = segment->first_frame + segment->num_frames;
+    for (int n = segment->first_frame; n < end; n++) {
+        if (render_slot_draw(&worker->buffer, &worker->rc, &job->config, &job->quiz,
+                             job->frames_per_question, n) < 0) {
+            return -1;
+        }
+        if (video_segment_write_planes(&segment->encoder, worker->buffer.yuv,
+                                       worker->buffer.linesize) < 0) {
+            return -1;
+        }
+    }
+
+    return video_segment_finish(&segment->encoder);
+}
+
+static void *worker_main(void *arg) {
+    BatchWorker *worker = arg;
+    Batch *batch = worker->batch;
+
+    for (;;) {
+        BatchJob *job = NULL;
+        pthread_mutex_lock(&batch->lock);
+        Segment *segment = claim_segment(batch, &job);
+        /* Stay while a job is being opened: its segments are still to come */
+        while (!segment && !job && (batch->serving || batch->starting > 0)) {
+            pthread_cond_wait(&batch->work, &batch->lock);
+            segment = claim_segment(batch, &job);
+        }
+        pthread_mutex_unlock(&batch->lock);
+        if (!segment && !job) break;
+
+        if (!segment) {
+            start_job(batch, job);
+            continue;
+        }
+
+        int ret = encode_segment(worker, job, segment);
+
+        pthread_mutex_lock(&batch->lock);
+        if (ret < 0) {
+            job_fail(job, "encoding failed in frames %d-%d", segment->first_frame,
+                     segment->first_frame + segment->num_frames - 1);
+        } else {
+            segment->done = 1;
+            job->frames_done += segment->num_frames;
+            if (batch->on_event) {
+                batch->on_event(job, BATCH_EVENT_PROGRESS);
+            }
+        }
+        job->in_flight--;
+
+        /* Write every segment that is now next in line. One worker writes
+         * at a time; the others leave their segments for it to pick up. */
+        while (!job->muxing && !job->failed && job->next_mux < job->num_segments &&
+               job->segments[job->next_mux].done) {
+            Segment *next = &job->segments[job->next_mux];
+            job->muxing = 1;
+            pthread_mutex_unlock(&batch->lock);
+
+            int wret = video_write_segment(&job->output, &next->encoder);
+            video_segment_free(&next->encoder);
+
+            pthread_mutex_lock(&batch->lock);
+            job->muxing = 0;
+            job->next_mux++;
+            if (wret < 0) {
+                job_fail(job, "could not write %s", job->config.output_file);
+            }
+        }
+
+        int finish = job->status == BATCH_JOB_RUNNING && !job->muxing &&
+                     job->in_flight == 0 &&
+                     (job->failed || job->next_mux == job->num_segments);
+        if (finish) {
+            job->status = job->failed ? BATCH_JOB_FAILED : BATCH_JOB_DONE;
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        if (finish) {
+            finish_job(batch, job);
+            pthread_mutex_lock(&batch->lock);
+            close_job(batch, job);
+            pthread_mutex_unlock(&batch->lock);
+        }
+    }
+
+    return NULL;
+}
+
+void batch_init(Batch *batch) {
+    memset(batch, 0, sizeof(*batch));
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->work, NULL);
+}
+
+BatchJob *batch_job_new(const AppConfig *base, struct json_object *entry) {
+    BatchJob *job = calloc(1, sizeof(BatchJob));
+    if (!job) {
+        return NULL;
+    }
+    if (config_copy(&job->config, base) < 0) {
+        free(job);
+        return NULL;
+    }
+
+    struct json_object *value;
+    if (json_object_object_get_ex(entry, "config", &value)) {
+        config_apply_json(&job->config, value);
+    }
+    if (json_object_object_get_ex(entry, "quiz", &value)) {
+        job->quiz_json = json_object_get(value);
+    }
+    if (json_object_object_get_ex(entry, "quiz_file", &value)) {
+        set_config_string(&job->config.quiz_file, json_object_get_string(value));
+    }
+    if (json_object_object_get_ex(entry, "output", &value)) {
+        set_config_string(&job->config.output_file, json_object_get_string(value));
+    }
+
+    /* Fonts are loaded once per worker for the whole batch */
+    if (strcmp(job->config.font_path, base->font_path) != 0) {
+        fprintf(stderr, "font_path cannot change within a batch, using %s\n",
+                base->font_path);
+        set_config_string(&job->config.font_path, base->font_path);
+    }
+    return job;
+}
+
+int batch_load(Batch *batch, const char *manifest_file, const AppConfig *base) {
+    batch_init(batch);
+
+    struct json_object *root = json_object_from_file(manifest_file);
+    if (!root) {
+        fprintf(stderr, "Failed to parse batch manifest: %s\n", manifest_file);
+        batch_free(batch);
+        return -1;
+    }
+
+    struct json_object *jobs;
+    if (!json_object_object_get_ex(root, "jobs", &jobs) ||
+        !json_object_is_type(jobs, json_type_array)) {
+        fprintf(stderr, "No 'jobs' array in batch manifest\n");
+        json_object_put(root);
+        batch_free(batch);
+        return -1;
+    }
+
+    struct json_object *value;
+    const char *report = "batch_report.json";
+    if (json_object_object_get_ex(root, "report", &value)) {
+        report = json_object_get_string(value);
+    }
+    batch->report_path = copy_string(report);
+
+    int num_jobs = (int)json_object_array_length(jobs);
+    for (int i = 0; i < num_jobs && batch->report_path; i++) {
+        BatchJob *job = batch_job_new(base, json_object_array_get_idx(jobs, i));
+        if (!job || append_job(batch, job) < 0) {
+            if (job) free_job(job);
+            break;
+        }
+    }
+    json_object_put(root);
+
+    if (!batch->report_path || batch->num_jobs < num_jobs) {
+        fprintf(stderr, "Failed to allocate batch\n");
+        batch_free(batch);
+        return -1;
+    }
+
+    printf("Batch loaded from %s: %d jobs\n", manifest_file, batch->num_jobs);
+    return 0;
+}
+
+static const char *status_name(BatchJobStatus status) {
+    switch (status) {
+    case BATCH_JOB_DONE: return "done";
+    case BATCH_JOB_FAILED: return "failed";
+    case BATCH_JOB_STARTING: return "starting";
+    case BATCH_JOB_RUNNING: return "running";
+    default: return "pending";
+    }
+}
+
+/* Write one entry per job plus totals */
+static int write_report(const Batch *batch, double seconds) {
+    struct json_object *root = json_object_new_object();
+    struct json_object *jobs = json_object_new_array();
+    int failed = 0;
+
+    for (int i = 0; i < batch->num_jobs; i++) {
+        const BatchJob *job = batch->jobs[i];
+        struct json_object *entry = json_object_new_object();
+
+        json_object_object_add(entry, "quiz_file", json_object_new_string(job->config.quiz_file));
+        json_object_object_add(entry, "output", json_object_new_string(job->config.output_file));
+        json_object_object_add(entry, "status", json_object_new_string(status_name(job->status)));
+        if (job->failed) {
+            json_object_object_add(entry, "error", json_object_new_string(job->error));
+            failed++;
+        }
+        int questions = job->frames_per_question > 0 ?
+                        job->total_frames / job->frames_per_question : 0;
+        json_object_object_add(entry, "questions", json_object_new_int(questions));
+        json_object_object_add(entry, "frames", json_object_new_int(job->output.frame_count));
+        json_object_object_add(entry, "segments", json_object_new_int(job->num_segments));
+        json_object_object_add(entry, "seconds", json_object_new_double(job->seconds));
+        json_object_array_add(jobs, entry);
+    }
+
+    json_object_object_add(root, "jobs", jobs);
+    json_object_object_add(root, "succeeded", json_object_new_int(batch->num_jobs - failed));
+    json_object_object_add(root, "failed", json_object_new_int(failed));
+    json_object_object_add(root, "workers", json_object_new_int(batch->num_workers));
+    json_object_object_add(root, "seconds", json_object_new_double(seconds));
+
+    int ret = json_object_to_file_ext(batch->report_path, root, JSON_C_TO_STRING_PRETTY);
+    json_object_put(root);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to write batch report: %s\n", batch->report_path);
+        return -1;
+    }
+    return failed;
+}
+
+int batch_start(Batch *batch, const AppConfig *base) {
+    int threads = base->render.threads;
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > RENDER_POOL_MAX_WORKERS) threads = RENDER_POOL_MAX_WORKERS;
+    if (threads < 1) threads = 1;
+
+    batch->num_workers = threads;
+    batch->workers = calloc(threads, sizeof(BatchWorker));
+    if (!batch->workers) {
+        fprintf(stderr, "Failed to allocate batch workers\n");
+        return -1;
+    }
+
+    /* Fonts and glyph caches are loaded here once and shared by every job
+     * a worker renders */
+    ColorScheme colors;
+    config_resolve_colors(base, &colors);
+    for (int i = 0; i < batch->num_workers; i++) {
+        BatchWorker *worker = &batch->workers[i];
+        worker->batch = batch;
+        if (render_context_init(&worker->rc, base->font_path, &colors) < 0) {
+            return -1;
+        }
+    }
+
+    /* Threads that did start still drain the whole batch */
+    int started = 0;
+    for (int i = 0; i < batch->num_workers; i++) {
+        BatchWorker *worker = &batch->workers[i];
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr, "Failed to start batch thread\n");
+            break;
+        }
+        worker->started = 1;
+        started++;
+    }
+    return started > 0 ? 0 : -1;
+}
+
+/* Called with the batch lock held */
+static int count_queued(const Batch *batch) {
+    int queued = 0;
+    for (int i = batch->next_job; i < batch->num_jobs; i++) {
+        if (batch->jobs[i]->status == BATCH_JOB_PENDING) {
+            queued++;
+        }
+    }
+    return queued;
+}
+
+int batch_submit(Batch *batch, BatchJob *job) {
+    pthread_mutex_lock(&batch->lock);
+    drop_closed_jobs(batch);
+
+    job->queued_behind = count_queued(batch);
+    if (append_job(batch, job) < 0) {
+        pthread_mutex_unlock(&batch->lock);
+        free_job(job);
+        return -1;
+    }
+    if (batch->on_event) {
+        batch->on_event(job, BATCH_EVENT_QUEUED);
+    }
+    pthread_cond_broadcast(&batch->work);
+    pthread_mutex_unlock(&batch->lock);
+    return 0;
+}
+
+void batch_counts(Batch *batch, int *running, int *queued) {
+    pthread_mutex_lock(&batch->lock);
+    *running = batch->running;
+    *queued = count_queued(batch);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+void batch_wait(Batch *batch) {
+    pthread_mutex_lock(&batch->lock);
+    batch->serving = 0;
+    pthread_cond_broadcast(&batch->work);
+    pthread_mutex_unlock(&batch->lock);
+
+    for (int i = 0; i < batch->num_workers; i++) {
+        if (batch->workers[i].started) {
+            pthread_join(batch->workers[i].thread, NULL);
+            batch->workers[i].started = 0;
+        }
+    }
+}
+
+int batch_run(Batch *batch, const AppConfig *base) {
+    double start = now_seconds();
+    if (batch_start(batch, base) < 0) {
+        return -1;
+    }
+    printf("Running %d jobs on %d threads\n", batch->num_jobs, batch->num_workers);
+    batch_wait(batch);
+
+    double seconds = now_seconds() - start;
+    int failed = write_report(batch, seconds);
+    printf("Batch finished in %.1f s: %d/%d jobs done, report in %s\n", seconds,
+           batch->num_jobs - (failed > 0 ? failed : 0), batch->num_jobs, batch->report_path);
+    return failed;
+}
+
+void batch_free(Batch *batch) {
+    if (batch->workers) {
+        for (int i = 0; i < batch->num_workers; i++) {
+            render_context_free(&batch->workers[i].rc);
+            render_slot_free(&batch->workers[i].buffer);
+        }
+        free(batch->workers);
+        batch->workers = NULL;
+    }
+
+    if (batch->jobs) {
+        for (int i = 0; i < batch->num_jobs; i++) {
+            free_job(batch->jobs[i]);
+        }
+        free(batch->jobs);
+        batch->jobs = NULL;
+        batch->num_jobs = 0;
+    }
+
+    free(batch->report_path);
+    batch->report_path = NULL;
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->work);
+}
@@ -1,8 +1,5 @@
 #include "colors.h"
 
-/* Active color scheme (global) */
-ColorScheme active_colors;
-
 /* Grayscale color scheme (minimalistic) */
 const ColorScheme COLOR_SCHEME_GRAYSCALE = {
     .background = {15, 15, 15},           /* Very dark gray */
@@ -67,11 +64,11 @@ const ColorScheme COLOR_SCHEME_DEFAULT = {
     .accent = {0, 150, 255}               /* Blue */
 };
 
-void colors_init(const ColorScheme *scheme) {
+void colors_init(ColorScheme *colors, const ColorScheme *scheme) {
     if (scheme) {
-        active_colors = *scheme;
+        *colors = *scheme;
     } else {
         /* Default to colorblind-friendly if none specified */
-        active_colors = COLOR_SCHEME_COLORBLIND_ALTERNATIVE;
+        *colors = COLOR_SCHEME_COLORBLIND_ALTERNATIVE;
     }
 }
@@ -5,6 +5,13 @@
 #include "config.h"
 #include "colors.h"
 
+/* Draft renders keep at least this frame rate and bitrate (kbit/s) */
+#define CONFIG_DRAFT_MIN_FPS 12
+#define CONFIG_DRAFT_MIN_BITRATE 200
+
+/* output.sink names, in OutputSink order */
+static const char *const sink_names[] = {"encoder", "null", "y4m", "images"};
+
 /* Helper to get int from JSON object */
 static int get_json_int(struct json_object *obj, const char *key, int default_value) {
     struct json_object *value;
@@ -36,7 +43,7 @@ static char *strdup_safe(const char *str) {
 
 AppConfig config_get_default(void) {
     AppConfig config = {
-        .video = {1080, 1920, 30},
+        .video = {1080, 1920, 30, YUV_MATRIX_BT709, CANVAS_YUV420P},
         .layout = {
             .question_font_size = 64,
             .question_y_position = 400,
@@ -47,7 +54,8 @@ AppConfig config_get_default(void) {
             .button_height = 120,
             .button_radius = 20,
             .button_text_padding = 40,
-            .timer_bar_height = 80
+            .timer_bar_height = 80,
+            .scale = 1.0f
         },
         .animation = {
           .question_fade_duration = 0.5f,
@@ -55,6 +63,41 @@ AppConfig config_get_default(void) {
           .answer_delay_between = 0.3f,
           .question_delay = 0.0f
         },
+        .render = {
+            .mode = RENDER_MODE_POOL,
+            .threads = 0,
+            .queue_depth = 2
+        },
+        .encoder = {
+            .preset = "medium",
+            .tune = "",
+            .crf = 23,
+            .bitrate = 0,
+            .keyint = 150,
+            .b_frames = 1,
+            .threads = 0,
+            .thread_type = ENCODER_THREADS_AUTO,
+            .segment_questions = 0
+        },
+        .server = {
+            .max_jobs = 2,
+            .max_queued = 16
+        },
+        .audio = {
+            .source = AUDIO_SOURCE_NONE,
+            .voice_model = "",
+            .speed = 1.0f,
+            .sample_rate = 44100,
+            .bitrate = 96,
+            .cache_dir = "cache/tts",
+            .cache_max_mb = 256,
+            .tts_workers = 2,
+            .speak_answers = 0
+        },
+        .output = {
+            .container = OUTPUT_CONTAINER_AUTO,
+            .fragment = OUTPUT_FRAGMENT_KEYFRAME
+        },
         .color_scheme = "colorblind",
         .font_path = "assets/fonts/Roboto-Bold.ttf",
         .quiz_file = "examples/sample_quiz.json",
@@ -63,71 +106,278 @@ AppConfig config_get_default(void) {
     return config;
 }
 
-int config_load(AppConfig *config, const char *config_file) {
-    /* Read JSON file */
-    struct json_object *root = json_object_from_file(config_file);
-    if (!root) {
-        fprintf(stderr, "Failed to parse config file: %s\n", config_file);
-        fprintf(stderr, "Using default configuration.\n");
-        *config = config_get_default();
-        return -1;
+/* Replace an owned string setting */
+static void set_string(const char **field, const char *value) {
+    free((void *)*field);
+    *field = strdup_safe(value);
+}
+
+/* Apply the settings present in an "encoder" object */
+static void parse_encoder(EncoderSettings *enc, struct json_object *encoder) {
+    const char *preset = get_json_string(encoder, "preset", NULL);
+    if (preset) snprintf(enc->preset, sizeof(enc->preset), "%s", preset);
+    const char *tune = get_json_string(encoder, "tune", NULL);
+    if (tune) snprintf(enc->tune, sizeof(enc->tune), "%s", tune);
+    enc->crf = get_json_int(encoder, "crf", enc->crf);
+    enc->bitrate = get_json_int(encoder, "bitrate", enc->bitrate);
+    enc->keyint = get_json_int(encoder, "keyint", enc->keyint);
+    enc->b_frames = get_json_int(encoder, "b_frames", enc->b_frames);
+    enc->threads = get_json_int(encoder, "threads", enc->threads);
+    enc->segment_questions = get_json_int(encoder, "segment_questions", enc->segment_questions);
+
+    if (enc->crf < 0 || enc->crf > 51) {
+        fprintf(stderr, "crf %d out of range 0-51, using 23\n", enc->crf);
+        enc->crf = 23;
     }
+    if (enc->bitrate < 0) enc->bitrate = 0;
+    if (enc->keyint < 1) enc->keyint = 1;
+    if (enc->b_frames < 0) enc->b_frames = 0;
+    if (enc->threads < 0) enc->threads = 0;
+    if (enc->segment_questions < 0) enc->segment_questions = 0;
 
-    /* Start with defaults */
-    *config = config_get_default();
+    const char *thread_type = get_json_string(encoder, "thread_type", NULL);
+    if (!thread_type) {
+        /* Keep the current threading */
+    } else if (strcmp(thread_type, "auto") == 0) {
+        enc->thread_type = ENCODER_THREADS_AUTO;
+    } else if (strcmp(thread_type, "frame") == 0) {
+        enc->thread_type = ENCODER_THREADS_FRAME;
+    } else if (strcmp(thread_type, "slice") == 0) {
+        enc->thread_type = ENCODER_THREADS_SLICE;
+    } else {
+        fprintf(stderr, "Unknown encoder thread type: %s, using auto\n", thread_type);
+        enc->thread_type = ENCODER_THREADS_AUTO;
+    }
+}
+
+/* Replace the rendition list with the entries of a "renditions" array:
+ * [{"width": 720, "height": 1280, "file": "...", "encoder": {...}}, ...] */
+static void parse_renditions(AppConfig *config, struct json_object *array) {
+    OutputSettings *out = &config->output;
+    out->num_renditions = 0;
+    if (!json_object_is_type(array, json_type_array)) {
+        fprintf(stderr, "output.renditions is not an array, ignoring it\n");
+        return;
+    }
 
+    size_t count = json_object_array_length(array);
+    for (size_t i = 0; i < count; i++) {
+        struct json_object *entry = json_object_array_get_idx(array, i);
+        int width = get_json_int(entry, "width", 0) & ~1;
+        int height = get_json_int(entry, "height", 0) & ~1;
+        const char *file = get_json_string(entry, "file", NULL);
+        if (width < 2 || height < 2 || !file || !file[0]) {
+            fprintf(stderr, "Rendition %zu needs width, height and file, skipping it\n", i + 1);
+            continue;
+        }
+        if (out->num_renditions == OUTPUT_MAX_RENDITIONS) {
+            fprintf(stderr, "More than %d renditions, ignoring the rest\n",
+                    OUTPUT_MAX_RENDITIONS);
+            break;
+        }
+
+        RenditionSettings *rendition = &out->renditions[out->num_renditions++];
+        rendition->width = width;
+        rendition->height = height;
+        snprintf(rendition->file, sizeof(rendition->file), "%s", file);
+
+        /* A target bitrate shrinks with the frame unless one is given */
+        rendition->encoder = config->encoder;
+        EncoderSettings *enc = &rendition->encoder;
+        if (enc->bitrate > 0) {
+            enc->bitrate = (int)((int64_t)enc->bitrate * width * height /
+                                 ((int64_t)config->video.width * config->video.height));
+            if (enc->bitrate < 1) enc->bitrate = 1;
+        }
+        struct json_object *encoder;
+        if (json_object_object_get_ex(entry, "encoder", &encoder)) {
+            parse_encoder(enc, encoder);
+        }
+    }
+}
+
+void config_apply_json(AppConfig *config, struct json_object *root) {
     /* Parse video settings */
     struct json_object *video;
     if (json_object_object_get_ex(root, "video", &video)) {
-        config->video.width = get_json_int(video, "width", 1080);
-        config->video.height = get_json_int(video, "height", 1920);
-        config->video.fps = get_json_int(video, "fps", 30);
+        config->video.width = get_json_int(video, "width", config->video.width);
+        config->video.height = get_json_int(video, "height", config->video.height);
+        config->video.fps = get_json_int(video, "fps", config->video.fps);
+
+        const char *matrix = get_json_string(video, "color_matrix", NULL);
+        if (matrix && yuv_matrix_from_name(matrix, &config->video.color_matrix) < 0) {
+            fprintf(stderr, "Unknown color matrix: %s, using bt709\n", matrix);
+            config->video.color_matrix = YUV_MATRIX_BT709;
+        }
+
+        const char *format = get_json_string(video, "render_format", NULL);
+        if (!format) {
+            /* Keep the current format */
+        } else if (strcmp(format, "rgb24") == 0) {
+            config->video.render_format = CANVAS_RGB24;
+        } else if (strcmp(format, "yuv420p") == 0) {
+            config->video.render_format = CANVAS_YUV420P;
+        } else {
+            fprintf(stderr, "Unknown render format: %s, using yuv420p\n", format);
+            config->video.render_format = CANVAS_YUV420P;
+        }
     }
 
     /* Parse layout settings */
     struct json_object *layout;
     if (json_object_object_get_ex(root, "layout", &layout)) {
-        config->layout.question_font_size = get_json_int(layout, "question_font_size", 64);
-        config->layout.question_y_position = get_json_int(layout, "question_y_position", 400);
-        config->layout.answer_font_size = get_json_int(layout, "answer_font_size", 48);
-        config->layout.answer_y_start = get_json_int(layout, "answer_y_start", 700);
-        config->layout.answer_spacing = get_json_int(layout, "answer_spacing", 150);
-        config->layout.button_margin = get_json_int(layout, "button_margin", 100);
-        config->layout.button_height = get_json_int(layout, "button_height", 120);
-        config->layout.button_radius = get_json_int(layout, "button_radius", 20);
-        config->layout.button_text_padding = get_json_int(layout, "button_text_padding", 40);
-        config->layout.timer_bar_height = get_json_int(layout, "timer_bar_height", 80);
+        config->layout.question_font_size = get_json_int(layout, "question_font_size", config->layout.question_font_size);
+        config->layout.question_y_position = get_json_int(layout, "question_y_position", config->layout.question_y_position);
+        config->layout.answer_font_size = get_json_int(layout, "answer_font_size", config->layout.answer_font_size);
+        config->layout.answer_y_start = get_json_int(layout, "answer_y_start", config->layout.answer_y_start);
+        config->layout.answer_spacing = get_json_int(layout, "answer_spacing", config->layout.answer_spacing);
+        config->layout.button_margin = get_json_int(layout, "button_margin", config->layout.button_margin);
+        config->layout.button_height = get_json_int(layout, "button_height", config->layout.button_height);
+        config->layout.button_radius = get_json_int(layout, "button_radius", config->layout.button_radius);
+        config->layout.button_text_padding = get_json_int(layout, "button_text_padding", config->layout.button_text_padding);
+        config->layout.timer_bar_height = get_json_int(layout, "timer_bar_height", config->layout.timer_bar_height);
+    }
+
+    /* Parse render settings */
+    struct json_object *render;
+    if (json_object_object_get_ex(root, "render", &render)) {
+        config->render.threads = get_json_int(render, "threads", config->render.threads);
+        config->render.queue_depth = get_json_int(render, "queue_depth", config->render.queue_depth);
+        if (config->render.threads < 0) config->render.threads = 0;
+        if (config->render.queue_depth < 1) config->render.queue_depth = 1;
+
+        const char *mode = get_json_string(render, "mode", NULL);
+        if (!mode) {
+            /* Keep the current mode */
+        } else if (strcmp(mode, "pool") == 0) {
+            config->render.mode = RENDER_MODE_POOL;
+        } else if (strcmp(mode, "pipeline") == 0) {
+            config->render.mode = RENDER_MODE_PIPELINE;
+        } else {
+            fprintf(stderr, "Unknown render mode: %s, using pool\n", mode);
+            config->render.mode = RENDER_MODE_POOL;
+        }
+    }
+
+    /* Parse encoder settings */
+    struct json_object *encoder;
+    if (json_object_object_get_ex(root, "encoder", &encoder)) {
+        parse_encoder(&config->encoder, encoder);
+    }
+
+    /* Parse server settings */
+    struct json_object *server;
+    if (json_object_object_get_ex(root, "server", &server)) {
+        config->server.max_jobs = get_json_int(server, "max_jobs", config->server.max_jobs);
+        config->server.max_queued = get_json_int(server, "max_queued", config->server.max_queued);
+        if (config->server.max_jobs < 1) config->server.max_jobs = 1;
+        if (config->server.max_queued < 0) config->server.max_queued = 0;
+    }
+
+    /* Parse voiceover settings */
+    struct json_object *audio;
+    if (json_object_object_get_ex(root, "audio", &audio)) {
+        AudioSettings *aud = &config->audio;
+        const char *model = get_json_string(audio, "voice_model", NULL);
+        if (model) set_string(&aud->voice_model, model);
+        const char *cache_dir = get_json_string(audio, "cache_dir", NULL);
+        if (cache_dir) set_string(&aud->cache_dir, cache_dir);
+        aud->cache_max_mb = get_json_int(audio, "cache_max_mb", aud->cache_max_mb);
+        if (aud->cache_max_mb < 1) aud->cache_max_mb = 1;
+        struct json_object *val;
+        if (json_object_object_get_ex(audio, "speed", &val)) {
+            aud->speed = (float)json_object_get_double(val);
+        }
+        aud->sample_rate = get_json_int(audio, "sample_rate", aud->sample_rate);
+        aud->bitrate = get_json_int(audio, "bitrate", aud->bitrate);
+        if (aud->speed < 0.5f || aud->speed > 2.0f) {
+            fprintf(stderr, "Audio speed %.2f out of range 0.5-2.0, using 1.0\n", aud->speed);
+            aud->speed = 1.0f;
+        }
+        if (aud->sample_rate < 8000) aud->sample_rate = 44100;
+        if (aud->bitrate < 16) aud->bitrate = 16;
+        aud->tts_workers = get_json_int(audio, "tts_workers", aud->tts_workers);
+        if (aud->tts_workers < 1) aud->tts_workers = 1;
+        if (aud->tts_workers > 16) aud->tts_workers = 16;
+        aud->speak_answers = get_json_int(audio, "speak_answers", aud->speak_answers) != 0;
+
+        const char *source = get_json_string(audio, "source", NULL);
+        if (!source) {
+            /* Keep the current source */
+        } else if (strcmp(source, "none") == 0) {
+            aud->source = AUDIO_SOURCE_NONE;
+        } else if (strcmp(source, "piper") == 0) {
+            aud->source = AUDIO_SOURCE_TTS_PIPER;
+        } else if (strcmp(source, "file") == 0) {
+            aud->source = AUDIO_SOURCE_FILE;
+        } else {
+            fprintf(stderr, "Unknown audio source: %s, using none\n", source);
+            aud->source = AUDIO_SOURCE_NONE;
+        }
     }
 
     /* Parse appearance settings */
     struct json_object *appearance;
     if (json_object_object_get_ex(root, "appearance", &appearance)) {
-        const char *scheme = get_json_string(appearance, "color_scheme", "colorblind");
-        config->color_scheme = strdup_safe(scheme);
+        const char *scheme = get_json_string(appearance, "color_scheme", NULL);
+        if (scheme) set_string(&config->color_scheme, scheme);
 
-        const char *font = get_json_string(appearance, "font_path", "assets/fonts/Roboto-Bold.ttf");
-        config->font_path = strdup_safe(font);
-    } else {
-        config->color_scheme = strdup_safe("colorblind");
-        config->font_path = strdup_safe("assets/fonts/Roboto-Bold.ttf");
+        const char *font = get_json_string(appearance, "font_path", NULL);
+        if (font) set_string(&config->font_path, font);
     }
 
     /* Parse input settings */
     struct json_object *input;
     if (json_object_object_get_ex(root, "input", &input)) {
-        const char *quiz = get_json_string(input, "quiz_file", "examples/sample_quiz.json");
-        config->quiz_file = strdup_safe(quiz);
-    } else {
-        config->quiz_file = strdup_safe("examples/sample_quiz.json");
+        const char *quiz = get_json_string(input, "quiz_file", NULL);
+        if (quiz) set_string(&config->quiz_file, quiz);
     }
 
     /* Parse output settings */
     struct json_object *output;
     if (json_object_object_get_ex(root, "output", &output)) {
-        const char *file = get_json_string(output, "file", "quiz_video.mp4");
-        config->output_file = strdup_safe(file);
-    } else {
-        config->output_file = strdup_safe("quiz_video.mp4");
+        const char *file = get_json_string(output, "file", NULL);
+        if (file) set_string(&config->output_file, file);
+
+        const char *sink = get_json_string(output, "sink", NULL);
+        if (sink && config_parse_sink(sink, &config->output.sink) < 0) {
+            fprintf(stderr, "Unknown output sink: %s, using encoder\n", sink);
+            config->output.sink = OUTPUT_SINK_ENCODER;
+        }
+
+        const char *container = get_json_string(output, "container", NULL);
+        if (!container) {
+            /* Keep the current container */
+        } else if (strcmp(container, "auto") == 0) {
+            config->output.container = OUTPUT_CONTAINER_AUTO;
+        } else if (strcmp(container, "mp4") == 0) {
+            config->output.container = OUTPUT_CONTAINER_MP4;
+        } else if (strcmp(container, "fmp4") == 0) {
+            config->output.container = OUTPUT_CONTAINER_FMP4;
+        } else if (strcmp(container, "mpegts") == 0) {
+            config->output.container = OUTPUT_CONTAINER_MPEGTS;
+        } else {
+            fprintf(stderr, "Unknown output container: %s, using auto\n", container);
+            config->output.container = OUTPUT_CONTAINER_AUTO;
+        }
+
+        const char *fragment = get_json_string(output, "fragment", NULL);
+        if (!fragment) {
+            /* Keep the current fragmenting */
+        } else if (strcmp(fragment, "keyframe") == 0) {
+            config->output.fragment = OUTPUT_FRAGMENT_KEYFRAME;
+        } else if (strcmp(fragment, "question") == 0) {
+            config->output.fragment = OUTPUT_FRAGMENT_QUESTION;
+        } else {
+            fprintf(stderr, "Unknown output fragment: %s, using keyframe\n", fragment);
+            config->output.fragment = OUTPUT_FRAGMENT_KEYFRAME;
+        }
+
+        /* Renditions start from the encoder settings parsed above */
+        struct json_object *renditions;
+        if (json_object_object_get_ex(output, "renditions", &renditions)) {
+            parse_renditions(config, renditions);
+        }
     }
 
     /* Parse animation settings */
@@ -149,12 +399,52 @@ int config_load(AppConfig *config, const char *config_file) {
         }
     }
 
+}
+
+/* Give the config its own copies of every string setting */
+static int own_strings(AppConfig *config) {
+    config->color_scheme = strdup_safe(config->color_scheme);
+    config->font_path = strdup_safe(config->font_path);
+    config->quiz_file = strdup_safe(config->quiz_file);
+    config->output_file = strdup_safe(config->output_file);
+    config->audio.voice_model = strdup_safe(config->audio.voice_model);
+    config->audio.cache_dir = strdup_safe(config->audio.cache_dir);
+    if (!config->color_scheme || !config->font_path ||
+        !config->quiz_file || !config->output_file ||
+        !config->audio.voice_model || !config->audio.cache_dir) {
+        config_free(config);
+        return -1;
+    }
+    return 0;
+}
+
+int config_load(AppConfig *config, const char *config_file) {
+    /* Start with defaults */
+    *config = config_get_default();
+    own_strings(config);
+
+    /* Read JSON file */
+    struct json_object *root = json_object_from_file(config_file);
+    if (!root) {
+        fprintf(stderr, "Failed to parse config file: %s\n", config_file);
+        fprintf(stderr, "Using default configuration.\n");
+        return -1;
+    }
+
+    config_apply_json(config, root);
+
     json_object_put(root);
     printf("Configuration loaded from %s\n", config_file);
 
     return 0;
 }
 
+int config_copy(AppConfig *dst, const AppConfig *src) {
+    *dst = *src;
+    return own_strings(dst);
+}
+
+
 void config_free(AppConfig *config) {
     if (config->color_scheme) {
         free((void *)config->color_scheme);
@@ -172,28 +462,132 @@ void config_free(AppConfig *config) {
         free((void *)config->output_file);
         config->output_file = NULL;
     }
+    if (config->audio.voice_model) {
+        free((void *)config->audio.voice_model);
+        config->audio.voice_model = NULL;
+    }
+    if (config->audio.cache_dir) {
+        free((void *)config->audio.cache_dir);
+        config->audio.cache_dir = NULL;
+    }
 }
 
-int config_apply(const AppConfig *config) {
-    /* Apply color scheme */
+int config_parse_sink(const char *name, OutputSink *sink) {
+    for (int i = 0; i < (int)(sizeof(sink_names) / sizeof(sink_names[0])); i++) {
+        if (strcmp(name, sink_names[i]) == 0) {
+            *sink = (OutputSink)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int config_make_draft(AppConfig *config, int divisor) {
+    if (divisor < 1) {
+        fprintf(stderr, "Invalid draft scale 1/%d\n", divisor);
+        return -1;
+    }
+
+    /* Even sizes, as 4:2:0 chroma needs */
+    config->video.width = (config->video.width / divisor) & ~1;
+    config->video.height = (config->video.height / divisor) & ~1;
+    if (config->video.width < 2 || config->video.height < 2) {
+        fprintf(stderr, "Draft scale 1/%d leaves no frame\n", divisor);
+        return -1;
+    }
+    config->layout.scale /= divisor;
+
+    /* A preview is one small file */
+    config->output.num_renditions = 0;
+
+    /* Half the frame rate, but still smooth enough to judge the fades */
+    int fps = config->video.fps;
+    int draft_fps = fps / 2 < CONFIG_DRAFT_MIN_FPS ? CONFIG_DRAFT_MIN_FPS : fps / 2;
+    if (draft_fps < fps) {
+        config->video.fps = draft_fps;
+    }
+
+    /* Keyframes as far apart in time as in the full render */
+    EncoderSettings *enc = &config->encoder;
+    enc->keyint = enc->keyint * config->video.fps / fps;
+    if (enc->keyint < 1) enc->keyint = 1;
+    snprintf(enc->preset, sizeof(enc->preset), "ultrafast");
+    enc->b_frames = 0;
+    if (enc->bitrate > 0) {
+        enc->bitrate /= divisor * divisor;
+        if (enc->bitrate < CONFIG_DRAFT_MIN_BITRATE) enc->bitrate = CONFIG_DRAFT_MIN_BITRATE;
+    }
+
+    /* Never overwrite the full render: quiz.mp4 becomes quiz.draft.mp4 */
+    const char *file = config->output_file;
+    if (strcmp(file, "-") == 0 || strncmp(file, "fd:", 3) == 0) {
+        return 0;
+    }
+    const char *slash = strrchr(file, '/');
+    const char *dot = strrchr(file, '.');
+    size_t base = dot && dot > (slash ? slash + 1 : file) ? (size_t)(dot - file) : strlen(file);
+    size_t len = strlen(file) + sizeof(".draft");
+    char *draft = malloc(len);
+    if (!draft) {
+        fprintf(stderr, "Failed to allocate draft output name\n");
+        return -1;
+    }
+    snprintf(draft, len, "%.*s.draft%s", (int)base, file, file + base);
+    free((void *)config->output_file);
+    config->output_file = draft;
+    return 0;
+}
+
+int config_resolve_colors(const AppConfig *config, ColorScheme *colors) {
     if (strcmp(config->color_scheme, "grayscale") == 0) {
-        colors_init(&COLOR_SCHEME_GRAYSCALE);
+        colors_init(colors, &COLOR_SCHEME_GRAYSCALE);
     } else if (strcmp(config->color_scheme, "colorblind") == 0) {
-        colors_init(&COLOR_SCHEME_COLORBLIND_ALTERNATIVE);
+        colors_init(colors, &COLOR_SCHEME_COLORBLIND_ALTERNATIVE);
     } else if (strcmp(config->color_scheme, "default") == 0) {
-        colors_init(&COLOR_SCHEME_DEFAULT);
+        colors_init(colors, &COLOR_SCHEME_DEFAULT);
     } else {
         fprintf(stderr, "Unknown color scheme: %s, using colorblind\n", config->color_scheme);
-        colors_init(&COLOR_SCHEME_COLORBLIND);
+        colors_init(colors, &COLOR_SCHEME_COLORBLIND);
+        return -1;
+    }
+    return 0;
+}
+
+int config_apply(const AppConfig *config, ColorScheme *colors) {
+    /* Apply color scheme */
+    if (config_resolve_colors(config, colors) < 0) {
         return -1;
     }
 
     printf("Applied configuration:\n");
-    printf("  Video: %dx%d @ %d fps\n", config->video.width, config->video.height, config->video.fps);
+    printf("  Video: %dx%d @ %d fps (%s canvas)\n", config->video.width, config->video.height,
+           config->video.fps, config->video.render_format == CANVAS_RGB24 ? "rgb24" : "yuv420p");
+    const EncoderSettings *enc = &config->encoder;
+    if (enc->bitrate > 0) {
+        printf("  Encoder: preset %s, %d kbit/s", enc->preset, enc->bitrate);
+    } else {
+        printf("  Encoder: preset %s, crf %d", enc->preset, enc->crf);
+    }
+    printf(", keyint %d, %d b-frames%s%s\n", enc->keyint, enc->b_frames,
+           enc->tune[0] ? ", tune " : "", enc->tune);
+    if (enc->segment_questions > 0) {
+        printf("  Segments: one encoder per %d question(s)\n", enc->segment_questions);
+    }
+    if (config->audio.source != AUDIO_SOURCE_NONE) {
+        printf("  Voiceover: %s, AAC %d Hz @ %d kbit/s\n",
+               config->audio.source == AUDIO_SOURCE_TTS_PIPER ? "Piper TTS" : "question files",
+               config->audio.sample_rate, config->audio.bitrate);
+    }
     printf("  Color scheme: %s\n", config->color_scheme);
     printf("  Font: %s\n", config->font_path);
     printf("  Quiz: %s\n", config->quiz_file);
-    printf("  Output: %s\n\n", config->output_file);
+    printf("  Output: %s (%s)\n", config->output_file, sink_names[config->output.sink]);
+    for (int i = 0; i < config->output.num_renditions; i++) {
+        const RenditionSettings *rendition = &config->output.renditions[i];
+        printf("  Rendition: %dx%d, preset %s -> %s\n", rendition->width, rendition->height,
+               rendition->encoder.preset, rendition->file);
+    }
+    printf("\n");
 
     return 0;
 }
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "frame_sink.h"
+#include "stats.h"
+
+/* Null sink */
+
+static int null_open(VideoEncoder *enc, const VideoConfig *config) {
+    (void)enc;
+    printf("Video null sink initialized: %dx%d @ %d fps, frames are dropped\n",
+           config->width, config->height, config->fps);
+    return 0;
+}
+
+static int null_write(VideoEncoder *enc) {
+    (void)enc;
+    return 0;
+}
+
+static void null_close(VideoEncoder *enc, int finish) {
+    (void)enc;
+    (void)finish;
+}
+
+const FrameSink frame_sink_null = {"null sink", null_open, null_write, null_close};
+
+/* YUV4MPEG2 sink */
+
+static int y4m_open(VideoEncoder *enc, const VideoConfig *config) {
+    const char *target = config->output_filename;
+    if (strcmp(target, "-") == 0) {
+        int fd = dup(STDOUT_FILENO);
+        enc->raw_file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    } else if (strncmp(target, "fd:", 3) == 0) {
+        enc->raw_file = fdopen(atoi(target + 3), "wb");
+    } else {
+        enc->raw_file = fopen(target, "wb");
+    }
+    if (!enc->raw_file) {
+        fprintf(stderr, "Could not open output %s\n", target);
+        return -1;
+    }
+
+    /* Chroma is the average of each 2x2 block, so sited in its center */
+    fprintf(enc->raw_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+            config->width, config->height, config->fps);
+
+    printf("Video y4m sink initialized: %dx%d @ %d fps -> %s\n",
+           config->width, config->height, config->fps, target);
+    return 0;
+}
+
+static int y4m_write(VideoEncoder *enc) {
+    const AVFrame *frame = enc->frame;
+    FILE *file = enc->raw_file;
+    uint64_t start = stats_start();
+
+    fputs("FRAME\n", file);
+    size_t total = 6;
+    for (int p = 0; p < 3; p++) {
+        int rows = p ? (frame->height + 1) / 2 : frame->height;
+        int bytes = p ? (frame->width + 1) / 2 : frame->width;
+        for (int row = 0; row < rows; row++) {
+            fwrite(frame->data[p] + row * frame->linesize[p], 1, bytes, file);
+        }
+        total += (size_t)rows * bytes;
+    }
+    stats_stop(STATS_MUX_WRITE, start);
+    stats_add_bytes(total);
+
+    if (ferror(file)) {
+        fprintf(stderr, "Could not write frame %d to %s\n", enc->frame_count,
+                enc->settings.output_filename);
+        return -1;
+    }
+    return 0;
+}
+
+static void y4m_close(VideoEncoder *enc, int finish) {
+    if (!enc->raw_file) {
+        return;
+    }
+    if (fclose(enc->raw_file) != 0 && finish) {
+        fprintf(stderr, "Could not finish %s\n", enc->settings.output_filename);
+    }
+    enc->raw_file = NULL;
+}
+
+const FrameSink frame_sink_y4m = {"y4m sink", y4m_open, y4m_write, y4m_close};
+
+/* Image sequence sink */
+
+/* Accept a name with exactly one %d (optionally zero-padded, like %05d);
+ * any other conversion would read arguments that are not there */
+static int check_pattern(const char *name) {
+    const char *percent = strchr(name, '%');
+    if (!percent) {
+        return 0;
+    }
+    const char *p = percent + 1;
+    if (*p == '0') p++;
+    while (isdigit((unsigned char)*p)) p++;
+    if (*p != 'd' || strchr(p, '%')) {
+        return -1;
+    }
+    return 1;
+}
+
+/* Frame file names and codec from the output name: "a/b.png" becomes
+ * "a/b_%05d.png"; a name with its own %d is used as it is */
+static int image_pattern(const char *file, char *pattern, size_t size,
+                         enum AVCodecID *codec) {
+    const char *slash = strrchr(file, '/');
+    const char *ext = strrchr(slash ? slash + 1 : file, '.');
+    if (ext && strcasecmp(ext, ".png") == 0) {
+        *codec = AV_CODEC_ID_PNG;
+    } else if (ext && (strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0)) {
+        *codec = AV_CODEC_ID_MJPEG;
+    } else {
+        fprintf(stderr, "Image sequence %s needs a .png, .jpg or .jpeg name\n", file);
+        return -1;
+    }
+
+    int numbered = check_pattern(file);
+    if (numbered < 0) {
+        fprintf(stderr, "Image sequence %s may only contain one %%d\n", file);
+        return -1;
+    }
+    int len = numbered ? snprintf(pattern, size, "%s", file)
+                       : snprintf(pattern, size, "%.*s_%%05d%s", (int)(ext - file), file, ext);
+    if (len < 0 || (size_t)len >= size) {
+        fprintf(stderr, "Image sequence name too long: %s\n", file);
+        return -1;
+    }
+    return 0;
+}
+
+static int images_open(VideoEncoder *enc, const VideoConfig *config) {
+    enum AVCodecID codec_id;
+    if (image_pattern(config->output_filename, enc->image_pattern,
+                      sizeof(enc->image_pattern), &codec_id) < 0) {
+        return -1;
+    }
+
+    const AVCodec *codec = avcodec_find_encoder(codec_id);
+    if (!codec) {
+        fprintf(stderr, "%s encoder not found\n", codec_id == AV_CODEC_ID_PNG ? "PNG" : "JPEG");
+        return -1;
+    }
+    enc->codec_ctx = avcodec_alloc_context3(codec);
+    if (!enc->codec_ctx) {
+        fprintf(stderr, "Could not allocate codec context\n");
+        return -1;
+    }
+
+    /* PNG is RGB; JPEG is full-range YUV at a fixed high quality */
+    AVCodecContext *ctx = enc->codec_ctx;
+    ctx->width = config->width;
+    ctx->height = config->height;
+    ctx->time_base = (AVRational){1, config->fps};
+    if (codec_id == AV_CODEC_ID_PNG) {
+        ctx->pix_fmt = AV_PIX_FMT_RGB24;
+    } else {
+        ctx->pix_fmt = AV_PIX_FMT_YUVJ420P;
+        ctx->color_range = AVCOL_RANGE_JPEG;
+        ctx->flags |= AV_CODEC_FLAG_QSCALE;
+        ctx->global_quality = FF_QP2LAMBDA * 2;
+    }
+    if (avcodec_open2(ctx, codec, NULL) < 0) {
+        fprintf(stderr, "Could not open image codec\n");
+        return -1;
+    }
+
+    enc->image_frame = av_frame_alloc();
+    if (!enc->image_frame) {
+        fprintf(stderr, "Could not allocate frame\n");
+        return -1;
+    }
+    enc->image_frame->format = ctx->pix_fmt;
+    enc->image_frame->width = ctx->width;
+    enc->image_frame->height = ctx->height;
+    if (av_frame_get_buffer(enc->image_frame, 0) < 0) {
+        fprintf(stderr, "Could not allocate frame buffer\n");
+        return -1;
+    }
+
+    /* Our frames are limited range in the configured matrix */
+    enc->image_scaler = sws_getContext(config->width, config->height, AV_PIX_FMT_YUV420P,
+                                       ctx->width, ctx->height, ctx->pix_fmt,
+                                       SWS_BICUBIC, NULL, NULL, NULL);
+    if (!enc->image_scaler) {
+        fprintf(stderr, "Could not set up image conversion\n");
+        return -1;
+    }
+    const int *coefficients = sws_getCoefficients(
+        config->color_matrix == YUV_MATRIX_BT709 ? SWS_CS_ITU709 : SWS_CS_ITU601);
+    sws_setColorspaceDetails(enc->image_scaler, coefficients, 0, coefficients, 1,
+                             0, 1 << 16, 1 << 16);
+
+    printf("Video image sink initialized: %dx%d, %s\n",
+           config->width, config->height, enc->image_pattern);
+    return 0;
+}
+
+/* Write one encoded image to the file for its frame number */
+static int write_image(VideoEncoder *enc, const AVPacket *pkt) {
+    char path[sizeof(enc->image_pattern) + 16];
+    snprintf(path, sizeof(path), enc->image_pattern, (int)pkt->pts);
+
+    uint64_t start = stats_start();
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return -1;
+    }
+    size_t written = fwrite(pkt->data, 1, pkt->size, file);
+    if (fclose(file) != 0 || written != (size_t)pkt->size) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return -1;
+    }
+    stats_stop(STATS_MUX_WRITE, start);
+    stats_add_bytes(written);
+    return 0;
+}
+
+static int images_write(VideoEncoder *enc) {
+    AVFrame *image = enc->image_frame;
+    if (av_frame_make_writable(image) < 0) {
+        fprintf(stderr, "Frame not writtable\n");
+        return -1;
+    }
+    sws_scale(enc->image_scaler, (const uint8_t *const *)enc->frame->data,
+              enc->frame->linesize, 0, enc->frame->height, image->data, image->linesize);
+    image->pts = enc->frame_count;
+    image->quality = enc->codec_ctx->global_quality;
+
+    if (avcodec_send_frame(enc->codec_ctx, image) < 0) {
+        fprintf(stderr, "Error encoding image\n");
+        return -1;
+    }
+    for (;;) {
+        int ret = avcodec_receive_packet(enc->codec_ctx, enc->packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return 0;
+        } else if (ret < 0) {
+            fprintf(stderr, "Error encoding image\n");
+            return -1;
+        }
+        ret = write_image(enc, enc->packet);
+        av_packet_unref(enc->packet);
+        if (ret < 0) {
+            return -1;
+        }
+    }
+}
+
+/* Images are intra-only and leave nothing in the encoder to flush */
+static void images_close(VideoEncoder *enc, int finish) {
+    (void)finish;
+    if (enc->image_scaler) {
+        sws_freeContext(enc->image_scaler);
+        enc->image_scaler = NULL;
+    }
+    if (enc->image_frame) av_frame_free(&enc->image_frame);
+    if (enc->codec_ctx) avcodec_free_context(&enc->codec_ctx);
+}
+
+const FrameSink frame_sink_images = {"image sink", images_open, images_write, images_close};
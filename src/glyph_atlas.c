@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "glyph_atlas.h"
+#include "trace.h"
+
+#define GLYPH_CHUNK_SIZE 256
+#define GLYPH_INDEX_INITIAL 512
+
+/* Hash the glyph key (face, size, codepoint) */
+static uint32_t glyph_hash(int face_id, int pixel_size, uint32_t codepoint) {
+    uint32_t h = 2166136261u;
+    h = (h ^ (uint32_t)face_id) * 16777619u;
+    h = (h ^ (uint32_t)pixel_size) * 16777619u;
+    h = (h ^ codepoint) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+static Glyph *glyph_at(GlyphAtlas *atlas, int n) {
+    return &atlas->chunks[n / GLYPH_CHUNK_SIZE][n % GLYPH_CHUNK_SIZE];
+}
+
+int glyph_atlas_init(GlyphAtlas *atlas) {
+    memset(atlas, 0, sizeof(*atlas));
+
+    atlas->index = malloc(GLYPH_INDEX_INITIAL * sizeof(int));
+    if (!atlas->index) {
+        fprintf(stderr, "Failed to allocate glyph atlas index\n");
+        return -1;
+    }
+    memset(atlas->index, 0xff, GLYPH_INDEX_INITIAL * sizeof(int));
+    atlas->index_capacity = GLYPH_INDEX_INITIAL;
+
+    return 0;
+}
+
+void glyph_atlas_clear(GlyphAtlas *atlas) {
+    /* Glyph chunks and the index are kept for reuse */
+    for (int i = 0; i < atlas->num_pages; i++) {
+        free(atlas->pages[i].pixels);
+    }
+    free(atlas->pages);
+    atlas->pages = NULL;
+    atlas->num_pages = 0;
+    atlas->count = 0;
+    memset(atlas->index, 0xff, atlas->index_capacity * sizeof(int));
+}
+
+void glyph_atlas_free(GlyphAtlas *atlas) {
+    for (int i = 0; i < atlas->num_chunks; i++) {
+        free(atlas->chunks[i]);
+    }
+    for (int i = 0; i < atlas->num_pages; i++) {
+        free(atlas->pages[i].pixels);
+    }
+    free(atlas->chunks);
+    free(atlas->pages);
+    free(atlas->index);
+    memset(atlas, 0, sizeof(*atlas));
+}
+
+/* Find the table slot for a key (either holding it or empty) */
+static int find_slot(GlyphAtlas *atlas, int face_id, int pixel_size,
+                     uint32_t codepoint) {
+    uint32_t mask = (uint32_t)atlas->index_capacity - 1;
+    uint32_t slot = glyph_hash(face_id, pixel_size, codepoint) & mask;
+
+    while (atlas->index[slot] >= 0) {
+        Glyph *g = glyph_at(atlas, atlas->index[slot]);
+        if (g->codepoint == codepoint && g->pixel_size == pixel_size &&
+            g->face_id == face_id) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return (int)slot;
+}
+
+/* Double the index table once it is more than half full */
+static int grow_index(GlyphAtlas *atlas) {
+    int new_capacity = atlas->index_capacity * 2;
+    int *new_index = malloc(new_capacity * sizeof(int));
+    if (!new_index) {
+        return -1;
+    }
+    memset(new_index, 0xff, new_capacity * sizeof(int));
+
+    int *old_index = atlas->index;
+    atlas->index = new_index;
+    atlas->index_capacity = new_capacity;
+
+    for (int n = 0; n < atlas->count; n++) {
+        Glyph *g = glyph_at(atlas, n);
+        int slot = find_slot(atlas, g->face_id, g->pixel_size, g->codepoint);
+        atlas->index[slot] = n;
+    }
+
+    free(old_index);
+    return 0;
+}
+
+/* Reserve a width x rows rectangle in the atlas pages */
+static uint8_t *alloc_bitmap(GlyphAtlas *atlas, int width, int rows) {
+    if (width > GLYPH_ATLAS_PAGE_SIZE || rows > GLYPH_ATLAS_PAGE_SIZE) {
+        return NULL;
+    }
+
+    GlyphAtlasPage *page = atlas->num_pages > 0 ? &atlas->pages[atlas->num_pages - 1] : NULL;
+
+    if (page) {
+        /* Start a new shelf if the glyph does not fit on the current one */
+        if (page->cursor_x + width > GLYPH_ATLAS_PAGE_SIZE) {
+            page->shelf_y += page->shelf_height;
+            page->shelf_height = 0;
+            page->cursor_x = 0;
+        }
+        if (page->shelf_y + rows > GLYPH_ATLAS_PAGE_SIZE) {
+            page = NULL;
+        }
+    }
+
+    if (!page) {
+        GlyphAtlasPage *pages = realloc(atlas->pages,
+                                        (atlas->num_pages + 1) * sizeof(GlyphAtlasPage));
+        if (!pages) {
+            return NULL;
+        }
+        atlas->pages = pages;
+        page = &atlas->pages[atlas->num_pages];
+        memset(page, 0, sizeof(*page));
+        page->pixels = calloc(GLYPH_ATLAS_PAGE_SIZE, GLYPH_ATLAS_PAGE_SIZE);
+        if (!page->pixels) {
+            return NULL;
+        }
+        atlas->num_pages++;
+    }
+
+    uint8_t *dst = page->pixels + page->shelf_y * GLYPH_ATLAS_PAGE_SIZE + page->cursor_x;
+    page->cursor_x += width;
+    if (rows > page->shelf_height) {
+        page->shelf_height = rows;
+    }
+    return dst;
+}
+
+/* Append a new glyph record and return it */
+static Glyph *append_glyph(GlyphAtlas *atlas) {
+    if (atlas->count == atlas->num_chunks * GLYPH_CHUNK_SIZE) {
+        Glyph **chunks = realloc(atlas->chunks, (atlas->num_chunks + 1) * sizeof(Glyph *));
+        if (!chunks) {
+            return NULL;
+        }
+        atlas->chunks = chunks;
+        atlas->chunks[atlas->num_chunks] = calloc(GLYPH_CHUNK_SIZE, sizeof(Glyph));
+        if (!atlas->chunks[atlas->num_chunks]) {
+            return NULL;
+        }
+        atlas->num_chunks++;
+    }
+    return glyph_at(atlas, atlas->count);
+}
+
+const Glyph *glyph_atlas_get(GlyphAtlas *atlas, FT_Face face, int face_id,
+                             int pixel_size, uint32_t codepoint) {
+    int slot = find_slot(atlas, face_id, pixel_size, codepoint);
+    if (atlas->index[slot] >= 0) {
+        return glyph_at(atlas, atlas->index[slot]);
+    }
+
+    /* Miss: rasterize once and keep the coverage bitmap */
+    if ((atlas->count + 1) * 2 > atlas->index_capacity) {
+        if (grow_index(atlas) < 0) {
+            fprintf(stderr, "Failed to grow glyph atlas index\n");
+            return NULL;
+        }
+        slot = find_slot(atlas, face_id, pixel_size, codepoint);
+    }
+
+    Glyph *g = append_glyph(atlas);
+    if (!g) {
+        fprintf(stderr, "Failed to allocate glyph\n");
+        return NULL;
+    }
+    memset(g, 0, sizeof(*g));
+    g->face_id = face_id;
+    g->pixel_size = pixel_size;
+    g->codepoint = codepoint;
+
+    /* Failed loads are cached as empty glyphs so they are reported once */
+    uint64_t start = trace_begin();
+    FT_Error error = FT_Load_Char(face, codepoint, FT_LOAD_RENDER);
+    trace_end("FT_Load_Char", start);
+    if (error) {
+        fprintf(stderr, "Failed to load character U+%04X\n", (unsigned int)codepoint);
+    } else {
+        FT_GlyphSlot ft_slot = face->glyph;
+        FT_Bitmap *bitmap = &ft_slot->bitmap;
+
+        g->left = ft_slot->bitmap_left;
+        g->top = ft_slot->bitmap_top;
+        g->advance = ft_slot->advance.x >> 6;
+
+        if (bitmap->width > 0 && bitmap->rows > 0) {
+            uint8_t *dst = alloc_bitmap(atlas, bitmap->width, bitmap->rows);
+            if (dst) {
+                for (unsigned int row = 0; row < bitmap->rows; row++) {
+                    memcpy(dst + row * GLYPH_ATLAS_PAGE_SIZE,
+                           bitmap->buffer + row * bitmap->pitch, bitmap->width);
+                }
+                g->bitmap = dst;
+                g->pitch = GLYPH_ATLAS_PAGE_SIZE;
+                g->width = bitmap->width;
+                g->rows = bitmap->rows;
+            } else {
+                fprintf(stderr, "Glyph U+%04X does not fit in atlas\n", (unsigned int)codepoint);
+            }
+        }
+    }
+
+    atlas->index[slot] = atlas->count++;
+    return g;
+}
+
+void glyph_atlas_preload(GlyphAtlas *atlas, FT_Face face, int face_id,
+                         int pixel_size, uint32_t first, uint32_t last) {
+    for (uint32_t c = first; c <= last; c++) {
+        glyph_atlas_get(atlas, face, face_id, pixel_size, c);
+    }
+}
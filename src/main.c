@@ -1,16 +1,288 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "video.h"
 #include "text.h"
 #include "quiz.h"
 #include "colors.h"
 #include "config.h"
+#include "render_pool.h"
+#include "segment_pool.h"
+#include "pipeline.h"
+#include "batch.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+#include "voiceover.h"
+
+/* Render on a thread pool and feed frames to the single encoder in order */
+static int encode_frames(VideoEncoder *video, Voiceover *voiceover,
+                         const AppConfig *config, const ColorScheme *colors,
+                         QuizData *quiz, int *total_frames) {
+    /* Render threads each own their fonts and caches; frames come back
+     * in presentation order */
+    RenderPool pool;
+    if (render_pool_init(&pool, config, colors, quiz) < 0) {
+        fprintf(stderr, "Failed to initialize renderer\n");
+        return -1;
+    }
+
+    *total_frames = pool.total_frames;
+    printf("Generating %d questions (%d frames total)...\n",
+           quiz->num_questions, pool.total_frames);
+
+    int frame = 0;
+    int failed = 0;
+    const RenderSlot *slot;
+    while ((slot = render_pool_next(&pool)) != NULL) {
+        if (frame % pool.frames_per_question == 0) {
+            printf("Question %d/%d: %s\n", slot->question + 1, quiz->num_questions,
+                   quiz->questions[slot->question].question);
+        }
+
+        /* Write frame to video */
+        int ret = video_write_frame_planes(video, slot->yuv, slot->linesize);
+        render_pool_release(&pool, slot);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to write frame %d\n", frame);
+            failed = 1;
+            break;
+        }
+
+        frame++;
+
+        /* Voiceover up to the same point, interleaved with the video */
+        if (voiceover_write(voiceover, video, frame) < 0) {
+            fprintf(stderr, "Failed to write audio at frame %d\n", frame);
+            failed = 1;
+            break;
+        }
+
+        /* Progress every second */
+        if ((frame % config->video.fps) == 0) {
+            printf("  Progress: %d/%d frames (%.1f seconds)\n",
+                   frame, pool.total_frames, (float)frame / config->video.fps);
+        }
+    }
+
+    /* The pool stops handing out frames when a render fails */
+    if (!failed && frame < pool.total_frames) {
+        fprintf(stderr, "Rendering failed at frame %d of %d\n", frame, pool.total_frames);
+        failed = 1;
+    }
+
+    render_pool_free(&pool);
+    return failed ? -1 : 0;
+}
+
+/* Render, convert and encode as overlapping pipeline stages */
+static int encode_pipeline(VideoEncoder *video, Voiceover *voiceover,
+                           const AppConfig *config, const ColorScheme *colors,
+                           QuizData *quiz, int *total_frames) {
+    Pipeline pipeline;
+    if (pipeline_init(&pipeline, config, colors, quiz) < 0) {
+        fprintf(stderr, "Failed to initialize pipeline\n");
+        return -1;
+    }
+
+    *total_frames = pipeline.total_frames;
+    printf("Generating %d questions (%d frames total)...\n",
+           quiz->num_questions, pipeline.total_frames);
+
+    int frame = 0;
+    int failed = 0;
+    const RenderSlot *slot;
+    while ((slot = pipeline_next(&pipeline)) != NULL) {
+        if (frame % pipeline.frames_per_question == 0) {
+            printf("Question %d/%d: %s\n", slot->question + 1, quiz->num_questions,
+                   quiz->questions[slot->question].question);
+        }
+
+        int ret = video_write_frame_planes(video, slot->yuv, slot->linesize);
+        pipeline_release(&pipeline, slot);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to write frame %d\n", frame);
+            failed = 1;
+            break;
+        }
+
+        frame++;
+
+        if (voiceover_write(voiceover, video, frame) < 0) {
+            fprintf(stderr, "Failed to write audio at frame %d\n", frame);
+            failed = 1;
+            break;
+        }
+
+        if ((frame % config->video.fps) == 0) {
+            printf("  Progress: %d/%d frames (%.1f seconds)\n",
+                   frame, pipeline.total_frames, (float)frame / config->video.fps);
+        }
+    }
+
+    /* pipeline_next returns NULL early when a stage fails */
+    if (!failed && frame < pipeline.total_frames) {
+        fprintf(stderr, "Pipeline failed at frame %d of %d\n", frame, pipeline.total_frames);
+        failed = 1;
+    }
+
+    pipeline_free(&pipeline);
+    pipeline_print_stats(&pipeline);
+    return failed ? -1 : 0;
+}
+
+/* Encode question segments in parallel and mux them in order */
+static int encode_segments(VideoEncoder *video, Voiceover *voiceover,
+                           const AppConfig *config, const ColorScheme *colors,
+                           QuizData *quiz, int *total_frames) {
+    SegmentPool pool;
+    if (segment_pool_init(&pool, config, colors, quiz, video) < 0) {
+        fprintf(stderr, "Failed to initialize segment encoders\n");
+        return -1;
+    }
+
+    *total_frames = pool.total_frames;
+    printf("Generating %d questions (%d frames total)...\n",
+           quiz->num_questions, pool.total_frames);
+
+    int frames_written = 0;
+    int failed = 0;
+    Segment *segment;
+    while ((segment = segment_pool_next(&pool)) != NULL) {
+        for (int q = segment->first_question;
+             q < segment->first_question + segment->num_questions; q++) {
+            printf("Question %d/%d: %s\n", q + 1, quiz->num_questions,
+                   quiz->questions[q].question);
+        }
+
+        int ret = video_write_segment(video, &segment->encoder);
+        segment_pool_release(&pool, segment);
+        if (ret < 0) {
+            fprintf(stderr, "Failed to write segment at frame %d\n", segment->first_frame);
+            failed = 1;
+            break;
+        }
+
+        int frame = segment->first_frame + segment->num_frames;
+        frames_written = frame;
+        if (voiceover_write(voiceover, video, frame) < 0) {
+            fprintf(stderr, "Failed to write audio at frame %d\n", frame);
+            failed = 1;
+            break;
+        }
+        printf("  Progress: %d/%d frames (%.1f seconds)\n",
+               frame, pool.total_frames, (float)frame / config->video.fps);
+    }
+
+    /* segment_pool_next returns NULL early when a segment fails to encode */
+    if (!failed && frames_written < pool.total_frames) {
+        fprintf(stderr, "Encoding failed at frame %d of %d\n", frames_written,
+                pool.total_frames);
+        failed = 1;
+    }
+
+    segment_pool_free(&pool);
+    return failed ? -1 : 0;
+}
+
+/* Render every job of a manifest in this process.
+ * Usage: quizvid --batch manifest.json [config.json] */
+static int run_batch(const char *manifest_file, const char *config_file) {
+    printf("QuizVid - Batch rendering\n\n");
+
+    AppConfig config;
+    config_load(&config, config_file);
+
+    Batch batch;
+    if (batch_load(&batch, manifest_file, &config) < 0) {
+        config_free(&config);
+        return 1;
+    }
+
+    int failed = batch_run(&batch, &config);
+    batch_free(&batch);
+    config_free(&config);
+
+    return failed == 0 ? 0 : 1;
+}
+
+static int run_server(const char *socket_path, const char *config_file) {
+    printf("QuizVid - Render server\n\n");
+
+    AppConfig config;
+    config_load(&config, config_file);
+
+    Server server;
+    int ret = server_init(&server, socket_path, &config);
+    if (ret == 0) {
+        ret = server_run(&server);
+    }
+    server_free(&server);
+    config_free(&config);
+
+    return ret == 0 ? 0 : 1;
+}
 
 int main(int argc, char *argv[]) {
     const char *config_file = "config.json";
 
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s --batch manifest.json [config.json]\n", argv[0]);
+            return 1;
+        }
+        return run_batch(argv[2], argc > 3 ? argv[3] : config_file);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s --serve socket [config.json]\n", argv[0]);
+            return 1;
+        }
+        return run_server(argv[2], argc > 3 ? argv[3] : config_file);
+    }
+
+    /* Options before the config file:
+     *   --draft[=N]    preview at 1/N size (N = 2)
+     *   --sink=NAME    encoder, null, y4m or images instead of output.sink
+     *   --output=FILE  instead of output.file
+     *   --stats[=FILE] time each stage and write the summary as JSON
+     *                  (FILE = stats.json)
+     *   --trace FILE   record spans on every thread as a Chrome trace */
+    int draft = 0;
+    const char *sink_name = NULL;
+    const char *output_file = NULL;
+    const char *stats_file = NULL;
+    const char *trace_file = NULL;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--draft") == 0) {
+            draft = 2;
+        } else if (strncmp(argv[arg], "--draft=", 8) == 0 && atoi(argv[arg] + 8) >= 1) {
+            draft = atoi(argv[arg] + 8);
+        } else if (strncmp(argv[arg], "--sink=", 7) == 0) {
+            sink_name = argv[arg] + 7;
+        } else if (strncmp(argv[arg], "--output=", 9) == 0 && argv[arg][9]) {
+            output_file = argv[arg] + 9;
+        } else if (strcmp(argv[arg], "--stats") == 0) {
+            stats_file = "stats.json";
+        } else if (strncmp(argv[arg], "--stats=", 8) == 0 && argv[arg][8]) {
+            stats_file = argv[arg] + 8;
+        } else if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+            trace_file = argv[++arg];
+        } else if (strncmp(argv[arg], "--trace=", 8) == 0 && argv[arg][8]) {
+            trace_file = argv[arg] + 8;
+        } else {
+            fprintf(stderr, "Usage: %s [--draft[=N]] [--sink=encoder|null|y4m|images] "
+                    "[--output=FILE] [--stats[=FILE]] [--trace FILE] [config.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
     /* Allow config file as command line argument */
-    if (argc > 1) {
-        config_file = argv[1];
+    if (argc > arg) {
+        config_file = argv[arg];
     }
 
     printf("QuizVid - Generating Quiz Video\n\n");
@@ -18,14 +290,83 @@ int main(int argc, char *argv[]) {
     /* Load configuration */
     AppConfig config;
     config_load(&config, config_file);
+    if (sink_name && config_parse_sink(sink_name, &config.output.sink) < 0) {
+        fprintf(stderr, "Unknown sink: %s\n", sink_name);
+        config_free(&config);
+        return 1;
+    }
+    if (output_file) {
+        char *file = strdup(output_file);
+        if (!file) {
+            config_free(&config);
+            return 1;
+        }
+        free((void *)config.output_file);
+        config.output_file = file;
+    }
+    if (draft > 0 && config_make_draft(&config, draft) < 0) {
+        config_free(&config);
+        return 1;
+    }
 
-    /* Apply configuration (sets colors) */
-    config_apply(&config);
+    /* Only the encoder takes the voiceover and encoded segments */
+    if (config.output.sink != OUTPUT_SINK_ENCODER) {
+        config.audio.source = AUDIO_SOURCE_NONE;
+        config.encoder.segment_questions = 0;
+    }
+
+    /* Video on stdout: the encoder gets its own copy of the descriptor and
+     * messages go to stderr from here on. Anything printed so far is still
+     * in stdout's buffer when it is a pipe, so it follows them. */
+    char stream_target[32];
+    const char *output_target = config.output_file;
+    if (strcmp(config.output_file, "-") == 0) {
+        int fd = dup(STDOUT_FILENO);
+        if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "Failed to redirect messages for output to stdout\n");
+            config_free(&config);
+            return 1;
+        }
+        snprintf(stream_target, sizeof(stream_target), "fd:%d", fd);
+        output_target = stream_target;
+    }
+
+    /* Renditions are scaled from whole rendered frames, which the segment
+     * encoders never hand back */
+    if (config.output.num_renditions > 0 && config.encoder.segment_questions > 0) {
+        fprintf(stderr, "Renditions need whole frames; encoding without segments\n");
+        config.encoder.segment_questions = 0;
+    }
+
+    /* Apply configuration (resolves colors) */
+    ColorScheme colors;
+    config_apply(&config, &colors);
+
+    /* Tracing starts before any worker thread does */
+    if (trace_file && trace_open(trace_file) < 0) {
+        config_free(&config);
+        return 1;
+    }
 
     /* Load quiz data */
     QuizData quiz = {0};
-    if (quiz_load(&quiz, config.quiz_file) < 0) {
+    uint64_t trace_start = trace_begin();
+    int loaded = quiz_load(&quiz, config.quiz_file);
+    trace_end("quiz_load", trace_start);
+    if (loaded < 0) {
         fprintf(stderr, "Failed to load quiz\n");
+        trace_close();
+        config_free(&config);
+        return 1;
+    }
+
+    /* Voiceover clips are prepared in the background while frames render,
+     * and muxed as frames go out */
+    Voiceover voiceover;
+    if (voiceover_init(&voiceover, &config, &quiz) < 0) {
+        fprintf(stderr, "Failed to prepare voiceover\n");
+        trace_close();
+        quiz_free(&quiz);
         config_free(&config);
         return 1;
     }
@@ -35,71 +376,62 @@ int main(int argc, char *argv[]) {
         .width = config.video.width,
         .height = config.video.height,
         .fps = config.video.fps,
-        .output_filename = config.output_file
+        .color_matrix = config.video.color_matrix,
+        .encoder = config.encoder,
+        .segmented = config.encoder.segment_questions > 0,
+        .audio_sample_rate = voiceover_enabled(&voiceover) ? config.audio.sample_rate : 0,
+        .audio_bitrate = config.audio.bitrate,
+        .container = config.output.container,
+        .fragment_frames = config.output.fragment == OUTPUT_FRAGMENT_QUESTION ?
+            (quiz.question_duration + quiz.reveal_duration) * config.video.fps : 0,
+        .output_filename = output_target,
+        .renditions = config.output.renditions,
+        .num_renditions = config.output.num_renditions,
+        .sink = config.output.sink
     };
 
     /* Initialize video encoder */
-    if (video_init(&video_config) < 0) {
+    VideoEncoder video;
+    if (video_init(&video, &video_config) < 0) {
         fprintf(stderr, "Failed to initialize video encoder\n");
+        voiceover_free(&voiceover);
+        trace_close();
         quiz_free(&quiz);
         config_free(&config);
         return 1;
     }
 
-    /* Allocate RGB buffer */
-    size_t buffer_size = config.video.width * config.video.height * 3;
-    uint8_t *rgb_buffer = malloc(buffer_size);
-    if (!rgb_buffer) {
-        fprintf(stderr, "Failed to allocate RGB buffer\n");
-        video_close();
+    /* Timed from the first frame to the closed output */
+    if (stats_file) {
+        stats_enable();
+    }
+
+    int total_frames = 0;
+    int ret;
+    if (config.encoder.segment_questions > 0) {
+        ret = encode_segments(&video, &voiceover, &config, &colors, &quiz, &total_frames);
+    } else if (config.render.mode == RENDER_MODE_PIPELINE) {
+        ret = encode_pipeline(&video, &voiceover, &config, &colors, &quiz, &total_frames);
+    } else {
+        ret = encode_frames(&video, &voiceover, &config, &colors, &quiz, &total_frames);
+    }
+    if (ret < 0) {
+        video_close(&video);
+        voiceover_free(&voiceover);
+        trace_close();
         quiz_free(&quiz);
         config_free(&config);
         return 1;
     }
 
-    /* Generate video for each question */
-    int total_duration = quiz.question_duration + quiz.reveal_duration;
-    int frames_per_question = total_duration * config.video.fps;
-    int total_frames = frames_per_question * quiz.num_questions;
-
-    printf("Generating %d questions (%d frames total)...\n",
-           quiz.num_questions, total_frames);
-
-    int frame = 0;
-    for (int q = 0; q < quiz.num_questions; q++) {
-        printf("Question %d/%d: %s\n", q + 1, quiz.num_questions,
-               quiz.questions[q].question);
-
-        for (int f = 0; f < frames_per_question; f++) {
-            float time = (float)f / config.video.fps;
-
-            /* Render quiz frame with layout config */
-            if (quiz_render_frame(&quiz, q, time, rgb_buffer,
-                                 config.video.width, config.video.height,
-                                 &config.layout, &config.animation) < 0) {
-                fprintf(stderr, "Failed to render frame\n");
-                break;
-            }
-
-            /* Write frame to video */
-            if (video_write_frame_rgb(rgb_buffer) < 0) {
-                fprintf(stderr, "Failed to write frame %d\n", frame);
-                break;
-            }
-
-            frame++;
-
-            /* Progress every second */
-            if ((frame % config.video.fps) == 0) {
-                printf("  Progress: %d/%d frames (%.1f seconds)\n",
-                       frame, total_frames, (float)frame / config.video.fps);
-            }
-        }
-    }
-
     /* Cleanup */
-    free(rgb_buffer);
-    video_close();
+    int frames_written = video_get_frame_count(&video);
+    trace_start = trace_begin();
+    video_close(&video);
+    trace_end("video_close", trace_start);
+    stats_report(frames_written, stats_file);
+    voiceover_free(&voiceover);
+    trace_close();
     quiz_free(&quiz);
     config_free(&config);
 
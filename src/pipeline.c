@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "pipeline.h"
+#include "trace.h"
+
+/* Buffers per stage are capped so every buffer keeps a retained scene */
+#define PIPELINE_MAX_SLOTS RENDER_MAX_SCENES
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int ring_init(FrameRing *ring, int capacity) {
+    unsigned int size = 1;
+    while (size < (unsigned int)capacity) size <<= 1;
+
+    ring->items = calloc(size, sizeof(RenderSlot *));
+    if (!ring->items) {
+        return -1;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+static void ring_free(FrameRing *ring) {
+    free(ring->items);
+    ring->items = NULL;
+}
+
+/* Producer side; the ring holds every buffer, so it never fills up */
+static void ring_push(FrameRing *ring, RenderSlot *slot) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring->items[tail & ring->mask] = slot;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/* Consumer side; NULL when empty */
+static RenderSlot *ring_pop(FrameRing *ring) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+        return NULL;
+    }
+    RenderSlot *slot = ring->items[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return slot;
+}
+
+/* Pop, yielding for the first 64 polls of an empty queue and then
+ * sleeping 50 us between polls. Returns NULL once the pipeline is stopped. */
+static RenderSlot *ring_pop_wait(Pipeline *pipeline, FrameRing *ring,
+                                 PipelineStageStats *stats) {
+    RenderSlot *slot = ring_pop(ring);
+    if (slot) {
+        return slot;
+    }
+
+    stats->stalls++;
+    double start = now_seconds();
+    for (int spins = 0; !slot; spins++) {
+        if (atomic_load_explicit(&pipeline->stop, memory_order_acquire)) {
+            break;
+        }
+        if (spins < 64) {
+            sched_yield();
+        } else {
+            struct timespec pause = {0, 50000};
+            nanosleep(&pause, NULL);
+        }
+        slot = ring_pop(ring);
+    }
+    stats->wait_seconds += now_seconds() - start;
+    return slot;
+}
+
+static void pipeline_fail(Pipeline *pipeline) {
+    atomic_store(&pipeline->failed, 1);
+    atomic_store(&pipeline->stop, 1);
+}
+
+static void *render_main(void *arg) {
+    Pipeline *pipeline = arg;
+    trace_thread_name("render");
+
+    for (int n = 0; n < pipeline->total_frames; n++) {
+        RenderSlot *slot = ring_pop_wait(pipeline, &pipeline->free_frames,
+                                         &pipeline->render_stats);
+        if (!slot) break;
+
+        if (render_slot_paint(slot, &pipeline->rc, pipeline->config, pipeline->quiz,
+                              pipeline->frames_per_question, n) < 0) {
+            pipeline_fail(pipeline);
+            break;
+        }
+        slot->frame = n;
+        ring_push(&pipeline->rendered, slot);
+    }
+
+    return NULL;
+}
+
+static void *convert_main(void *arg) {
+    Pipeline *pipeline = arg;
+    trace_thread_name("convert");
+
+    for (int n = 0; n < pipeline->total_frames; n++) {
+        RenderSlot *slot = ring_pop_wait(pipeline, &pipeline->rendered,
+                                         &pipeline->convert_stats);
+        if (!slot) break;
+
+        render_slot_convert(slot, pipeline->config);
+        ring_push(&pipeline->converted, slot);
+    }
+
+    return NULL;
+}
+
+int pipeline_init(Pipeline *pipeline, const AppConfig *config,
+                  const ColorScheme *colors, QuizData *quiz) {
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->quiz = quiz;
+    pipeline->config = config;
+    pipeline->frames_per_question = (quiz->question_duration + quiz->reveal_duration) *
+                                    config->video.fps;
+    pipeline->total_frames = pipeline->frames_per_question * quiz->num_questions;
+    atomic_init(&pipeline->stop, 0);
+    atomic_init(&pipeline->failed, 0);
+
+    /* queue_depth buffers for each of the three stages */
+    int num_slots = config->render.queue_depth * 3;
+    if (num_slots > PIPELINE_MAX_SLOTS) num_slots = PIPELINE_MAX_SLOTS;
+    if (num_slots < 3) num_slots = 3;
+
+    pipeline->num_slots = num_slots;
+    pipeline->slots = calloc(num_slots, sizeof(RenderSlot));
+    if (!pipeline->slots ||
+        ring_init(&pipeline->free_frames, num_slots) < 0 ||
+        ring_init(&pipeline->rendered, num_slots) < 0 ||
+        ring_init(&pipeline->converted, num_slots) < 0) {
+        fprintf(stderr, "Failed to allocate pipeline\n");
+        pipeline_free(pipeline);
+        return -1;
+    }
+
+    int use_rgb = (config->video.render_format == CANVAS_RGB24);
+    for (int i = 0; i < num_slots; i++) {
+        if (render_slot_init(&pipeline->slots[i], config->video.width,
+                             config->video.height, use_rgb) < 0) {
+            fprintf(stderr, "Failed to allocate frame buffers\n");
+            pipeline_free(pipeline);
+            return -1;
+        }
+        ring_push(&pipeline->free_frames, &pipeline->slots[i]);
+    }
+
+    if (render_context_init(&pipeline->rc, config->font_path, colors) < 0) {
+        pipeline_free(pipeline);
+        return -1;
+    }
+
+    if (pthread_create(&pipeline->render_thread, NULL, render_main, pipeline) != 0) {
+        fprintf(stderr, "Failed to start render thread\n");
+        pipeline_free(pipeline);
+        return -1;
+    }
+    pipeline->render_started = 1;
+
+    if (pthread_create(&pipeline->convert_thread, NULL, convert_main, pipeline) != 0) {
+        fprintf(stderr, "Failed to start convert thread\n");
+        pipeline_free(pipeline);
+        return -1;
+    }
+    pipeline->convert_started = 1;
+
+    printf("Rendering as a render/convert/encode pipeline (%d frame buffers)\n",
+           num_slots);
+    return 0;
+}
+
+const RenderSlot *pipeline_next(Pipeline *pipeline) {
+    if (pipeline->next_out >= pipeline->total_frames) {
+        return NULL;
+    }
+
+    RenderSlot *slot = ring_pop_wait(pipeline, &pipeline->converted,
+                                     &pipeline->encode_stats);
+    if (!slot || atomic_load(&pipeline->failed)) {
+        return NULL;
+    }
+    return slot;
+}
+
+void pipeline_release(Pipeline *pipeline, const RenderSlot *slot) {
+    ring_push(&pipeline->free_frames, &pipeline->slots[slot - pipeline->slots]);
+    pipeline->next_out++;
+}
+
+void pipeline_print_stats(const Pipeline *pipeline) {
+    const struct {
+        const char *name;
+        const char *waits_for;
+        const PipelineStageStats *stats;
+    } stages[] = {
+        {"render", "free buffer", &pipeline->render_stats},
+        {"convert", "rendered frame", &pipeline->convert_stats},
+        {"encode", "converted frame", &pipeline->encode_stats},
+    };
+
+    printf("Pipeline stalls:\n");
+    for (int i = 0; i < 3; i++) {
+        printf("  %-8s %6lu waits for a %s (%.2f s)\n", stages[i].name,
+               stages[i].stats->stalls, stages[i].waits_for,
+               stages[i].stats->wait_seconds);
+    }
+}
+
+void pipeline_free(Pipeline *pipeline) {
+    atomic_store(&pipeline->stop, 1);
+    if (pipeline->render_started) {
+        pthread_join(pipeline->render_thread, NULL);
+        pipeline->render_started = 0;
+    }
+    if (pipeline->convert_started) {
+        pthread_join(pipeline->convert_thread, NULL);
+        pipeline->convert_started = 0;
+    }
+
+    render_context_free(&pipeline->rc);
+    if (pipeline->slots) {
+        for (int i = 0; i < pipeline->num_slots; i++) {
+            render_slot_free(&pipeline->slots[i]);
+        }
+        free(pipeline->slots);
+        pipeline->slots = NULL;
+    }
+
+    ring_free(&pipeline->free_frames);
+    ring_free(&pipeline->rendered);
+    ring_free(&pipeline->converted);
+}
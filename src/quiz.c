@@ -7,15 +7,11 @@
 #include "video.h"
 #include "text.h"
 #include "colors.h"
+#include "scene.h"
+#include "sprite.h"
+#include "trace.h"
 
-int quiz_load(QuizData *quiz, const char *json_file) {
-    /* Read JSON file */
-    struct json_object *root = json_object_from_file(json_file);
-    if (!root) {
-        fprintf(stderr, "Failed to parse JSON file: %s\n", json_file);
-        return -1;
-    }
-
+int quiz_parse(QuizData *quiz, struct json_object *root) {
     /* Get config */
     struct json_object *config;
     if (json_object_object_get_ex(root, "config", &config)) {
@@ -32,7 +28,6 @@ int quiz_load(QuizData *quiz, const char *json_file) {
     struct json_object *questions_array;
     if (!json_object_object_get_ex(root, "questions", &questions_array)) {
         fprintf(stderr, "No 'questions' array in JSON\n");
-        json_object_put(root);
         return -1;
     }
 
@@ -40,7 +35,6 @@ int quiz_load(QuizData *quiz, const char *json_file) {
     quiz->questions = malloc(quiz->num_questions * sizeof(QuizQuestion));
     if (!quiz->questions) {
         fprintf(stderr, "Failed to allocate questions array\n");
-        json_object_put(root);
         return -1;
     }
 
@@ -91,6 +85,14 @@ int quiz_load(QuizData *quiz, const char *json_file) {
             }
         }
 
+        /* Optional prerecorded voiceover */
+        struct json_object *audio;
+        q->audio_file[0] = '\0';
+        if (json_object_object_get_ex(q_obj, "audio", &audio)) {
+            strncpy(q->audio_file, json_object_get_string(audio), MAX_AUDIO_PATH_LEN - 1);
+            q->audio_file[MAX_AUDIO_PATH_LEN - 1] = '\0';
+        }
+
         /* Get correct answers array */
         struct json_object *correct_array;
         if (json_object_object_get_ex(q_obj, "correct", &correct_array)) {
@@ -104,9 +106,24 @@ int quiz_load(QuizData *quiz, const char *json_file) {
         }
     }
 
+    return 0;
+}
+
+int quiz_load(QuizData *quiz, const char *json_file) {
+    /* Read JSON file */
+    struct json_object *root = json_object_from_file(json_file);
+    if (!root) {
+        fprintf(stderr, "Failed to parse JSON file: %s\n", json_file);
+        return -1;
+    }
+
+    int ret = quiz_parse(quiz, root);
     json_object_put(root);
-    printf("Loaded %d quiz questions from %s\n", quiz->num_questions, json_file);
+    if (ret < 0) {
+        return -1;
+    }
 
+    printf("Loaded %d quiz questions from %s\n", quiz->num_questions, json_file);
     return 0;
 }
 
@@ -128,18 +145,23 @@ static int is_correct_answer(QuizQuestion *q, int answer_index) {
     return 0;
 }
 
+/* Layout size in pixels of the frame being drawn */
+static int layout_px(const LayoutConfig *layout, int size) {
+    return (int)(size * layout->scale + 0.5f);
+}
+
 /* Calculate dynamic button dimensions based on answer count */
 static void calc_button_dims(int num_answers, int screen_height,
                              const LayoutConfig *layout,
                              int *out_height, int *out_spacing,
                              int *out_y_start) {
     /* Base values from layout config */
-    int base_height = layout->button_height;
-    int base_spacing = layout->answer_spacing;
-    int base_y = layout->answer_y_start;
+    int base_height = layout_px(layout, layout->button_height);
+    int base_spacing = layout_px(layout, layout->answer_spacing);
+    int base_y = layout_px(layout, layout->answer_y_start);
 
-    /* Available vertical space for buttons */
-    int available = screen_height - base_y - 100;  /* 100px bottom margin */
+    /* Available vertical space for buttons, above a 100px bottom margin */
+    int available = screen_height - base_y - layout_px(layout, 100);
     int total_needed = num_answers * base_spacing;
 
     if (total_needed <= available) {
@@ -159,9 +181,120 @@ static void calc_button_dims(int num_answers, int screen_height,
     }
 }
 
-int quiz_render_frame(QuizData *quiz, int question_index,
+/* Sprite cache slots for one question */
+enum {
+    SPRITE_SLOT_HINT,
+    SPRITE_SLOT_QUESTION,
+    SPRITE_SLOT_ANSWERS      /* ANSWER_VARIANTS slots per answer */
+};
+
+/* Reveal-state variants of an answer button */
+enum {
+    ANSWER_NORMAL,
+    ANSWER_CORRECT,
+    ANSWER_INCORRECT,
+    ANSWER_VARIANTS
+};
+
+/* Timer bar as two solid rects, matching video_draw_timer_bar */
+static void scene_timer_bar(Scene *scene, int width, float progress, int bar_height,
+                            const ColorScheme *colors) {
+    if (progress < 0.0f) progress = 0.0f;
+    if (progress > 1.0f) progress = 1.0f;
+
+    int fill_width = (int)(width * progress);
+    scene_rect(scene, 0, 0, width, bar_height, colors->timer_background);
+    scene_rect(scene, 0, 0, fill_width, bar_height, colors->timer_fill);
+}
+
+/* Everything that changes how a cached sprite looks besides the question */
+static uint32_t sprite_key(const Canvas *canvas, const LayoutConfig *layout,
+                           const ColorScheme *colors) {
+    int dims[4] = {canvas->width, canvas->height, (int)canvas->format, (int)canvas->matrix};
+    const uint8_t *parts[3] = {(const uint8_t *)dims, (const uint8_t *)layout,
+                               (const uint8_t *)colors};
+    size_t sizes[3] = {sizeof(dims), sizeof(*layout), sizeof(*colors)};
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < 3; i++) {
+        for (size_t n = 0; n < sizes[i]; n++) {
+            h = (h ^ parts[i][n]) * 16777619u;
+        }
+    }
+    return h;
+}
+
+/* Pre-composite a line of text; bounds come from the glyph ink box */
+static Sprite *text_sprite(RenderContext *rc, const Canvas *canvas, int slot,
+                           TextContext *ctx, const char *text,
+                           int x, int y, Color color) {
+    Sprite *sprite = sprite_cache_get(&rc->sprites, slot);
+    if (sprite) {
+        return sprite;
+    }
+
+    /* Built once per question */
+    uint64_t start = trace_begin();
+    int bx0, by0, bx1, by1;
+    text_measure_box(ctx, text, &bx0, &by0, &bx1, &by1);
+
+    Canvas layer;
+    int lx = x + bx0, ly = y + by0, lw = bx1 - bx0, lh = by1 - by0;
+    if (sprite_layer_alloc(&layer, &lx, &ly, &lw, &lh) < 0) {
+        return NULL;
+    }
+    text_render_alpha(ctx, &layer, text, x - lx, y - ly,
+                      color.r, color.g, color.b, 1.0f);
+
+    sprite = sprite_cache_store(&rc->sprites, slot, &layer, lx, ly,
+                                canvas->format, canvas->matrix);
+    sprite_layer_free(&layer);
+    trace_end("question_text_sprite", start);
+    return sprite;
+}
+
+/* Pre-composite an answer button with its label */
+static Sprite *answer_sprite(RenderContext *rc, const Canvas *canvas, int slot,
+                             TextContext *ctx, const char *text,
+                             int x, int y, int width, int height, int radius,
+                             int text_x, int text_y, Color button_bg, Color text_color) {
+    Sprite *sprite = sprite_cache_get(&rc->sprites, slot);
+    if (sprite) {
+        return sprite;
+    }
+
+    /* Union of the button and the label, which may overflow it */
+    uint64_t start = trace_begin();
+    int bx0, by0, bx1, by1;
+    text_measure_box(ctx, text, &bx0, &by0, &bx1, &by1);
+    int x0 = x, y0 = y, x1 = x + width, y1 = y + height;
+    if (bx1 > bx0 && by1 > by0) {
+        if (text_x + bx0 < x0) x0 = text_x + bx0;
+        if (text_y + by0 < y0) y0 = text_y + by0;
+        if (text_x + bx1 > x1) x1 = text_x + bx1;
+        if (text_y + by1 > y1) y1 = text_y + by1;
+    }
+
+    Canvas layer;
+    int lx = x0, ly = y0, lw = x1 - x0, lh = y1 - y0;
+    if (sprite_layer_alloc(&layer, &lx, &ly, &lw, &lh) < 0) {
+        return NULL;
+    }
+    video_draw_rounded_rect_alpha(&layer, x - lx, y - ly, width, height,
+                                  radius, button_bg, 1.0f);
+    text_render_alpha(ctx, &layer, text, text_x - lx, text_y - ly,
+                      text_color.r, text_color.g, text_color.b, 1.0f);
+
+    sprite = sprite_cache_store(&rc->sprites, slot, &layer, lx, ly,
+                                canvas->format, canvas->matrix);
+    sprite_layer_free(&layer);
+    trace_end("question_answer_sprite", start);
+    return sprite;
+}
+
+int quiz_render_frame(RenderContext *rc, QuizData *quiz, int question_index,
                       float time_in_question,
-                      uint8_t *rgb_buffer, int width, int height,
+                      Canvas *canvas,
                       const LayoutConfig *layout,
                       const AnimationConfig *animation) {
     if (question_index < 0 || question_index >= quiz->num_questions) {
@@ -169,18 +302,25 @@ int quiz_render_frame(QuizData *quiz, int question_index,
     }
 
     QuizQuestion *q = &quiz->questions[question_index];
+    const ColorScheme *colors = &rc->colors;
+    int width = canvas->width;
+    int height = canvas->height;
 
     float progress = time_in_question / (float)quiz->question_duration;
     if (progress > 1.0f) progress = 1.0f;
 
     int reveal = (time_in_question >= quiz->question_duration);
 
+    /* Describe the frame; scene_draw repaints only what changed */
+    Scene *scene = render_context_scene(rc, canvas);
+    scene_begin(scene);
+
     /* Fill background */
-    video_fill_rgb_color(rgb_buffer, width, height, active_colors.background);
+    scene_fill(scene, colors->background);
 
     /* Draw timer bar */
-    video_draw_timer_bar(rgb_buffer, width, height, progress,
-                         layout->timer_bar_height);
+    int timer_height = layout_px(layout, layout->timer_bar_height);
+    scene_timer_bar(scene, width, progress, timer_height, colors);
 
     /* Calculate dynamic button dimensions */
     int btn_height, btn_spacing, btn_y_start;
@@ -197,43 +337,50 @@ int quiz_render_frame(QuizData *quiz, int question_index,
                          animation->question_fade_duration;
     }
 
+    /* Elements are composited once per question and blitted with the fade */
+    sprite_cache_bind(&rc->sprites, q, sprite_key(canvas, layout, colors));
+
     /* Render type indicator for multi-answer */
     if (q->type == QUIZ_TYPE_MULTI && question_alpha > 0.0f) {
-        TextContext hint_ctx;
-        if (text_init(&hint_ctx, "assets/fonts/Roboto-Bold.ttf", 32) == 0) {
-            Color hint_color = active_colors.accent;
-            int hint_y = layout->timer_bar_height + 60;
-            text_render_centered_alpha(&hint_ctx, rgb_buffer, width, height,
-                                      "Multiple correct",
-                                      hint_y, hint_color.r, hint_color.g,
-                                      hint_color.b, question_alpha);
-            text_close(&hint_ctx);
+        TextContext *hint_ctx = render_context_text(rc, layout_px(layout, 32));
+        if (hint_ctx) {
+            const char *hint = "Multiple correct";
+            int hint_x = (width - text_measure_width(hint_ctx, hint)) / 2;
+            int hint_y = timer_height + layout_px(layout, 60);
+            Sprite *sprite = text_sprite(rc, canvas, SPRITE_SLOT_HINT, hint_ctx,
+                                         hint, hint_x, hint_y, colors->accent);
+            scene_sprite(scene, sprite, question_alpha);
         }
     }
 
     /* Render question */
     if (question_alpha > 0.0f) {
-        TextContext text_ctx;
-        if (text_init(&text_ctx, "assets/fonts/Roboto-Bold.ttf",
-                      layout->question_font_size) < 0) {
+        TextContext *question_ctx =
+            render_context_text(rc, layout_px(layout, layout->question_font_size));
+        if (!question_ctx) {
+            return -1;
+        }
+        int question_x = (width - text_measure_width(question_ctx, q->question)) / 2;
+        Sprite *sprite = text_sprite(rc, canvas, SPRITE_SLOT_QUESTION, question_ctx,
+                                     q->question, question_x,
+                                     layout_px(layout, layout->question_y_position),
+                                     colors->question_text);
+        if (!sprite) {
             return -1;
         }
-        Color q_color = active_colors.question_text;
-        text_render_centered_alpha(&text_ctx, rgb_buffer, width, height,
-                                  q->question, layout->question_y_position,
-                                  q_color.r, q_color.g, q_color.b, question_alpha);
-        text_close(&text_ctx);
+        scene_sprite(scene, sprite, question_alpha);
     }
 
     /* Render answers */
-    TextContext text_ctx;
-    if (text_init(&text_ctx, "assets/fonts/Roboto-Bold.ttf",
-                  layout->answer_font_size) < 0) {
+    TextContext *text_ctx =
+        render_context_text(rc, layout_px(layout, layout->answer_font_size));
+    if (!text_ctx) {
         return -1;
     }
 
     char answer_text[MAX_ANSWER_LEN + 4];
-    int button_width = width - (2 * layout->button_margin);
+    int button_margin = layout_px(layout, layout->button_margin);
+    int button_width = width - (2 * button_margin);
 
     for (int i = 0; i < q->num_answers; i++) {
         /* Staggered fade timing */
@@ -257,30 +404,34 @@ int quiz_render_frame(QuizData *quiz, int question_index,
 
         /* Determine button color based on type and reveal state */
         Color button_bg;
+        int variant;
         if (reveal && correct) {
-            button_bg = active_colors.answer_button_correct;
+            button_bg = colors->answer_button_correct;
+            variant = ANSWER_CORRECT;
         } else if (reveal && !correct) {
-            button_bg = active_colors.answer_button_incorrect;
+            button_bg = colors->answer_button_incorrect;
+            variant = ANSWER_INCORRECT;
         } else {
-            button_bg = active_colors.answer_button_normal;
+            button_bg = colors->answer_button_normal;
+            variant = ANSWER_NORMAL;
         }
 
-        /* Draw button */
-        video_draw_rounded_rect_alpha(rgb_buffer, width, height,
-                                     layout->button_margin, button_y,
-                                     button_width, btn_height,
-                                     layout->button_radius, button_bg, ans_alpha);
-
-        /* Render text */
-        Color text_color = active_colors.answer_text;
-        int text_y = button_y + (btn_height / 2) + 8;
-
-        text_render_alpha(&text_ctx, rgb_buffer, width, height,
-                         answer_text,
-                         layout->button_margin + layout->button_text_padding,
-                         text_y, text_color.r, text_color.g, text_color.b, ans_alpha);
+        /* Draw button and text */
+        int text_y = button_y + (btn_height / 2) + layout_px(layout, 8);
+        Sprite *sprite = answer_sprite(rc, canvas,
+                                       SPRITE_SLOT_ANSWERS + i * ANSWER_VARIANTS + variant,
+                                       text_ctx, answer_text,
+                                       button_margin, button_y,
+                                       button_width, btn_height,
+                                       layout_px(layout, layout->button_radius),
+                                       button_margin + layout_px(layout, layout->button_text_padding),
+                                       text_y, button_bg, colors->answer_text);
+        if (!sprite) {
+            return -1;
+        }
+        scene_sprite(scene, sprite, ans_alpha);
     }
 
-    text_close(&text_ctx);
+    scene_draw(scene, canvas);
     return 0;
 }
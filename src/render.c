@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "render.h"
+
+/* Read the whole font file into memory */
+static uint8_t *load_file(const char *path, size_t *out_size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    long size = ftell(f);
+    if (size <= 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    uint8_t *data = malloc(size);
+    if (data && fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+
+    *out_size = (size_t)size;
+    return data;
+}
+
+int render_context_init(RenderContext *rc, const char *font_path,
+                        const ColorScheme *colors) {
+    memset(rc, 0, sizeof(*rc));
+
+    rc->font_data = load_file(font_path, &rc->font_data_size);
+    if (!rc->font_data) {
+        fprintf(stderr, "Failed to load font: %s\n", font_path);
+        return -1;
+    }
+
+    if (FT_Init_FreeType(&rc->library)) {
+        fprintf(stderr, "Failed to initialize FreeType\n");
+        free(rc->font_data);
+        rc->font_data = NULL;
+        return -1;
+    }
+
+    if (glyph_atlas_init(&rc->atlas) < 0) {
+        FT_Done_FreeType(rc->library);
+        free(rc->font_data);
+        rc->font_data = NULL;
+        return -1;
+    }
+
+    colors_init(&rc->colors, colors);
+    rc->font_id = 0;
+
+    return 0;
+}
+
+TextContext *render_context_text(RenderContext *rc, int font_size) {
+    for (int i = 0; i < rc->num_faces; i++) {
+        if (rc->faces[i].font_size == font_size) {
+            rc->face_used[i] = ++rc->face_clock;
+            return &rc->faces[i];
+        }
+    }
+
+    /* All slots taken (e.g. by earlier batch jobs with other sizes): the
+     * least recently used face goes, and with it the atlas, whose glyphs
+     * cannot be dropped per size. Faces still in use rasterize again. */
+    int slot = rc->num_faces;
+    if (slot == RENDER_MAX_FACES) {
+        slot = 0;
+        for (int i = 1; i < RENDER_MAX_FACES; i++) {
+            if (rc->face_used[i] < rc->face_used[slot]) {
+                slot = i;
+            }
+        }
+        text_close(&rc->faces[slot]);
+        glyph_atlas_clear(&rc->atlas);
+        rc->faces[slot] = rc->faces[--rc->num_faces];
+        rc->face_used[slot] = rc->face_used[rc->num_faces];
+        slot = rc->num_faces;
+    }
+
+    TextContext *ctx = &rc->faces[slot];
+    if (text_init(ctx, rc->library, rc->font_data, rc->font_data_size,
+                  font_size, rc->font_id, &rc->atlas) < 0) {
+        return NULL;
+    }
+    rc->face_used[slot] = ++rc->face_clock;
+    rc->num_faces++;
+
+    return ctx;
+}
+
+Scene *render_context_scene(RenderContext *rc, const Canvas *canvas) {
+    int pick = 0;
+    for (int i = 0; i < RENDER_MAX_SCENES; i++) {
+        if (rc->scenes[i].valid && rc->scenes[i].buffer == canvas->data[0]) {
+            pick = i;
+            break;
+        }
+        if (rc->scene_used[i] < rc->scene_used[pick]) {
+            pick = i;
+        }
+    }
+
+    rc->scene_used[pick] = ++rc->scene_clock;
+    return &rc->scenes[pick];
+}
+
+void render_context_free(RenderContext *rc) {
+    for (int i = 0; i < rc->num_faces; i++) {
+        text_close(&rc->faces[i]);
+    }
+    rc->num_faces = 0;
+
+    sprite_cache_free(&rc->sprites);
+    glyph_atlas_free(&rc->atlas);
+
+    if (rc->library) {
+        FT_Done_FreeType(rc->library);
+        rc->library = NULL;
+    }
+    if (rc->font_data) {
+        free(rc->font_data);
+        rc->font_data = NULL;
+    }
+}
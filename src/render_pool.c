@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "render_pool.h"
+#include "stats.h"
+#include "trace.h"
+
+int render_slot_paint(RenderSlot *slot, RenderContext *rc, const AppConfig *config,
+                      QuizData *quiz, int frames_per_question, int n) {
+    int width = config->video.width, height = config->video.height;
+
+    int question = n / frames_per_question;
+    float time = (float)(n % frames_per_question) / config->video.fps;
+
+    Canvas canvas;
+    if (slot->rgb) {
+        canvas_init_rgb(&canvas, slot->rgb, width, height);
+    } else {
+        canvas_init_yuv(&canvas, slot->yuv, slot->linesize, width, height,
+                        config->video.color_matrix);
+    }
+
+    uint64_t start = stats_start();
+    if (quiz_render_frame(rc, quiz, question, time, &canvas,
+                          &config->layout, &config->animation) < 0) {
+        fprintf(stderr, "Failed to render frame %d\n", n);
+        return -1;
+    }
+    stats_stop(STATS_RENDER, start);
+
+    /* Remember what the scene repainted so only that is converted */
+    if (slot->rgb) {
+        const Scene *scene = render_context_scene(rc, &canvas);
+        memcpy(slot->dirty, scene->dirty, scene->num_dirty * sizeof(CanvasRect));
+        slot->num_dirty = scene->num_dirty;
+    }
+
+    slot->question = question;
+    return 0;
+}
+
+void render_slot_convert(RenderSlot *slot, const AppConfig *config) {
+    if (!slot->rgb) {
+        return;
+    }
+
+    int width = config->video.width;
+    uint64_t start = stats_start();
+    for (int i = 0; i < slot->num_dirty; i++) {
+        const CanvasRect *r = &slot->dirty[i];
+        yuv_convert_rgb24_rect(slot->rgb, width * 3, slot->yuv, slot->linesize,
+                               r->x0, r->y0, r->x1 - r->x0, r->y1 - r->y0,
+                               config->video.color_matrix);
+    }
+    slot->num_dirty = 0;
+    stats_stop(STATS_CONVERT, start);
+}
+
+int render_slot_draw(RenderSlot *slot, RenderContext *rc, const AppConfig *config,
+                     QuizData *quiz, int frames_per_question, int n) {
+    if (render_slot_paint(slot, rc, config, quiz, frames_per_question, n) < 0) {
+        return -1;
+    }
+    render_slot_convert(slot, config);
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    RenderWorker *worker = arg;
+    RenderPool *pool = worker->pool;
+    trace_thread_name("render");
+
+    for (int n = worker->index; n < pool->total_frames; n += pool->num_workers) {
+        RenderSlot *slot = &pool->slots[n % pool->num_slots];
+
+        /* Wait until the encoder is done with the slot's previous frame */
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && n >= pool->next_out + pool->num_slots) {
+            pthread_cond_wait(&pool->slot_free, &pool->lock);
+        }
+        int stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) break;
+
+        int ret = render_slot_draw(slot, &worker->rc, pool->config, pool->quiz,
+                                   pool->frames_per_question, n);
+
+        pthread_mutex_lock(&pool->lock);
+        if (ret < 0) {
+            pool->failed = 1;
+        } else {
+            slot->frame = n;
+            slot->ready = 1;
+        }
+        pthread_cond_broadcast(&pool->slot_ready);
+        pthread_mutex_unlock(&pool->lock);
+        if (ret < 0) break;
+    }
+
+    return NULL;
+}
+
+int render_slot_init(RenderSlot *slot, int width, int height, int use_rgb) {
+    int chroma_w = (width + 1) / 2, chroma_h = (height + 1) / 2;
+
+    memset(slot, 0, sizeof(*slot));
+    slot->frame = -1;
+    slot->linesize[0] = width;
+    slot->linesize[1] = chroma_w;
+    slot->linesize[2] = chroma_w;
+    slot->yuv[0] = malloc((size_t)width * height);
+    slot->yuv[1] = malloc((size_t)chroma_w * chroma_h);
+    slot->yuv[2] = malloc((size_t)chroma_w * chroma_h);
+    if (use_rgb) {
+        slot->rgb = malloc((size_t)width * height * 3);
+    }
+
+    if (!slot->yuv[0] || !slot->yuv[1] || !slot->yuv[2] || (use_rgb && !slot->rgb)) {
+        return -1;
+    }
+    return 0;
+}
+
+void render_slot_free(RenderSlot *slot) {
+    free(slot->rgb);
+    for (int i = 0; i < 3; i++) {
+        free(slot->yuv[i]);
+    }
+    memset(slot, 0, sizeof(*slot));
+}
+
+int render_pool_init(RenderPool *pool, const AppConfig *config,
+                     const ColorScheme *colors, QuizData *quiz) {
+    memset(pool, 0, sizeof(*pool));
+    pool->quiz = quiz;
+    pool->config = config;
+    pool->frames_per_question = (quiz->question_duration + quiz->reveal_duration) *
+                                config->video.fps;
+    pool->total_frames = pool->frames_per_question * quiz->num_questions;
+
+    int threads = config->render.threads;
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > RENDER_POOL_MAX_WORKERS) threads = RENDER_POOL_MAX_WORKERS;
+    if (pool->total_frames > 0 && threads > pool->total_frames) threads = pool->total_frames;
+    if (threads < 1) threads = 1;
+
+    pool->num_workers = threads;
+    pool->num_slots = threads * config->render.queue_depth;
+    pool->workers = calloc(pool->num_workers, sizeof(RenderWorker));
+    pool->slots = calloc(pool->num_slots, sizeof(RenderSlot));
+    if (!pool->workers || !pool->slots) {
+        fprintf(stderr, "Failed to allocate render pool\n");
+        free(pool->workers);
+        free(pool->slots);
+        return -1;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->slot_ready, NULL);
+    pthread_cond_init(&pool->slot_free, NULL);
+
+    int use_rgb = (config->video.render_format == CANVAS_RGB24);
+    for (int i = 0; i < pool->num_slots; i++) {
+        if (render_slot_init(&pool->slots[i], config->video.width, config->video.height, use_rgb) < 0) {
+            fprintf(stderr, "Failed to allocate frame buffers\n");
+            render_pool_free(pool);
+            return -1;
+        }
+    }
+
+    /* Contexts are set up before any thread starts so font errors are
+     * reported here rather than mid-render */
+    for (int i = 0; i < pool->num_workers; i++) {
+        RenderWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        if (render_context_init(&worker->rc, config->font_path, colors) < 0) {
+            render_pool_free(pool);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        RenderWorker *worker = &pool->workers[i];
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr, "Failed to start render thread\n");
+            render_pool_free(pool);
+            return -1;
+        }
+        worker->started = 1;
+    }
+
+    printf("Rendering on %d threads (%d frame buffers)\n",
+           pool->num_workers, pool->num_slots);
+    return 0;
+}
+
+const RenderSlot *render_pool_next(RenderPool *pool) {
+    if (pool->next_out >= pool->total_frames) {
+        return NULL;
+    }
+
+    RenderSlot *slot = &pool->slots[pool->next_out % pool->num_slots];
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->failed && !(slot->ready && slot->frame == pool->next_out)) {
+        pthread_cond_wait(&pool->slot_ready, &pool->lock);
+    }
+    int failed = pool->failed;
+    pthread_mutex_unlock(&pool->lock);
+
+    return failed ? NULL : slot;
+}
+
+void render_pool_release(RenderPool *pool, const RenderSlot *slot) {
+    pthread_mutex_lock(&pool->lock);
+    pool->slots[slot - pool->slots].ready = 0;
+    pool->next_out++;
+    pthread_cond_broadcast(&pool->slot_free);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void render_pool_free(RenderPool *pool) {
+    if (!pool->workers) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->slot_free);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        RenderWorker *worker = &pool->workers[i];
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
+        }
+        render_context_free(&worker->rc);
+    }
+    for (int i = 0; i < pool->num_slots; i++) {
+        render_slot_free(&pool->slots[i]);
+    }
+
+    free(pool->workers);
+    free(pool->slots);
+    pool->workers = NULL;
+    pool->slots = NULL;
+
+    pthread_cond_destroy(&pool->slot_free);
+    pthread_cond_destroy(&pool->slot_ready);
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <string.h>
+#include "scene.h"
+#include "trace.h"
+#include "video.h"
+
+void scene_begin(Scene *scene) {
+    scene->num_items = 0;
+}
+
+static SceneItem *append_item(Scene *scene, SceneItemType type) {
+    if (scene->num_items >= SCENE_MAX_ITEMS) {
+        fprintf(stderr, "Scene item limit reached (max %d)\n", SCENE_MAX_ITEMS);
+        return NULL;
+    }
+    SceneItem *item = &scene->items[scene->num_items++];
+    memset(item, 0, sizeof(*item));
+    item->type = type;
+    return item;
+}
+
+void scene_fill(Scene *scene, Color color) {
+    SceneItem *item = append_item(scene, SCENE_FILL);
+    if (!item) return;
+
+    item->rect.x1 = 1 << 30;
+    item->rect.y1 = 1 << 30;
+    item->color = color;
+}
+
+void scene_rect(Scene *scene, int x, int y, int width, int height, Color color) {
+    if (width <= 0 || height <= 0) return;
+
+    SceneItem *item = append_item(scene, SCENE_RECT);
+    if (!item) return;
+
+    item->rect.x0 = x;
+    item->rect.y0 = y;
+    item->rect.x1 = x + width;
+    item->rect.y1 = y + height;
+    item->color = color;
+}
+
+void scene_sprite(Scene *scene, const Sprite *sprite, float alpha) {
+    if (!sprite || alpha <= 0.0f) return;
+    if (alpha > 1.0f) alpha = 1.0f;
+
+    SceneItem *item = append_item(scene, SCENE_SPRITE);
+    if (!item) return;
+
+    item->rect.x0 = sprite->x;
+    item->rect.y0 = sprite->y;
+    item->rect.x1 = sprite->x + sprite->width;
+    item->rect.y1 = sprite->y + sprite->height;
+    item->sprite = sprite;
+    item->sprite_id = sprite->id;
+    item->alpha = (int)(alpha * 256.0f);
+}
+
+void scene_invalidate(Scene *scene) {
+    scene->valid = 0;
+    scene->num_prev = 0;
+}
+
+static int rects_equal(const CanvasRect *a, const CanvasRect *b) {
+    return a->x0 == b->x0 && a->y0 == b->y0 && a->x1 == b->x1 && a->y1 == b->y1;
+}
+
+static int rects_touch(const CanvasRect *a, const CanvasRect *b) {
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+static void rect_union(CanvasRect *a, const CanvasRect *b) {
+    if (b->x0 < a->x0) a->x0 = b->x0;
+    if (b->y0 < a->y0) a->y0 = b->y0;
+    if (b->x1 > a->x1) a->x1 = b->x1;
+    if (b->y1 > a->y1) a->y1 = b->y1;
+}
+
+/* Add a region to the dirty list: clipped to the canvas, widened to even
+ * bounds for chroma, and merged with any region it touches */
+static void add_dirty(Scene *scene, CanvasRect r) {
+    if (r.x0 < 0) r.x0 = 0;
+    if (r.y0 < 0) r.y0 = 0;
+    if (r.x1 > scene->width) r.x1 = scene->width;
+    if (r.y1 > scene->height) r.y1 = scene->height;
+    if (r.x0 >= r.x1 || r.y0 >= r.y1) return;
+
+    r.x0 &= ~1;
+    r.y0 &= ~1;
+    if (r.x1 & 1 && r.x1 < scene->width) r.x1++;
+    if (r.y1 & 1 && r.y1 < scene->height) r.y1++;
+
+    /* Merging can make the result touch earlier regions, so repeat */
+    int merged = 1;
+    while (merged) {
+        merged = 0;
+        for (int i = 0; i < scene->num_dirty; i++) {
+            if (rects_touch(&scene->dirty[i], &r)) {
+                rect_union(&r, &scene->dirty[i]);
+                scene->dirty[i] = scene->dirty[--scene->num_dirty];
+                merged = 1;
+                break;
+            }
+        }
+    }
+
+    if (scene->num_dirty == SCENE_MAX_DIRTY) {
+        rect_union(&scene->dirty[SCENE_MAX_DIRTY - 1], &r);
+        return;
+    }
+    scene->dirty[scene->num_dirty++] = r;
+}
+
+/* Same item type drawing the same pixels, ignoring position */
+static int same_paint(const SceneItem *a, const SceneItem *b) {
+    if (a->type != b->type) return 0;
+    if (a->type == SCENE_SPRITE) {
+        return a->sprite == b->sprite && a->sprite_id == b->sprite_id &&
+               a->alpha == b->alpha;
+    }
+    return a->color.r == b->color.r && a->color.g == b->color.g &&
+           a->color.b == b->color.b;
+}
+
+/* Mark what changed between two items drawn at the same list position */
+static void diff_items(Scene *scene, const SceneItem *old, const SceneItem *cur) {
+    int paint = same_paint(old, cur);
+    if (paint && rects_equal(&old->rect, &cur->rect)) return;
+
+    /* A solid rect that only moved one edge pair (e.g. the timer fill
+     * growing) changes just the strips between the old and new edges */
+    if (paint && cur->type == SCENE_RECT) {
+        const CanvasRect *a = &old->rect, *b = &cur->rect;
+        if (a->y0 == b->y0 && a->y1 == b->y1) {
+            CanvasRect left = {a->x0 < b->x0 ? a->x0 : b->x0, a->y0,
+                               a->x0 < b->x0 ? b->x0 : a->x0, a->y1};
+            CanvasRect right = {a->x1 < b->x1 ? a->x1 : b->x1, a->y0,
+                                a->x1 < b->x1 ? b->x1 : a->x1, a->y1};
+            add_dirty(scene, left);
+            add_dirty(scene, right);
+            return;
+        }
+        if (a->x0 == b->x0 && a->x1 == b->x1) {
+            CanvasRect top = {a->x0, a->y0 < b->y0 ? a->y0 : b->y0,
+                              a->x1, a->y0 < b->y0 ? b->y0 : a->y0};
+            CanvasRect bottom = {a->x0, a->y1 < b->y1 ? a->y1 : b->y1,
+                                 a->x1, a->y1 < b->y1 ? b->y1 : a->y1};
+            add_dirty(scene, top);
+            add_dirty(scene, bottom);
+            return;
+        }
+    }
+
+    add_dirty(scene, old->rect);
+    add_dirty(scene, cur->rect);
+}
+
+static void draw_items(const Scene *scene, Canvas *canvas) {
+    for (int i = 0; i < scene->num_items; i++) {
+        const SceneItem *item = &scene->items[i];
+        const CanvasRect *clip = &canvas->clip;
+        if (item->rect.x1 <= clip->x0 || item->rect.x0 >= clip->x1 ||
+            item->rect.y1 <= clip->y0 || item->rect.y0 >= clip->y1) {
+            continue;
+        }
+
+        switch (item->type) {
+        case SCENE_FILL:
+            video_fill_rgb_color(canvas, item->color);
+            break;
+        case SCENE_RECT:
+            video_draw_rect(canvas, item->rect.x0, item->rect.y0,
+                            item->rect.x1 - item->rect.x0, item->rect.y1 - item->rect.y0,
+                            item->color.r, item->color.g, item->color.b);
+            break;
+        case SCENE_SPRITE: {
+            uint64_t start = trace_begin();
+            sprite_blit(canvas, item->sprite, item->alpha / 256.0f);
+            trace_end("sprite_blit", start);
+            break;
+        }
+        }
+    }
+}
+
+void scene_draw(Scene *scene, Canvas *canvas) {
+    int same_buffer = scene->valid && scene->buffer == canvas->data[0] &&
+                      scene->width == canvas->width && scene->height == canvas->height &&
+                      scene->format == canvas->format;
+
+    scene->buffer = canvas->data[0];
+    scene->width = canvas->width;
+    scene->height = canvas->height;
+    scene->format = canvas->format;
+    scene->num_dirty = 0;
+
+    if (!same_buffer) {
+        CanvasRect full = {0, 0, canvas->width, canvas->height};
+        add_dirty(scene, full);
+    } else {
+        int n = scene->num_items > scene->num_prev ? scene->num_items : scene->num_prev;
+        for (int i = 0; i < n; i++) {
+            if (i >= scene->num_items) {
+                add_dirty(scene, scene->prev[i].rect);
+            } else if (i >= scene->num_prev) {
+                add_dirty(scene, scene->items[i].rect);
+            } else {
+                diff_items(scene, &scene->prev[i], &scene->items[i]);
+            }
+        }
+    }
+
+    /* Replay the whole list inside each changed region */
+    for (int i = 0; i < scene->num_dirty; i++) {
+        canvas_set_clip(canvas, &scene->dirty[i]);
+        draw_items(scene, canvas);
+    }
+    canvas_set_clip(canvas, NULL);
+
+    memcpy(scene->prev, scene->items, scene->num_items * sizeof(SceneItem));
+    scene->num_prev = scene->num_items;
+    scene->valid = 1;
+}
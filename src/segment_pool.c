@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "segment_pool.h"
+#include "trace.h"
+
+/* Render and encode every frame of one segment */
+static int encode_segment(SegmentWorker *worker, Segment *segment) {
+    SegmentPool *pool = worker->pool;
+
+    if (video_segment_init(pool->output, &segment->encoder, segment->first_frame) < 0) {
+        return -1;
+    }
+
+    int end = segment->first_frame + segment->num_frames;
+    for (int n = segment->first_frame; n < end; n++) {
+        if (render_slot_draw(&worker->buffer, &worker->rc, pool->config, pool->quiz,
+                             pool->frames_per_question, n) < 0) {
+            return -1;
+        }
+        if (video_segment_write_planes(&segment->encoder, worker->buffer.yuv,
+                                       worker->buffer.linesize) < 0) {
+            fprintf(stderr, "Failed to encode frame %d\n", n);
+            return -1;
+        }
+    }
+
+    return video_segment_finish(&segment->encoder);
+}
+
+static void *worker_main(void *arg) {
+    SegmentWorker *worker = arg;
+    SegmentPool *pool = worker->pool;
+    trace_thread_name("segment");
+
+    for (;;) {
+        /* Claim the next segment once the muxer has room for it */
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->next_claim < pool->num_segments &&
+               pool->next_claim >= pool->next_out + pool->max_ahead) {
+            pthread_cond_wait(&pool->segment_free, &pool->lock);
+        }
+        if (pool->stop || pool->next_claim >= pool->num_segments) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        Segment *segment = &pool->segments[pool->next_claim++];
+        pthread_mutex_unlock(&pool->lock);
+
+        int ret = encode_segment(worker, segment);
+
+        pthread_mutex_lock(&pool->lock);
+        if (ret < 0) {
+            pool->failed = 1;
+        } else {
+            segment->done = 1;
+        }
+        pthread_cond_broadcast(&pool->segment_done);
+        pthread_mutex_unlock(&pool->lock);
+        if (ret < 0) break;
+    }
+
+    return NULL;
+}
+
+int segment_pool_init(SegmentPool *pool, const AppConfig *config,
+                      const ColorScheme *colors, QuizData *quiz,
+                      const VideoEncoder *output) {
+    memset(pool, 0, sizeof(*pool));
+    pool->quiz = quiz;
+    pool->config = config;
+    pool->output = output;
+    pool->frames_per_question = (quiz->question_duration + quiz->reveal_duration) *
+                                config->video.fps;
+    pool->total_frames = pool->frames_per_question * quiz->num_questions;
+
+    int per_segment = config->encoder.segment_questions > 0 ?
+                      config->encoder.segment_questions : 1;
+    pool->num_segments = (quiz->num_questions + per_segment - 1) / per_segment;
+
+    int threads = config->render.threads;
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > RENDER_POOL_MAX_WORKERS) threads = RENDER_POOL_MAX_WORKERS;
+    if (pool->num_segments > 0 && threads > pool->num_segments) threads = pool->num_segments;
+    if (threads < 1) threads = 1;
+
+    pool->num_workers = threads;
+    pool->max_ahead = threads * config->render.queue_depth;
+    pool->workers = calloc(pool->num_workers, sizeof(SegmentWorker));
+    pool->segments = calloc(pool->num_segments > 0 ? pool->num_segments : 1, sizeof(Segment));
+    if (!pool->workers || !pool->segments) {
+        fprintf(stderr, "Failed to allocate segment pool\n");
+        free(pool->workers);
+        free(pool->segments);
+        pool->workers = NULL;
+        pool->segments = NULL;
+        return -1;
+    }
+
+    for (int i = 0; i < pool->num_segments; i++) {
+        Segment *segment = &pool->segments[i];
+        segment->first_question = i * per_segment;
+        segment->num_questions = quiz->num_questions - segment->first_question;
+        if (segment->num_questions > per_segment) segment->num_questions = per_segment;
+        segment->first_frame = segment->first_question * pool->frames_per_question;
+        segment->num_frames = segment->num_questions * pool->frames_per_question;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->segment_done, NULL);
+    pthread_cond_init(&pool->segment_free, NULL);
+
+    /* Contexts and buffers are set up before any thread starts so font
+     * errors are reported here rather than mid-encode */
+    int use_rgb = (config->video.render_format == CANVAS_RGB24);
+    for (int i = 0; i < pool->num_workers; i++) {
+        SegmentWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        if (render_slot_init(&worker->buffer, config->video.width, config->video.height,
+                             use_rgb) < 0) {
+            fprintf(stderr, "Failed to allocate frame buffers\n");
+            segment_pool_free(pool);
+            return -1;
+        }
+        if (render_context_init(&worker->rc, config->font_path, colors) < 0) {
+            segment_pool_free(pool);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        SegmentWorker *worker = &pool->workers[i];
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr, "Failed to start encoder thread\n");
+            segment_pool_free(pool);
+            return -1;
+        }
+        worker->started = 1;
+    }
+
+    printf("Encoding %d segments on %d threads\n", pool->num_segments, pool->num_workers);
+    return 0;
+}
+
+Segment *segment_pool_next(SegmentPool *pool) {
+    if (pool->next_out >= pool->num_segments) {
+        return NULL;
+    }
+
+    Segment *segment = &pool->segments[pool->next_out];
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->failed && !segment->done) {
+        pthread_cond_wait(&pool->segment_done, &pool->lock);
+    }
+    int failed = pool->failed;
+    pthread_mutex_unlock(&pool->lock);
+
+    return failed ? NULL : segment;
+}
+
+void segment_pool_release(SegmentPool *pool, Segment *segment) {
+    video_segment_free(&segment->encoder);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->next_out++;
+    pthread_cond_broadcast(&pool->segment_free);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void segment_pool_free(SegmentPool *pool) {
+    if (!pool->workers) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->segment_free);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        SegmentWorker *worker = &pool->workers[i];
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
+        }
+        render_context_free(&worker->rc);
+        render_slot_free(&worker->buffer);
+    }
+    for (int i = 0; i < pool->num_segments; i++) {
+        video_segment_free(&pool->segments[i].encoder);
+    }
+
+    free(pool->workers);
+    free(pool->segments);
+    pool->workers = NULL;
+    pool->segments = NULL;
+
+    pthread_cond_destroy(&pool->segment_free);
+    pthread_cond_destroy(&pool->segment_done);
+    pthread_mutex_destroy(&pool->lock);
+}
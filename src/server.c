@@ -0,0 +1,401 @@
+#define _GNU_SOURCE   /* accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <json-c/json.h>
+#include "server.h"
+
+/* Seconds a client has to send its request */
+#define SERVER_READ_TIMEOUT 5
+
+/* Milliseconds the last event of a connection may wait for the client */
+#define SERVER_FINAL_SEND_TIMEOUT 1000
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int job_fd(const BatchJob *job) {
+    return (int)(intptr_t)job->user;
+}
+
+/* Send all of a line, waiting up to timeout_ms for the client to make
+ * room. A line that cannot go out whole shuts the connection down, so no
+ * later event is glued onto half a line; the client sees the stream end
+ * and later sends to it fail quietly. */
+static void send_line(int fd, const char *line, size_t len, int timeout_ms) {
+    double deadline = now_seconds() + timeout_ms / 1000.0;
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(fd, line + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n >= 0) {
+            sent += n;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            int wait_ms = (int)((deadline - now_seconds()) * 1000);
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            if (wait_ms > 0 && (poll(&pfd, 1, wait_ms) >= 0 || errno == EINTR)) {
+                continue;
+            }
+            fprintf(stderr, "Client is not reading its events, closing the connection\n");
+        } else if (errno != EPIPE && errno != ECONNRESET) {
+            fprintf(stderr, "Failed to send event: %s\n", strerror(errno));
+        }
+        shutdown(fd, SHUT_RDWR);
+        return;
+    }
+}
+
+/* Send one event line. Progress events never wait, as they are sent from
+ * worker threads with the batch lock held; the last event of a
+ * connection waits up to SERVER_FINAL_SEND_TIMEOUT so it is not lost. */
+static void send_event(int fd, struct json_object *event, int final) {
+    const char *text = json_object_to_json_string_ext(event, JSON_C_TO_STRING_PLAIN);
+    size_t len = strlen(text);
+    char *line = malloc(len + 1);
+    if (line) {
+        memcpy(line, text, len);
+        line[len] = '\n';
+        send_line(fd, line, len + 1, final ? SERVER_FINAL_SEND_TIMEOUT : 0);
+        free(line);
+    }
+    json_object_put(event);
+}
+
+static struct json_object *new_event(const char *name) {
+    struct json_object *event = json_object_new_object();
+    json_object_object_add(event, "event", json_object_new_string(name));
+    return event;
+}
+
+static void send_error(int fd, const char *name, const char *error) {
+    struct json_object *event = new_event(name);
+    json_object_object_add(event, "error", json_object_new_string(error));
+    send_event(fd, event, 1);
+}
+
+/* Report job events to the client that submitted the job */
+static void on_job_event(BatchJob *job, BatchEvent what) {
+    int fd = job_fd(job);
+    struct json_object *event;
+
+    switch (what) {
+    case BATCH_EVENT_QUEUED:
+        event = new_event("queued");
+        json_object_object_add(event, "job", json_object_new_int(job->id));
+        json_object_object_add(event, "position", json_object_new_int(job->queued_behind));
+        break;
+    case BATCH_EVENT_STARTED:
+        event = new_event("started");
+        json_object_object_add(event, "job", json_object_new_int(job->id));
+        json_object_object_add(event, "frames", json_object_new_int(job->total_frames));
+        json_object_object_add(event, "segments", json_object_new_int(job->num_segments));
+        break;
+    case BATCH_EVENT_PROGRESS:
+        event = new_event("progress");
+        json_object_object_add(event, "job", json_object_new_int(job->id));
+        json_object_object_add(event, "frames", json_object_new_int(job->frames_done));
+        json_object_object_add(event, "total", json_object_new_int(job->total_frames));
+        break;
+    default:
+        event = new_event(job->failed ? "failed" : "done");
+        json_object_object_add(event, "job", json_object_new_int(job->id));
+        json_object_object_add(event, "output", json_object_new_string(job->config.output_file));
+        if (job->failed) {
+            json_object_object_add(event, "error", json_object_new_string(job->error));
+        } else {
+            json_object_object_add(event, "frames", json_object_new_int(job->output.frame_count));
+        }
+        json_object_object_add(event, "seconds", json_object_new_double(job->seconds));
+        send_event(fd, event, 1);
+        close(fd);
+        return;
+    }
+    send_event(fd, event, 0);
+}
+
+/* Start reading a new connection's request */
+static void add_client(Server *server, int fd) {
+    ServerClient *client = &server->clients[server->num_clients];
+    client->buffer = malloc(4096);
+    if (!client->buffer) {
+        send_error(fd, "rejected", "out of memory");
+        close(fd);
+        return;
+    }
+    client->fd = fd;
+    client->len = 0;
+    client->capacity = 4096;
+    client->deadline = now_seconds() + SERVER_READ_TIMEOUT;
+    server->num_clients++;
+}
+
+/* Read whatever the client has sent so far without blocking.
+ * Returns 1 once the request is complete (up to the first newline or end
+ * of stream), 0 if more is to come, -1 if it cannot be read. */
+static int read_client(ServerClient *client) {
+    for (;;) {
+        if (client->len + 1 == client->capacity) {
+            if (client->capacity >= SERVER_MAX_REQUEST) {
+                return -1;
+            }
+            char *grown = realloc(client->buffer, client->capacity * 2);
+            if (!grown) return -1;
+            client->buffer = grown;
+            client->capacity *= 2;
+        }
+
+        ssize_t n = recv(client->fd, client->buffer + client->len,
+                         client->capacity - client->len - 1, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        if (n == 0) {
+            if (client->len == 0) {
+                return -1;
+            }
+            /* Client closed its side without a newline */
+            client->buffer[client->len] = '\0';
+            return 1;
+        }
+
+        char *newline = memchr(client->buffer + client->len, '\n', n);
+        client->len += n;
+        if (newline) {
+            *newline = '\0';
+            return 1;
+        }
+    }
+}
+
+/* Validate one request and queue it, or tell the client why not */
+static void handle_client(Server *server, int fd, const char *request) {
+    struct json_object *root = json_tokener_parse(request);
+    struct json_object *value;
+    if (!root || !json_object_is_type(root, json_type_object)) {
+        send_error(fd, "rejected", "request is not a JSON object");
+        json_object_put(root);
+        close(fd);
+        return;
+    }
+    if (!json_object_object_get_ex(root, "output", &value) ||
+        (!json_object_object_get_ex(root, "quiz", &value) &&
+         !json_object_object_get_ex(root, "quiz_file", &value))) {
+        send_error(fd, "rejected", "request needs output and quiz or quiz_file");
+        json_object_put(root);
+        close(fd);
+        return;
+    }
+
+    /* Admission control: accept what can start now plus max_queued waiting */
+    int running, queued;
+    batch_counts(&server->batch, &running, &queued);
+    int free_slots = server->config->server.max_jobs - running;
+    if (free_slots < 0) free_slots = 0;
+    if (queued >= free_slots + server->config->server.max_queued) {
+        send_error(fd, "rejected", "queue full");
+        json_object_put(root);
+        close(fd);
+        return;
+    }
+
+    BatchJob *job = batch_job_new(server->config, root);
+    json_object_put(root);
+    if (!job) {
+        send_error(fd, "rejected", "out of memory");
+        close(fd);
+        return;
+    }
+
+    /* From here on the job's events own the connection */
+    job->user = (void *)(intptr_t)fd;
+    if (batch_submit(&server->batch, job) < 0) {
+        send_error(fd, "rejected", "out of memory");
+        close(fd);
+    }
+}
+
+/* Refuse to take over the socket of a server that is still running */
+static int claim_socket_path(const struct sockaddr_un *addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int in_use = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    close(fd);
+    if (in_use) {
+        fprintf(stderr, "Another server is listening on %s\n", addr->sun_path);
+        return -1;
+    }
+
+    /* A socket left behind by a server that died; never remove other files */
+    struct stat st;
+    if (stat(addr->sun_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", addr->sun_path);
+            return -1;
+        }
+        unlink(addr->sun_path);
+    }
+    return 0;
+}
+
+int server_init(Server *server, const char *socket_path, const AppConfig *config) {
+    memset(server, 0, sizeof(*server));
+    server->listen_fd = -1;
+    server->config = config;
+    batch_init(&server->batch);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    if (claim_socket_path(&addr) < 0) {
+        return -1;
+    }
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0 ||
+        bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Failed to bind %s: %s\n", socket_path, strerror(errno));
+        return -1;
+    }
+    server->socket_path = malloc(strlen(socket_path) + 1);
+    if (server->socket_path) {
+        strcpy(server->socket_path, socket_path);
+    }
+    if (listen(server->listen_fd, 64) < 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", socket_path, strerror(errno));
+        return -1;
+    }
+
+    server->batch.serving = 1;
+    server->batch.max_running = config->server.max_jobs;
+    server->batch.on_event = on_job_event;
+    if (batch_start(&server->batch, config) < 0) {
+        return -1;
+    }
+
+    printf("Listening on %s (%d render threads, %d jobs at once, %d queued)\n",
+           socket_path, server->batch.num_workers, config->server.max_jobs,
+           config->server.max_queued);
+    return 0;
+}
+
+int server_run(Server *server) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!stop_requested) {
+        /* The listen socket first, then every client still sending; no
+         * new connections while the pending list is full */
+        struct pollfd pfds[SERVER_MAX_PENDING + 1];
+        int listening = server->num_clients < SERVER_MAX_PENDING;
+        pfds[0] = (struct pollfd){server->listen_fd, listening ? POLLIN : 0, 0};
+        double now = now_seconds();
+        int timeout_ms = -1;
+        for (int i = 0; i < server->num_clients; i++) {
+            pfds[i + 1] = (struct pollfd){server->clients[i].fd, POLLIN, 0};
+            int wait_ms = (int)((server->clients[i].deadline - now) * 1000) + 1;
+            if (wait_ms < 0) wait_ms = 0;
+            if (timeout_ms < 0 || wait_ms < timeout_ms) timeout_ms = wait_ms;
+        }
+
+        if (poll(pfds, server->num_clients + 1, timeout_ms) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        /* From the end, so the client moved into a finished one's place
+         * has been handled already */
+        now = now_seconds();
+        for (int i = server->num_clients - 1; i >= 0; i--) {
+            ServerClient *client = &server->clients[i];
+            int ret = pfds[i + 1].revents ? read_client(client) : 0;
+            if (ret == 0 && now < client->deadline) {
+                continue;
+            }
+
+            int fd = client->fd;
+            char *request = client->buffer;
+            server->clients[i] = server->clients[--server->num_clients];
+            if (ret > 0) {
+                handle_client(server, fd, request);
+            } else {
+                send_error(fd, "rejected", ret < 0 ? "could not read request"
+                                                   : "timed out reading request");
+                close(fd);
+            }
+            free(request);
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd >= 0) {
+                add_client(server, fd);
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                       errno != ECONNABORTED) {
+                fprintf(stderr, "accept failed: %s\n", strerror(errno));
+            }
+        }
+    }
+
+    printf("Stopping: finishing accepted jobs\n");
+    return 0;
+}
+
+void server_free(Server *server) {
+    /* Requests that had not fully arrived are not accepted */
+    for (int i = 0; i < server->num_clients; i++) {
+        send_error(server->clients[i].fd, "rejected", "server stopping");
+        close(server->clients[i].fd);
+        free(server->clients[i].buffer);
+    }
+    server->num_clients = 0;
+
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        server->listen_fd = -1;
+    }
+    if (server->socket_path) {
+        unlink(server->socket_path);
+        free(server->socket_path);
+        server->socket_path = NULL;
+    }
+
+    /* Accepted jobs still run to the end and report to their clients */
+    batch_wait(&server->batch);
+    batch_free(&server->batch);
+}
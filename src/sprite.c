@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sprite.h"
+
+int sprite_layer_alloc(Canvas *layer, int *x, int *y, int *width, int *height) {
+    /* Even origin and size keep YUV sprites on the chroma grid */
+    int x0 = *x & ~1, y0 = *y & ~1;
+    int x1 = *x + *width, y1 = *y + *height;
+    if (x1 < x0 + 2) x1 = x0 + 2;
+    if (y1 < y0 + 2) y1 = y0 + 2;
+    x1 = (x1 + 1) & ~1;
+    y1 = (y1 + 1) & ~1;
+
+    uint8_t *pixels = calloc((size_t)(x1 - x0) * (y1 - y0), 4);
+    if (!pixels) {
+        fprintf(stderr, "Failed to allocate sprite layer\n");
+        return -1;
+    }
+
+    *x = x0;
+    *y = y0;
+    *width = x1 - x0;
+    *height = y1 - y0;
+    canvas_init_rgba(layer, pixels, *width, *height);
+    return 0;
+}
+
+void sprite_layer_free(Canvas *layer) {
+    free(layer->data[0]);
+    layer->data[0] = NULL;
+}
+
+static int clamp_u8(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/* Premultiplied RGB keeps the layer colors and adds a coverage plane */
+static int init_rgb(Sprite *sprite, const Canvas *layer) {
+    int w = sprite->width, h = sprite->height;
+
+    sprite->data[0] = malloc((size_t)w * h * 3);
+    sprite->alpha[0] = malloc((size_t)w * h);
+    if (!sprite->data[0] || !sprite->alpha[0]) {
+        return -1;
+    }
+    sprite->linesize[0] = w * 3;
+    sprite->alpha_linesize[0] = w;
+
+    for (int row = 0; row < h; row++) {
+        const uint8_t *src = layer->data[0] + row * layer->linesize[0];
+        uint8_t *dst = sprite->data[0] + row * sprite->linesize[0];
+        uint8_t *a = sprite->alpha[0] + row * sprite->alpha_linesize[0];
+        for (int col = 0; col < w; col++) {
+            dst[col * 3 + 0] = src[col * 4 + 0];
+            dst[col * 3 + 1] = src[col * 4 + 1];
+            dst[col * 3 + 2] = src[col * 4 + 2];
+            a[col] = src[col * 4 + 3];
+        }
+    }
+    return 0;
+}
+
+/* Premultiplied YUV: the limited-range offsets are scaled by coverage, so
+ * a fully transparent sample is zero in every plane */
+static int init_yuv(Sprite *sprite, const Canvas *layer, YuvMatrix matrix) {
+    const YuvCoeffs *k = yuv_coeffs(matrix);
+    int w = sprite->width, h = sprite->height;
+    int cw = w / 2, ch = h / 2;
+
+    sprite->data[0] = malloc((size_t)w * h);
+    sprite->data[1] = malloc((size_t)cw * ch);
+    sprite->data[2] = malloc((size_t)cw * ch);
+    sprite->alpha[0] = malloc((size_t)w * h);
+    sprite->alpha[1] = malloc((size_t)cw * ch);
+    if (!sprite->data[0] || !sprite->data[1] || !sprite->data[2] ||
+        !sprite->alpha[0] || !sprite->alpha[1]) {
+        return -1;
+    }
+    sprite->linesize[0] = w;
+    sprite->linesize[1] = cw;
+    sprite->linesize[2] = cw;
+    sprite->alpha_linesize[0] = w;
+    sprite->alpha_linesize[1] = cw;
+
+    for (int row = 0; row < h; row++) {
+        const uint8_t *src = layer->data[0] + row * layer->linesize[0];
+        uint8_t *py = sprite->data[0] + row * sprite->linesize[0];
+        uint8_t *pa = sprite->alpha[0] + row * sprite->alpha_linesize[0];
+        for (int col = 0; col < w; col++) {
+            const uint8_t *px = src + col * 4;
+            int luma = (k->y[0] * px[0] + k->y[1] * px[1] + k->y[2] * px[2] + 128) >> 8;
+            py[col] = (uint8_t)clamp_u8(luma + (16 * px[3] + 127) / 255);
+            pa[col] = px[3];
+        }
+    }
+
+    for (int crow = 0; crow < ch; crow++) {
+        const uint8_t *s0 = layer->data[0] + (2 * crow) * layer->linesize[0];
+        const uint8_t *s1 = s0 + layer->linesize[0];
+        uint8_t *pu = sprite->data[1] + crow * sprite->linesize[1];
+        uint8_t *pv = sprite->data[2] + crow * sprite->linesize[2];
+        uint8_t *pa = sprite->alpha[1] + crow * sprite->alpha_linesize[1];
+
+        for (int ccol = 0; ccol < cw; ccol++) {
+            const uint8_t *a = s0 + ccol * 8, *b = s1 + ccol * 8;
+            int r = a[0] + a[4] + b[0] + b[4];
+            int g = a[1] + a[5] + b[1] + b[5];
+            int bl = a[2] + a[6] + b[2] + b[6];
+            int alpha = (a[3] + a[7] + b[3] + b[7] + 2) >> 2;
+
+            /* Sums of four samples: divide the matrix product by 4 * 256 */
+            float offset = 128.0f * alpha / 255.0f + 0.5f;
+            int u = (int)((k->u[0] * r + k->u[1] * g + k->u[2] * bl) / 1024.0f + offset);
+            int v = (int)((k->v[0] * r + k->v[1] * g + k->v[2] * bl) / 1024.0f + offset);
+            pu[ccol] = (uint8_t)clamp_u8(u);
+            pv[ccol] = (uint8_t)clamp_u8(v);
+            pa[ccol] = (uint8_t)alpha;
+        }
+    }
+    return 0;
+}
+
+int sprite_init(Sprite *sprite, const Canvas *layer, int x, int y,
+                CanvasFormat format, YuvMatrix matrix) {
+    memset(sprite, 0, sizeof(*sprite));
+    sprite->format = format;
+    sprite->x = x;
+    sprite->y = y;
+    sprite->width = layer->width;
+    sprite->height = layer->height;
+
+    int ret;
+    if (format == CANVAS_YUV420P) {
+        ret = init_yuv(sprite, layer, matrix);
+    } else if (format == CANVAS_RGB24) {
+        ret = init_rgb(sprite, layer);
+    } else {
+        fprintf(stderr, "Unsupported sprite format\n");
+        return -1;
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "Failed to allocate sprite\n");
+        sprite_free(sprite);
+        return -1;
+    }
+    return 0;
+}
+
+void sprite_free(Sprite *sprite) {
+    for (int i = 0; i < 3; i++) {
+        free(sprite->data[i]);
+        sprite->data[i] = NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        free(sprite->alpha[i]);
+        sprite->alpha[i] = NULL;
+    }
+}
+
+/* Composite one plane: dst = src * fade + dst * (1 - coverage * fade).
+ * src is premultiplied; fade is 0..256. */
+static void blit_plane(uint8_t *dst, int dst_stride,
+                       const uint8_t *src, int src_stride, int bpp,
+                       const uint8_t *alpha, int alpha_stride,
+                       int width, int height, int fade) {
+    for (int row = 0; row < height; row++) {
+        uint8_t *d = dst + row * dst_stride;
+        const uint8_t *s = src + row * src_stride;
+        const uint8_t *a = alpha + row * alpha_stride;
+
+        for (int col = 0; col < width; col++) {
+            int coverage = a[col];
+            if (coverage == 0) continue;
+
+            uint8_t *dp = d + col * bpp;
+            const uint8_t *sp = s + col * bpp;
+            if (coverage == 255 && fade == 256) {
+                for (int c = 0; c < bpp; c++) dp[c] = sp[c];
+                continue;
+            }
+
+            int inv = 256 - (((coverage + (coverage >> 7)) * fade) >> 8);
+            for (int c = 0; c < bpp; c++) {
+                dp[c] = (uint8_t)((dp[c] * inv + sp[c] * fade + 128) >> 8);
+            }
+        }
+    }
+}
+
+void sprite_blit(Canvas *canvas, const Sprite *sprite, float alpha) {
+    if (alpha <= 0.0f || sprite->format != canvas->format) return;
+    if (alpha > 1.0f) alpha = 1.0f;
+    int fade = (int)(alpha * 256.0f);
+
+    /* Clip the sprite rectangle against the canvas clip */
+    const CanvasRect *clip = &canvas->clip;
+    int x0 = sprite->x < clip->x0 ? clip->x0 - sprite->x : 0;
+    int y0 = sprite->y < clip->y0 ? clip->y0 - sprite->y : 0;
+    int x1 = sprite->width, y1 = sprite->height;
+    if (sprite->x + x1 > clip->x1) x1 = clip->x1 - sprite->x;
+    if (sprite->y + y1 > clip->y1) y1 = clip->y1 - sprite->y;
+    if (x0 >= x1 || y0 >= y1) return;
+
+    int bpp = canvas->format == CANVAS_RGB24 ? 3 : 1;
+    blit_plane(canvas->data[0] + (sprite->y + y0) * canvas->linesize[0] + (sprite->x + x0) * bpp,
+               canvas->linesize[0],
+               sprite->data[0] + y0 * sprite->linesize[0] + x0 * bpp, sprite->linesize[0], bpp,
+               sprite->alpha[0] + y0 * sprite->alpha_linesize[0] + x0, sprite->alpha_linesize[0],
+               x1 - x0, y1 - y0, fade);
+
+    if (canvas->format != CANVAS_YUV420P) return;
+
+    /* Sprite origin and clip are even, so chroma clips follow from the
+     * luma clip (an odd canvas edge keeps its last chroma sample) */
+    int cx0 = x0 / 2, cy0 = y0 / 2;
+    int cx1 = (x1 + 1) / 2, cy1 = (y1 + 1) / 2;
+
+    for (int p = 1; p < 3; p++) {
+        blit_plane(canvas->data[p] + (sprite->y / 2 + cy0) * canvas->linesize[p] + sprite->x / 2 + cx0,
+                   canvas->linesize[p],
+                   sprite->data[p] + cy0 * sprite->linesize[p] + cx0, sprite->linesize[p], 1,
+                   sprite->alpha[1] + cy0 * sprite->alpha_linesize[1] + cx0, sprite->alpha_linesize[1],
+                   cx1 - cx0, cy1 - cy0, fade);
+    }
+}
+
+void sprite_cache_bind(SpriteCache *cache, const void *owner, uint32_t key) {
+    if (cache->owner == owner && cache->key == key) return;
+
+    sprite_cache_free(cache);
+    cache->owner = owner;
+    cache->key = key;
+}
+
+Sprite *sprite_cache_get(SpriteCache *cache, int slot) {
+    if (slot < 0 || slot >= SPRITE_CACHE_SLOTS || !cache->valid[slot]) {
+        return NULL;
+    }
+    return &cache->slots[slot];
+}
+
+Sprite *sprite_cache_store(SpriteCache *cache, int slot, const Canvas *layer,
+                           int x, int y, CanvasFormat format, YuvMatrix matrix) {
+    if (slot < 0 || slot >= SPRITE_CACHE_SLOTS) {
+        return NULL;
+    }
+    if (cache->valid[slot]) {
+        sprite_free(&cache->slots[slot]);
+        cache->valid[slot] = 0;
+    }
+    if (sprite_init(&cache->slots[slot], layer, x, y, format, matrix) < 0) {
+        return NULL;
+    }
+    cache->slots[slot].id = ++cache->next_id;
+    cache->valid[slot] = 1;
+    return &cache->slots[slot];
+}
+
+void sprite_cache_free(SpriteCache *cache) {
+    for (int i = 0; i < SPRITE_CACHE_SLOTS; i++) {
+        if (cache->valid[i]) {
+            sprite_free(&cache->slots[i]);
+            cache->valid[i] = 0;
+        }
+    }
+    cache->owner = NULL;
+    cache->key = 0;
+}
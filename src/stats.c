@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <json-c/json.h>
+#include "stats.h"
+#include "trace.h"
+
+/* Log-linear buckets: exact below 16 ns, then 16 per power of two (at
+ * most 1/16 relative error) up to 2^41 ns, about 36 minutes */
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXP 40
+#define STATS_BUCKETS ((STATS_MAX_EXP - STATS_SUB_BITS + 2) * STATS_SUB_BUCKETS)
+
+typedef struct {
+    atomic_ullong buckets[STATS_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong total_ns;
+    atomic_ullong max_ns;
+} StatsHistogram;
+
+static const char *stage_names[STATS_NUM_STAGES] = {
+    "render", "convert", "encode_send", "encode_receive", "mux_write"
+};
+
+static struct {
+    atomic_int enabled;
+    uint64_t start_ns;
+    StatsHistogram stages[STATS_NUM_STAGES];
+    atomic_ullong bytes;
+    atomic_int queue_max;
+    atomic_ullong queue_sum;
+    atomic_ullong queue_samples;
+} stats;
+
+static int bucket_index(uint64_t ns) {
+    if (ns < STATS_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    int exp = 63 - __builtin_clzll(ns);
+    int sub = (int)(ns >> (exp - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1);
+    int index = (exp - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS + sub;
+    return index < STATS_BUCKETS ? index : STATS_BUCKETS - 1;
+}
+
+/* Middle of a bucket's range */
+static uint64_t bucket_value(int index) {
+    if (index < STATS_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int shift = index / STATS_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t)(STATS_SUB_BUCKETS + index % STATS_SUB_BUCKETS) << shift;
+    return low + ((1ull << shift) >> 1);
+}
+
+void stats_enable(void) {
+    stats.start_ns = trace_now();
+    atomic_store(&stats.enabled, 1);
+}
+
+uint64_t stats_start(void) {
+    if (!trace_active && !atomic_load_explicit(&stats.enabled, memory_order_relaxed)) {
+        return 0;
+    }
+    return trace_now();
+}
+
+void stats_stop(StatsStage stage, uint64_t start) {
+    if (start == 0) {
+        return;
+    }
+    uint64_t end = trace_now();
+    if (trace_active) {
+        trace_span(stage_names[stage], start, end);
+    }
+    if (!atomic_load_explicit(&stats.enabled, memory_order_relaxed)) {
+        return;
+    }
+    uint64_t ns = end - start;
+    StatsHistogram *h = &stats.stages[stage];
+
+    atomic_fetch_add_explicit(&h->buckets[bucket_index(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total_ns, ns, memory_order_relaxed);
+    unsigned long long max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&h->max_ns, &max, ns,
+                                                              memory_order_relaxed,
+                                                              memory_order_relaxed)) {
+    }
+}
+
+void stats_add_bytes(uint64_t bytes) {
+    if (atomic_load_explicit(&stats.enabled, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&stats.bytes, bytes, memory_order_relaxed);
+    }
+}
+
+void stats_encoder_queue(int depth) {
+    if (!atomic_load_explicit(&stats.enabled, memory_order_relaxed)) {
+        return;
+    }
+    atomic_fetch_add_explicit(&stats.queue_sum, (unsigned long long)depth,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats.queue_samples, 1, memory_order_relaxed);
+    int max = atomic_load_explicit(&stats.queue_max, memory_order_relaxed);
+    while (depth > max && !atomic_compare_exchange_weak_explicit(&stats.queue_max, &max, depth,
+                                                                 memory_order_relaxed,
+                                                                 memory_order_relaxed)) {
+    }
+}
+
+/* Latency at quantile q (0..1) in nanoseconds */
+static uint64_t percentile(const StatsHistogram *h, double q) {
+    unsigned long long count = atomic_load(&h->count);
+    unsigned long long max = atomic_load(&h->max_ns);
+    if (count == 0) {
+        return 0;
+    }
+    unsigned long long rank = (unsigned long long)(q * count + 0.5);
+    if (rank < 1) rank = 1;
+
+    unsigned long long seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += atomic_load(&h->buckets[i]);
+        if (seen >= rank) {
+            uint64_t value = bucket_value(i);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
+
+static struct json_object *json_ms(uint64_t ns) {
+    return json_object_new_double(ns / 1e6);
+}
+
+int stats_report(int frames, const char *json_file) {
+    if (!atomic_load(&stats.enabled)) {
+        return 0;
+    }
+
+    double seconds = (trace_now() - stats.start_ns) / 1e9;
+    double fps = seconds > 0 ? frames / seconds : 0;
+    unsigned long long bytes = atomic_load(&stats.bytes);
+    unsigned long long samples = atomic_load(&stats.queue_samples);
+    double queue_mean = samples ? (double)atomic_load(&stats.queue_sum) / samples : 0;
+    int queue_max = atomic_load(&stats.queue_max);
+
+    /* ru_maxrss is in kilobytes on Linux */
+    struct rusage usage;
+    long peak_rss_kb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+
+    printf("\nStats: %d frames in %.2f s (%.1f fps), %.1f MB written, peak RSS %.1f MB\n",
+           frames, seconds, fps, bytes / 1e6, peak_rss_kb / 1024.0);
+    printf("  %-15s %8s %9s %9s %9s %9s %9s\n",
+           "stage (ms)", "calls", "mean", "p50", "p95", "p99", "max");
+
+    struct json_object *root = json_object_new_object();
+    struct json_object *stages = json_object_new_object();
+    for (int s = 0; s < STATS_NUM_STAGES; s++) {
+        const StatsHistogram *h = &stats.stages[s];
+        unsigned long long count = atomic_load(&h->count);
+        uint64_t total = atomic_load(&h->total_ns);
+        uint64_t mean = count ? total / count : 0;
+        uint64_t p50 = percentile(h, 0.50), p95 = percentile(h, 0.95);
+        uint64_t p99 = percentile(h, 0.99), max = atomic_load(&h->max_ns);
+
+        if (count > 0) {
+            printf("  %-15s %8llu %9.3f %9.3f %9.3f %9.3f %9.3f\n", stage_names[s],
+                   count, mean / 1e6, p50 / 1e6, p95 / 1e6, p99 / 1e6, max / 1e6);
+        }
+
+        struct json_object *stage = json_object_new_object();
+        json_object_object_add(stage, "calls", json_object_new_int64((int64_t)count));
+        json_object_object_add(stage, "total_ms", json_ms(total));
+        json_object_object_add(stage, "mean_ms", json_ms(mean));
+        json_object_object_add(stage, "p50_ms", json_ms(p50));
+        json_object_object_add(stage, "p95_ms", json_ms(p95));
+        json_object_object_add(stage, "p99_ms", json_ms(p99));
+        json_object_object_add(stage, "max_ms", json_ms(max));
+        json_object_object_add(stages, stage_names[s], stage);
+    }
+    if (samples > 0) {
+        printf("  Encoder queue: %.1f frames on average, %d at most\n", queue_mean, queue_max);
+    }
+
+    json_object_object_add(root, "frames", json_object_new_int(frames));
+    json_object_object_add(root, "seconds", json_object_new_double(seconds));
+    json_object_object_add(root, "fps", json_object_new_double(fps));
+    json_object_object_add(root, "bytes_written", json_object_new_int64((int64_t)bytes));
+    json_object_object_add(root, "peak_rss_kb", json_object_new_int64(peak_rss_kb));
+    struct json_object *queue = json_object_new_object();
+    json_object_object_add(queue, "mean", json_object_new_double(queue_mean));
+    json_object_object_add(queue, "max", json_object_new_int(queue_max));
+    json_object_object_add(root, "encoder_queue", queue);
+    json_object_object_add(root, "stages", stages);
+
+    int ret = 0;
+    if (json_file) {
+        if (json_object_to_file_ext(json_file, root, JSON_C_TO_STRING_PRETTY) < 0) {
+            fprintf(stderr, "Failed to write stats to %s\n", json_file);
+            ret = -1;
+        } else {
+            printf("Stats written to %s\n", json_file);
+        }
+    }
+    json_object_put(root);
+    return ret;
+}
@@ -2,22 +2,37 @@
 #include <stdlib.h>
 #include <string.h>
 #include "text.h"
+#include "trace.h"
+
+/* Decode one UTF-8 sequence and advance the string pointer */
+static uint32_t utf8_next(const char **str) {
+  const uint8_t *s = (const uint8_t *)*str;
+  uint32_t c = s[0];
+  int extra = 0;
+
+  if (c >= 0xf0 && c < 0xf8) { c &= 0x07; extra = 3; }
+  else if (c >= 0xe0) { c &= 0x0f; extra = 2; }
+  else if (c >= 0xc0) { c &= 0x1f; extra = 1; }
+
+  int i = 1;
+  for (; i <= extra; i++) {
+    if ((s[i] & 0xc0) != 0x80) break;
+    c = (c << 6) | (s[i] & 0x3f);
+  }
 
-int text_init(TextContext *ctx, const char *font_path, int font_size) {
-  FT_Error error;
+  *str += i;
+  return c;
+}
 
-  /* Initialize FreeType lib */
-  error = FT_Init_FreeType(&ctx->library);
-  if(error){
-    fprintf(stderr, "Failed to initialize FreeType\n");
-    return -1;
-  }
+int text_init(TextContext *ctx, FT_Library library,
+              const uint8_t *font_data, size_t font_data_size,
+              int font_size, int face_id, GlyphAtlas *atlas) {
+  FT_Error error;
 
-  /* Load font */
-  error = FT_New_Face(ctx->library, font_path, 0, &ctx->face);
+  /* Face reads directly from the caller's copy of the font file */
+  error = FT_New_Memory_Face(library, font_data, (FT_Long)font_data_size, 0, &ctx->face);
   if(error){
-    fprintf(stderr, "Failed to load font: %s\n", font_path);
-    FT_Done_FreeType(ctx->library);
+    fprintf(stderr, "Failed to load font face\n");
     return -1;
   }
 
@@ -25,11 +40,16 @@ int text_init(TextContext *ctx, const char *font_path, int font_size) {
   if(error){
     fprintf(stderr, "Failed to set font size\n");
     FT_Done_Face(ctx->face);
-    FT_Done_FreeType(ctx->library);
+    ctx->face = NULL;
     return -1;
   }
 
   ctx->font_size = font_size;
+  ctx->face_id = face_id;
+  ctx->atlas = atlas;
+
+  /* Fill the atlas with printable ASCII up front */
+  glyph_atlas_preload(atlas, ctx->face, face_id, font_size, 0x20, 0x7e);
 
   return 0;
 }
@@ -37,82 +57,186 @@ int text_init(TextContext *ctx, const char *font_path, int font_size) {
 void text_close(TextContext *ctx){
   if(ctx->face){
     FT_Done_Face(ctx->face);
+    ctx->face = NULL;
   }
-  if(ctx->library){
-    FT_Done_FreeType(ctx->library);
+}
+
+/* Blend one glyph's coverage into YUV planes. Luma is blended per pixel;
+ * each chroma sample uses the mean coverage of its 2x2 pixels. */
+static void blend_glyph_yuv(Canvas *canvas, const Glyph *glyph, int draw_x, int draw_y,
+                            int col_start, int col_end, int row_start, int row_end,
+                            uint8_t cy, uint8_t cu, uint8_t cv, int alpha){
+  for (int row = row_start; row < row_end; row++){
+    const uint8_t *coverage = glyph->bitmap + row * glyph->pitch;
+    uint8_t *py = canvas->data[0] + (draw_y + row) * canvas->linesize[0] + draw_x;
+
+    for(int col = col_start; col < col_end; col++){
+      if(coverage[col]){
+        canvas_blend_u8(&py[col], cy, coverage[col] * alpha / 255);
+      }
+    }
+  }
+
+  /* Chroma cells touched by the clipped glyph rectangle */
+  int px0 = draw_x + col_start, px1 = draw_x + col_end;
+  int py0 = draw_y + row_start, py1 = draw_y + row_end;
+  for (int crow = py0 / 2; crow <= (py1 - 1) / 2; crow++){
+    uint8_t *pu = canvas->data[1] + crow * canvas->linesize[1];
+    uint8_t *pv = canvas->data[2] + crow * canvas->linesize[2];
+
+    for (int ccol = px0 / 2; ccol <= (px1 - 1) / 2; ccol++){
+      int sum = 0;
+      for (int dy = 0; dy < 2; dy++){
+        int gy = 2 * crow + dy - draw_y;
+        if (gy < row_start || gy >= row_end) continue;
+        for (int dx = 0; dx < 2; dx++){
+          int gx = 2 * ccol + dx - draw_x;
+          if (gx < col_start || gx >= col_end) continue;
+          sum += glyph->bitmap[gy * glyph->pitch + gx];
+        }
+      }
+      if (sum == 0) continue;
+
+      int a = sum * alpha / (4 * 255);
+      canvas_blend_u8(&pu[ccol], cu, a);
+      canvas_blend_u8(&pv[ccol], cv, a);
+    }
   }
 }
 
-int text_render_alpha(TextContext *ctx, uint8_t *rgb_buffer, int buffer_width, int buffer_height,
+int text_render_alpha(TextContext *ctx, Canvas *canvas,
                 const char *text, int x, int y, uint8_t r, uint8_t g, uint8_t b, float alpha){
     if (alpha < 0.0f) alpha = 0.0f;
     if (alpha > 1.0f) alpha = 1.0f;
+  uint64_t start = trace_begin();
 
-    FT_Error error;
-  FT_GlyphSlot slot = ctx->face->glyph;
   int pen_x = x;
   int pen_y = y;
+  const char *p = text;
+
+  /* Palette color converted once per string in YUV mode */
+  uint8_t cy = 0, cu = 0, cv = 0;
+  int alpha_i = (int)(alpha * 256.0f);
+  if(canvas->format == CANVAS_YUV420P){
+    yuv_from_rgb(canvas->matrix, r, g, b, &cy, &cu, &cv);
+  }
 
   /* Render each character */
-  for(size_t i = 0; i < strlen(text); i++){
-    error = FT_Load_Char(ctx->face, text[i], FT_LOAD_RENDER);
-    if(error){
-      fprintf(stderr, "Failed to load character '%c'\n", text[i]);
+  while(*p){
+    uint32_t codepoint = utf8_next(&p);
+    const Glyph *glyph = glyph_atlas_get(ctx->atlas, ctx->face, ctx->face_id,
+                                         ctx->font_size, codepoint);
+    if(!glyph){
+      continue;
+    }
+
+    int draw_x = pen_x + glyph->left;
+    int draw_y = pen_y - glyph->top;
+    pen_x += glyph->advance;
+
+    /* Clip glyph rectangle against the canvas once */
+    const CanvasRect *clip = &canvas->clip;
+    int col_start = draw_x < clip->x0 ? clip->x0 - draw_x : 0;
+    int row_start = draw_y < clip->y0 ? clip->y0 - draw_y : 0;
+    int col_end = glyph->width;
+    int row_end = glyph->rows;
+    if(draw_x + col_end > clip->x1) col_end = clip->x1 - draw_x;
+    if(draw_y + row_end > clip->y1) row_end = clip->y1 - draw_y;
+    if(col_start >= col_end || row_start >= row_end){
       continue;
     }
 
-    FT_Bitmap *bitmap = &slot->bitmap;
+    if(canvas->format == CANVAS_YUV420P){
+      blend_glyph_yuv(canvas, glyph, draw_x, draw_y, col_start, col_end,
+                      row_start, row_end, cy, cu, cv, alpha_i);
+      continue;
+    }
 
-    int draw_x = pen_x + slot->bitmap_left;
-    int draw_y = pen_y - slot->bitmap_top;
+    if(canvas->format == CANVAS_RGBA){
+      Color color = {r, g, b};
+      for (int row = row_start; row < row_end; row++){
+        const uint8_t *coverage = glyph->bitmap + row * glyph->pitch;
+        uint8_t *dst = canvas->data[0] + (draw_y + row) * canvas->linesize[0] + draw_x * 4;
+        for(int col = col_start; col < col_end; col++){
+          if(coverage[col]){
+            canvas_blend_rgba(dst + col * 4, color, coverage[col] * alpha_i / 255);
+          }
+        }
+      }
+      continue;
+    }
 
     /* Blend bitmap onto RGB buffer */
-    for (unsigned int row = 0; row < bitmap->rows; row++){
-      for(unsigned int col = 0; col < bitmap->width; col++){
-        int pixel_x = draw_x + col;
-        int pixel_y = draw_y + row;
+    for (int row = row_start; row < row_end; row++){
+      const uint8_t *coverage = glyph->bitmap + row * glyph->pitch;
+      uint8_t *dst = canvas->data[0] + (draw_y + row) * canvas->linesize[0] + draw_x * 3;
 
-        if(pixel_x < 0 || pixel_x >= buffer_width ||
-           pixel_y < 0 || pixel_y >= buffer_height){
+      for(int col = col_start; col < col_end; col++){
+        uint8_t glyph_alpha = coverage[col];
+        if(glyph_alpha == 0){
           continue;
         }
 
-        uint8_t glyph_alpha = bitmap->buffer[row*bitmap->pitch + col];
         float combined_alpha = (glyph_alpha / 255.0f) * alpha;
-        int buffer_index = (pixel_y * buffer_width + pixel_x) * 3;
+        uint8_t *px = dst + col * 3;
 
-        rgb_buffer[buffer_index + 0] = (uint8_t)(r * combined_alpha + rgb_buffer[buffer_index + 0] * (1.0f - combined_alpha));
-        rgb_buffer[buffer_index + 1] = (uint8_t)(g * combined_alpha + rgb_buffer[buffer_index + 1] * (1.0f - combined_alpha));
-        rgb_buffer[buffer_index + 2] = (uint8_t)(b * combined_alpha + rgb_buffer[buffer_index + 2] * (1.0f - combined_alpha));
+        px[0] = (uint8_t)(r * combined_alpha + px[0] * (1.0f - combined_alpha));
+        px[1] = (uint8_t)(g * combined_alpha + px[1] * (1.0f - combined_alpha));
+        px[2] = (uint8_t)(b * combined_alpha + px[2] * (1.0f - combined_alpha));
       }
     }
-    pen_x += slot->advance.x >> 6;
   }
+  trace_end("text_render_alpha", start);
   return 0;
 }
 
 int text_measure_width(TextContext *ctx, const char *text) {
-    FT_Error error;
-    FT_GlyphSlot slot = ctx->face->glyph;
     int width = 0;
+    const char *p = text;
 
-    for (size_t i = 0; i < strlen(text); i++) {
-        error = FT_Load_Char(ctx->face, text[i], FT_LOAD_DEFAULT);
-        if (error) continue;
+    while (*p) {
+        uint32_t codepoint = utf8_next(&p);
+        const Glyph *glyph = glyph_atlas_get(ctx->atlas, ctx->face, ctx->face_id,
+                                             ctx->font_size, codepoint);
+        if (!glyph) continue;
 
-        width += slot->advance.x >> 6;
+        width += glyph->advance;
     }
 
     return width;
 }
 
-int text_render_centered_alpha(TextContext *ctx, uint8_t *rgb_buffer,
-                         int buffer_width, int buffer_height,
+void text_measure_box(TextContext *ctx, const char *text,
+                      int *x0, int *y0, int *x1, int *y1) {
+    int pen_x = 0;
+    int empty = 1;
+    const char *p = text;
+
+    *x0 = *y0 = *x1 = *y1 = 0;
+    while (*p) {
+        uint32_t codepoint = utf8_next(&p);
+        const Glyph *glyph = glyph_atlas_get(ctx->atlas, ctx->face, ctx->face_id,
+                                             ctx->font_size, codepoint);
+        if (!glyph) continue;
+
+        if (glyph->width > 0 && glyph->rows > 0) {
+            int gx0 = pen_x + glyph->left, gx1 = gx0 + glyph->width;
+            int gy0 = -glyph->top, gy1 = gy0 + glyph->rows;
+            if (empty || gx0 < *x0) *x0 = gx0;
+            if (empty || gy0 < *y0) *y0 = gy0;
+            if (empty || gx1 > *x1) *x1 = gx1;
+            if (empty || gy1 > *y1) *y1 = gy1;
+            empty = 0;
+        }
+        pen_x += glyph->advance;
+    }
+}
+
+int text_render_centered_alpha(TextContext *ctx, Canvas *canvas,
                          const char *text, int y,
                          uint8_t r, uint8_t g, uint8_t b, float alpha) {
     int text_width = text_measure_width(ctx, text);
-    int x = (buffer_width - text_width) / 2;
+    int x = (canvas->width - text_width) / 2;
 
-    return text_render_alpha(ctx, rgb_buffer, buffer_width, buffer_height,
-                       text, x, y, r, g, b, alpha);
+    return text_render_alpha(ctx, canvas, text, x, y, r, g, b, alpha);
 }
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "trace.h"
+
+/* Per-thread cap, about 128 MB of events; later spans are dropped */
+#define TRACE_MAX_EVENTS (4 * 1024 * 1024)
+
+typedef struct {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+} TraceEvent;
+
+/* Spans of one thread. Only that thread appends, so recording takes no
+ * lock; the list of threads is guarded by trace_lock. */
+typedef struct TraceThread {
+    int tid;
+    const char *name;
+    TraceEvent *events;
+    size_t count;
+    size_t capacity;
+    unsigned long dropped;
+    struct TraceThread *next;
+} TraceThread;
+
+int trace_active = 0;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceThread *threads;
+static int next_tid = 1;
+static uint64_t origin;
+static char *trace_file;
+static __thread TraceThread *current;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* The calling thread's buffer, registered on first use */
+static TraceThread *this_thread(void) {
+    if (current) {
+        return current;
+    }
+    TraceThread *thread = calloc(1, sizeof(*thread));
+    if (!thread) {
+        return NULL;
+    }
+    pthread_mutex_lock(&trace_lock);
+    thread->tid = next_tid++;
+    thread->next = threads;
+    threads = thread;
+    pthread_mutex_unlock(&trace_lock);
+    current = thread;
+    return thread;
+}
+
+int trace_open(const char *json_file) {
+    trace_file = strdup(json_file);
+    if (!trace_file) {
+        fprintf(stderr, "Failed to allocate trace\n");
+        return -1;
+    }
+    origin = trace_now();
+    trace_active = 1;
+    trace_thread_name("main");
+    return 0;
+}
+
+void trace_thread_name(const char *name) {
+    if (!trace_active) {
+        return;
+    }
+    TraceThread *thread = this_thread();
+    if (thread) {
+        thread->name = name;
+    }
+}
+
+void trace_span(const char *name, uint64_t start, uint64_t end) {
+    TraceThread *thread = this_thread();
+    if (!thread) {
+        return;
+    }
+    if (thread->count == thread->capacity) {
+        size_t capacity = thread->capacity ? thread->capacity * 2 : 4096;
+        TraceEvent *events = thread->count < TRACE_MAX_EVENTS ?
+            realloc(thread->events, capacity * sizeof(TraceEvent)) : NULL;
+        if (!events) {
+            thread->dropped++;
+            return;
+        }
+        thread->events = events;
+        thread->capacity = capacity;
+    }
+    TraceEvent *event = &thread->events[thread->count++];
+    event->name = name;
+    event->start = start;
+    event->end = end;
+}
+
+/* Microseconds since trace_open, as trace viewers expect */
+static double trace_us(uint64_t ns) {
+    return ns > origin ? (ns - origin) / 1e3 : 0.0;
+}
+
+int trace_close(void) {
+    if (!trace_active) {
+        return 0;
+    }
+    trace_active = 0;
+
+    FILE *file = fopen(trace_file, "w");
+    if (!file) {
+        fprintf(stderr, "Could not open trace file %s\n", trace_file);
+    }
+
+    size_t total = 0;
+    unsigned long dropped = 0;
+    if (file) {
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    }
+    int first = 1;
+    for (TraceThread *thread = threads; thread; thread = thread->next) {
+        if (file && thread->name) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", thread->tid, thread->name);
+            first = 0;
+        }
+        for (size_t i = 0; file && i < thread->count; i++) {
+            const TraceEvent *event = &thread->events[i];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f}", first ? "" : ",\n", event->name,
+                    thread->tid, trace_us(event->start),
+                    (event->end - event->start) / 1e3);
+            first = 0;
+        }
+        total += thread->count;
+        dropped += thread->dropped;
+    }
+
+    int ret = 0;
+    if (file) {
+        fputs("\n]}\n", file);
+        if (fclose(file) != 0) {
+            fprintf(stderr, "Could not write trace file %s\n", trace_file);
+            ret = -1;
+        } else {
+            printf("Trace: %zu spans written to %s\n", total, trace_file);
+        }
+    } else {
+        ret = -1;
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "Trace: %lu spans dropped, buffers full\n", dropped);
+    }
+
+    while (threads) {
+        TraceThread *next = threads->next;
+        free(threads->events);
+        free(threads);
+        threads = next;
+    }
+    /* Only the closing thread can still see its buffer */
+    current = NULL;
+    free(trace_file);
+    trace_file = NULL;
+    return ret;
+}
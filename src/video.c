@@ -1,367 +1,1016 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <sys/types.h>
 #include "video.h"
 #include "colors.h"
+#include "frame_sink.h"
+#include "stats.h"
+#include "trace.h"
+
+static void free_encoder(VideoEncoder *enc);
+static int send_and_mux(VideoEncoder *enc, AVCodecContext *ctx, AVStream *stream,
+                        AVFrame *frame);
+static int open_renditions(VideoEncoder *enc, const VideoConfig *config);
+static int feed_renditions(VideoEncoder *enc);
+static int feed_renditions_audio(VideoEncoder *enc, const float *samples, int count);
+static void close_renditions(VideoEncoder *enc);
+
+/* Create and open an H.264 encoder for the encoder's settings */
+static AVCodecContext *open_encoder(const VideoConfig *settings){
+  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+  if (!codec){
+    fprintf(stderr, "H.264 codec not found\n");
+    return NULL;
+  }
 
-// Global state for video encoding
-static AVFormatContext *format_ctx = NULL;
-static AVCodecContext *codec_ctx = NULL;
-static AVStream *video_stream = NULL;
-static AVFrame *frame = NULL;
-static AVPacket *packet = NULL;
-static int frame_count = 0;
-
-static void cleanup_on_error(void);
-static int rgb_to_yuv_frame(uint8_t *rgb_buffer, int width, int height);
-int video_init(VideoConfig *config){
-  int ret;
-  const AVCodec *codec;
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  if(!ctx){
+    fprintf(stderr, "Could not allocate codec context\n");
+    return NULL;
+  }
 
-  // Allocate output format context
-  avformat_alloc_output_context2(&format_ctx, NULL, NULL, config->output_filename);
-  if(!format_ctx){
-    fprintf(stderr, "Could not create output context\n");
-    cleanup_on_error();
+  // Set codec parameters
+  ctx->width = settings->width;
+  ctx->height = settings->height;
+  ctx->time_base = (AVRational){1,settings->fps};
+  ctx->framerate = (AVRational){settings->fps,1};
+  ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+
+  // Rate control, GOP and threading from the encoder profile
+  const EncoderSettings *profile = &settings->encoder;
+  AVDictionary *opts = NULL;
+  if(profile->preset[0]) av_dict_set(&opts, "preset", profile->preset, 0);
+  if(profile->tune[0]) av_dict_set(&opts, "tune", profile->tune, 0);
+  if(profile->bitrate > 0){
+    ctx->bit_rate = (int64_t)profile->bitrate * 1000;
+  } else {
+    av_dict_set_int(&opts, "crf", profile->crf, 0);
+  }
+  ctx->gop_size = profile->keyint;
+  ctx->max_b_frames = profile->b_frames;
+  ctx->thread_count = profile->threads;
+  if(profile->thread_type == ENCODER_THREADS_FRAME){
+    ctx->thread_type = FF_THREAD_FRAME;
+  } else if(profile->thread_type == ENCODER_THREADS_SLICE){
+    ctx->thread_type = FF_THREAD_SLICE;
+  }
+
+  // Segments are concatenated as-is: every one must open with an IDR and
+  // never reference another, and without B-frames dts == pts so rebased
+  // timestamps stay monotonic across the joins. Parallelism comes from
+  // running segments side by side, so each encoder keeps to one thread
+  // unless the profile asks for more.
+  if(settings->segmented){
+    ctx->max_b_frames = 0;
+    ctx->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+    if(profile->threads == 0) ctx->thread_count = 1;
+  }
+
+  // Tag the color conversion we perform (limited range)
+  ctx->color_range = AVCOL_RANGE_MPEG;
+  if(settings->color_matrix == YUV_MATRIX_BT709){
+    ctx->colorspace = AVCOL_SPC_BT709;
+    ctx->color_primaries = AVCOL_PRI_BT709;
+    ctx->color_trc = AVCOL_TRC_BT709;
+  } else {
+    ctx->colorspace = AVCOL_SPC_SMPTE170M;
+    ctx->color_primaries = AVCOL_PRI_SMPTE170M;
+    ctx->color_trc = AVCOL_TRC_SMPTE170M;
+  }
+
+  // Open codec; options it did not recognize are left in the dictionary
+  int ret = avcodec_open2(ctx, codec, &opts);
+  const AVDictionaryEntry *unused = NULL;
+  while((unused = av_dict_get(opts, "", unused, AV_DICT_IGNORE_SUFFIX))){
+    fprintf(stderr, "Encoder ignored option %s=%s\n", unused->key, unused->value);
+  }
+  av_dict_free(&opts);
+  if(ret < 0){
+    fprintf(stderr, "Could not open codec\n");
+    avcodec_free_context(&ctx);
+    return NULL;
+  }
+
+  return ctx;
+}
+
+/* Add a mono AAC stream and its encoder to the output */
+static int open_audio(VideoEncoder *enc){
+  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+  if(!codec){
+    fprintf(stderr, "AAC codec not found\n");
     return -1;
   }
 
-  // Find H.264 encoder
-  codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-  if (!codec){
-    fprintf(stderr, "H.264 codec not found\n");
-    cleanup_on_error();
+  enc->audio_stream = avformat_new_stream(enc->format_ctx, NULL);
+  enc->audio_ctx = avcodec_alloc_context3(codec);
+  if(!enc->audio_stream || !enc->audio_ctx){
+    fprintf(stderr, "Could not create audio stream\n");
     return -1;
   }
 
-  // Create video stream
-  video_stream = avformat_new_stream(format_ctx, NULL);
-  if (!video_stream){
-    fprintf(stderr, "Could not create video stream\n");
-    cleanup_on_error();
+  AVCodecContext *ctx = enc->audio_ctx;
+  ctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+  ctx->sample_rate = enc->settings.audio_sample_rate;
+  av_channel_layout_default(&ctx->ch_layout, 1);
+  ctx->bit_rate = (int64_t)enc->settings.audio_bitrate * 1000;
+  ctx->time_base = (AVRational){1, ctx->sample_rate};
+  if(enc->format_ctx->oformat->flags & AVFMT_GLOBALHEADER){
+    ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+
+  if(avcodec_open2(ctx, codec, NULL) < 0){
+    fprintf(stderr, "Could not open audio codec\n");
+    return -1;
+  }
+  enc->audio_stream->time_base = ctx->time_base;
+  if(avcodec_parameters_from_context(enc->audio_stream->codecpar, ctx) < 0){
+    fprintf(stderr, "Could not copy audio codec parameters\n");
     return -1;
   }
 
-  // Allocate codec context
-  codec_ctx = avcodec_alloc_context3(codec);
-  if(!codec_ctx){
-    fprintf(stderr, "Could not allocate codec context\n");
-    cleanup_on_error();
+  // One encoder frame of samples is collected before each send
+  enc->audio_frame = av_frame_alloc();
+  if(!enc->audio_frame){
+    fprintf(stderr, "Could not allocate audio frame\n");
+    return -1;
+  }
+  enc->audio_frame->format = ctx->sample_fmt;
+  enc->audio_frame->sample_rate = ctx->sample_rate;
+  enc->audio_frame->nb_samples = ctx->frame_size;
+  av_channel_layout_copy(&enc->audio_frame->ch_layout, &ctx->ch_layout);
+  if(av_frame_get_buffer(enc->audio_frame, 0) < 0){
+    fprintf(stderr, "Could not allocate audio frame buffer\n");
     return -1;
   }
 
-  // Set codec parameters
-  codec_ctx->width = config->width;
-  codec_ctx->height = config->height;
-  codec_ctx->time_base = (AVRational){1,config->fps};
-  codec_ctx->framerate = (AVRational){config->fps,1};
-  codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-  codec_ctx->gop_size = 10;
-  codec_ctx->max_b_frames = 1;
-
-  // Open codec
-  ret = avcodec_open2(codec_ctx, codec, NULL);
+  return 0;
+}
+
+/* Force an IDR where a fragment has to start */
+static void mark_fragment_start(AVFrame *frame, int fragment_frames, int64_t output_frame){
+  frame->pict_type = fragment_frames > 0 && output_frame > 0 &&
+                     output_frame % fragment_frames == 0 ? AV_PICTURE_TYPE_I
+                                                          : AV_PICTURE_TYPE_NONE;
+}
+
+/* Mux one packet with timestamps in codec_tb. With fragment_frames, an
+ * IDR on a fragment boundary first closes the current fragment and
+ * pushes it out. */
+static int mux_packet(VideoEncoder *enc, AVPacket *pkt, AVRational codec_tb){
+  if(enc->fragment_frames > 0 &&
+     pkt->stream_index == enc->video_stream->index &&
+     (pkt->flags & AV_PKT_FLAG_KEY) && pkt->pts > 0 &&
+     pkt->pts % enc->fragment_frames == 0){
+    av_write_frame(enc->format_ctx, NULL);
+    avio_flush(enc->format_ctx->pb);
+  }
+
+  AVStream *stream = enc->format_ctx->streams[pkt->stream_index];
+  av_packet_rescale_ts(pkt, codec_tb, stream->time_base);
+  stats_add_bytes(pkt->size);
+  uint64_t start = stats_start();
+  int ret = av_interleaved_write_frame(enc->format_ctx, pkt);
+  stats_stop(STATS_MUX_WRITE, start);
   if(ret < 0){
-    fprintf(stderr, "Could not open codec\n");
-    cleanup_on_error();
+    fprintf(stderr, "Error writing frame\n");
     return -1;
   }
+  return 0;
+}
 
-  // Copy codec parameters to stream
-  ret = avcodec_parameters_from_context(video_stream->codecpar, codec_ctx);
-  if(ret<0){
-    fprintf(stderr, "Could not copy codec parameters\n");
-    cleanup_on_error();
+/* Resolve the output target and container. "-" and "fd:N" become FFmpeg's
+ * pipe protocol, which cannot seek, so they default to fragmented MP4. */
+static int open_output(VideoEncoder *enc, const VideoConfig *config,
+                       char *url, size_t url_size, const char **movflags){
+  const char *target = config->output_filename;
+  if(strcmp(target, "-") == 0){
+    snprintf(url, url_size, "pipe:1");
+  } else if(strncmp(target, "fd:", 3) == 0){
+    snprintf(url, url_size, "pipe:%s", target + 3);
+  } else {
+    snprintf(url, url_size, "%s", target);
+  }
+  enc->streaming = strncmp(url, "pipe:", 5) == 0;
+
+  OutputContainer container = config->container;
+  if(container == OUTPUT_CONTAINER_AUTO && enc->streaming){
+    container = OUTPUT_CONTAINER_FMP4;
+  }
+  if(container == OUTPUT_CONTAINER_MP4 && enc->streaming){
+    fprintf(stderr, "MP4 needs a seekable file; use fmp4 or mpegts for %s\n", target);
     return -1;
   }
 
-  // Allocate frame
-  frame = av_frame_alloc();
-  if(!frame){
-    fprintf(stderr, "Could not allocate frame\n");
-    cleanup_on_error();
+  // Only fragmented containers are cut by frame count
+  if(container == OUTPUT_CONTAINER_FMP4 || container == OUTPUT_CONTAINER_MPEGTS){
+    enc->fragment_frames = config->fragment_frames;
+  }
+
+  const char *format = NULL;
+  if(container == OUTPUT_CONTAINER_MP4 || container == OUTPUT_CONTAINER_FMP4){
+    format = "mp4";
+  } else if(container == OUTPUT_CONTAINER_MPEGTS){
+    format = "mpegts";
+  }
+  if(container == OUTPUT_CONTAINER_FMP4){
+    // moov up front with no samples; each fragment is a self-contained moof+mdat
+    *movflags = enc->fragment_frames > 0 ? "frag_custom+empty_moov+default_base_moof"
+                                            : "frag_keyframe+empty_moov+default_base_moof";
+  }
+
+  avformat_alloc_output_context2(&enc->format_ctx, NULL, format, url);
+  if(!enc->format_ctx){
+    fprintf(stderr, "Could not create output context\n");
     return -1;
   }
-  frame->format = codec_ctx->pix_fmt;
-  frame->width = codec_ctx->width;
-  frame->height = codec_ctx->height;
 
-  ret = av_frame_get_buffer(frame, 0);
-  if(ret < 0){
-    fprintf(stderr, "Could not allocate frame buffer\n");
-    cleanup_on_error();
+  // Fragmented MP4 only writes whole fragments; pass each on at once
+  if(enc->streaming && container == OUTPUT_CONTAINER_FMP4){
+    enc->format_ctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+  }
+  return 0;
+}
+
+/* Open the output file or pipe with an H.264 encoder, and an AAC track
+ * when there is audio */
+static int encoder_open(VideoEncoder *enc, const VideoConfig *config){
+  int ret;
+
+  // Allocate output format context
+  char url[1024];
+  const char *movflags = NULL;
+  if(open_output(enc, config, url, sizeof(url), &movflags) < 0){
     return -1;
   }
 
-  // Allocate packet
-  packet = av_packet_alloc();
-  if (!packet){
-    fprintf(stderr, "Could not allocate packet\n");
-    cleanup_on_error();
+  // Create video stream
+  enc->video_stream = avformat_new_stream(enc->format_ctx, NULL);
+  if (!enc->video_stream){
+    fprintf(stderr, "Could not create video stream\n");
+    return -1;
+  }
+
+  // Open the encoder (segment encoders are opened the same way later)
+  enc->codec_ctx = open_encoder(&enc->settings);
+  if(!enc->codec_ctx){
+    return -1;
+  }
+
+  // Copy codec parameters to stream
+  ret = avcodec_parameters_from_context(enc->video_stream->codecpar, enc->codec_ctx);
+  if(ret<0){
+    fprintf(stderr, "Could not copy codec parameters\n");
+    return -1;
+  }
+
+  // Optional voiceover track; streams must exist before the header
+  if(config->audio_sample_rate > 0 && open_audio(enc) < 0){
     return -1;
   }
 
-  // Open output file
-  ret = avio_open(&format_ctx->pb, config->output_filename, AVIO_FLAG_WRITE);
+  // Open output file or pipe
+  ret = avio_open(&enc->format_ctx->pb, url, AVIO_FLAG_WRITE);
   if(ret < 0){
-    fprintf(stderr, "Could not open output file\n");
-    cleanup_on_error();
+    fprintf(stderr, "Could not open output %s\n", config->output_filename);
     return -1;
   }
 
   // Write file header
-  ret = avformat_write_header(format_ctx, NULL);
+  AVDictionary *mux_opts = NULL;
+  if(movflags) av_dict_set(&mux_opts, "movflags", movflags, 0);
+  ret = avformat_write_header(enc->format_ctx, &mux_opts);
+  av_dict_free(&mux_opts);
   if(ret < 0){
     fprintf(stderr, "Could not write header\n");
-    cleanup_on_error();
     return -1;
   }
+  enc->header_written = 1;
 
-  frame_count = 0;
-  printf("Video encoder initialized: %dx%d @ %d fps\n",
-         config->width, config->height, config->fps);
+  printf("Video encoder initialized: %dx%d @ %d fps (%s RGB->YUV%s%s%s)\n",
+         config->width, config->height, config->fps, yuv_kernel_name(),
+         config->segmented ? ", segmented" : "",
+         enc->audio_ctx ? ", AAC audio" : "",
+         enc->streaming ? ", streamed" : "");
   return 0;
 }
 
-void video_close(void){
-  // Write file trailer
-  if(format_ctx){
-    av_write_trailer(format_ctx);
-  }
+static int encoder_write(VideoEncoder *enc){
+  return send_and_mux(enc, enc->codec_ctx, enc->video_stream, enc->frame);
+}
 
-  // Free resources
-  if(packet) av_packet_free(&packet);
-  if(frame) av_frame_free(&frame);
-  if(codec_ctx) avcodec_free_context(&codec_ctx);
-  if(format_ctx) {
-    avio_closep(&format_ctx->pb);
-    avformat_free_context(format_ctx);
+/* Drain the encoders and write the trailer when finishing, then free them */
+static void encoder_close(VideoEncoder *enc, int finish){
+  if(finish && enc->header_written){
+    // Drain frames the encoder still holds for lookahead/reordering
+    send_and_mux(enc, enc->codec_ctx, enc->video_stream, NULL);
+
+    // Encode the last partial audio frame, then drain the audio encoder
+    if(enc->audio_ctx){
+      if(enc->audio_fill > 0){
+        enc->audio_frame->nb_samples = enc->audio_fill;
+        enc->audio_frame->pts = enc->audio_samples;
+        send_and_mux(enc, enc->audio_ctx, enc->audio_stream, enc->audio_frame);
+        enc->audio_samples += enc->audio_fill;
+        enc->audio_fill = 0;
+      }
+      send_and_mux(enc, enc->audio_ctx, enc->audio_stream, NULL);
+    }
+
+    // Write file trailer
+    av_write_trailer(enc->format_ctx);
   }
 
-  printf("Video encoder closed. Total frames: %d\n", frame_count);
+  if(enc->codec_ctx) avcodec_free_context(&enc->codec_ctx);
+  if(enc->audio_frame) av_frame_free(&enc->audio_frame);
+  if(enc->audio_ctx) avcodec_free_context(&enc->audio_ctx);
+  enc->audio_stream = NULL;
+  if(enc->format_ctx) {
+    avio_closep(&enc->format_ctx->pb);
+    avformat_free_context(enc->format_ctx);
+    enc->format_ctx = NULL;
+  }
+  enc->video_stream = NULL;
+  enc->header_written = 0;
 }
 
-static void cleanup_on_error(void){
-  if(packet) av_packet_free(&packet);
-  if(frame) av_frame_free(&frame);
-  if(codec_ctx) avcodec_free_context(&codec_ctx);
-  if(format_ctx) {
-    avio_closep(&format_ctx->pb);
-    avformat_free_context(format_ctx);
+static const FrameSink encoder_sink = {"encoder", encoder_open, encoder_write, encoder_close};
+
+static const FrameSink *find_sink(OutputSink kind){
+  switch(kind){
+  case OUTPUT_SINK_NULL:
+    return &frame_sink_null;
+  case OUTPUT_SINK_Y4M:
+    return &frame_sink_y4m;
+  case OUTPUT_SINK_IMAGES:
+    return &frame_sink_images;
+  default:
+    return &encoder_sink;
   }
 }
 
-int video_write_frame(uint8_t r, uint8_t g, uint8_t b){
+int video_init(VideoEncoder *enc, const VideoConfig *config){
   int ret;
 
-  // Make frame writtable
-  ret = av_frame_make_writable(frame);
-  if(ret<0){
-    fprintf(stderr, "Frame not writtable\n");
+  memset(enc, 0, sizeof(*enc));
+  enc->settings = *config;
+  enc->color_matrix = config->color_matrix;
+  enc->sink = find_sink(config->sink);
+  if(config->segmented && enc->sink != &encoder_sink){
+    fprintf(stderr, "Segments are only written by the H.264 encoder\n");
     return -1;
   }
 
-  // Fill frame with solid color (YUV format)
-  // Convert RGB to YUV - simplified formula
-  int y = (int)(0.299 * r + 0.587 * g + 0.114 * b);
-  int u = (int)(-0.169 * r - 0.331 * g + 0.500 * b + 128);
-  int v = (int)(0.500 * r - 0.419*g - 0.081 * b + 128);
+  // Every sink takes frames drawn into the same YUV420P frame
+  enc->frame = av_frame_alloc();
+  if(!enc->frame){
+    fprintf(stderr, "Could not allocate frame\n");
+    free_encoder(enc);
+    return -1;
+  }
+  enc->frame->format = AV_PIX_FMT_YUV420P;
+  enc->frame->width = config->width;
+  enc->frame->height = config->height;
 
-  y = y < 0 ? 0 : (y > 255 ? 255 : y);
-  u = u < 0 ? 0 : (u > 255 ? 255 : u);
-  v = v < 0 ? 0 : (v > 255 ? 255 : v);
+  ret = av_frame_get_buffer(enc->frame, 0);
+  if(ret < 0){
+    fprintf(stderr, "Could not allocate frame buffer\n");
+    free_encoder(enc);
+    return -1;
+  }
 
-  // Fill Y plane
-  for (int row = 0; row < codec_ctx->height; row++){
-    memset(frame->data[0] + row * frame->linesize[0], y, codec_ctx->width);
+  // Allocate packet
+  enc->packet = av_packet_alloc();
+  if (!enc->packet){
+    fprintf(stderr, "Could not allocate packet\n");
+    free_encoder(enc);
+    return -1;
   }
 
-  // Fill U plane
-  for (int row = 0; row < codec_ctx->height/2; row++){
-    memset(frame->data[1] + row * frame->linesize[1], u, codec_ctx->width/2);
+  // Pick the RGB->YUV kernel for this CPU
+  yuv_init();
+
+  if(enc->sink->open(enc, config) < 0){
+    free_encoder(enc);
+    return -1;
   }
 
-  // Fill V plane
-  for (int row = 0; row < codec_ctx->height/2; row++){
-    memset(frame->data[2] + row * frame->linesize[2], v, codec_ctx->width/2);
+  // Each rendition is another output of the same kind, fed from this one
+  if(open_renditions(enc, config) < 0){
+    free_encoder(enc);
+    return -1;
   }
+  return 0;
+}
 
-  // Set frame timestamp
-  frame->pts = frame_count;
+void video_close(VideoEncoder *enc){
+  // Renditions finish what they were handed and close their own outputs
+  close_renditions(enc);
+
+  const FrameSink *sink = enc->sink;
+  if(sink) sink->close(enc, 1);
+
+  free_encoder(enc);
+  printf("Video %s closed. Total frames: %d\n",
+         sink ? sink->name : "output", enc->frame_count);
+}
+
+static void free_encoder(VideoEncoder *enc){
+  close_renditions(enc);
+  if(enc->sink) enc->sink->close(enc, 0);
+  enc->sink = NULL;
+  if(enc->packet) av_packet_free(&enc->packet);
+  if(enc->frame) av_frame_free(&enc->frame);
+}
 
-  // Send frame to encoder
-  ret = avcodec_send_frame(codec_ctx, frame);
+/* Send a frame (NULL flushes) to one of the output's encoders and mux
+ * the resulting packets into its stream */
+static int send_and_mux(VideoEncoder *enc, AVCodecContext *ctx, AVStream *stream,
+                        AVFrame *frame){
+  // Only the video encoder is timed; audio frames are tiny
+  int video = ctx == enc->codec_ctx;
+  uint64_t start = video ? stats_start() : 0;
+  int ret = avcodec_send_frame(ctx, frame);
+  stats_stop(STATS_ENCODE_SEND, start);
   if(ret < 0){
     fprintf(stderr, "Error sending frame\n");
     return -1;
   }
+  if(video && frame){
+    enc->queued_frames++;
+  }
 
   // Receive encoded packets
   while(ret >= 0){
-    ret = avcodec_receive_packet(codec_ctx, packet);
+    start = video ? stats_start() : 0;
+    ret = avcodec_receive_packet(ctx, enc->packet);
+    stats_stop(STATS_ENCODE_RECEIVE, start);
     if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF){
       break;
     } else if (ret < 0){
       fprintf(stderr, "Error encoding frame\n");
       return -1;
     }
+    if(video){
+      enc->queued_frames--;
+    }
 
     // Write packet to file
-    packet->stream_index = video_stream->index;
-    av_packet_rescale_ts(packet, codec_ctx->time_base, video_stream->time_base);
-
-    ret = av_interleaved_write_frame(format_ctx, packet);
-    if(ret < 0){
-      fprintf(stderr, "Error writing frame\n");
+    enc->packet->stream_index = stream->index;
+    if(mux_packet(enc, enc->packet, ctx->time_base) < 0){
       return -1;
     }
 
-    av_packet_unref(packet);
+    av_packet_unref(enc->packet);
+  }
+
+  if(video && frame){
+    stats_encoder_queue(enc->queued_frames);
+  }
+  return 0;
+}
+
+/* Encode the current frame at the next timestamp */
+static int encode_current_frame(VideoEncoder *enc){
+  // Set frame timestamp
+  enc->frame->pts = enc->frame_count;
+  mark_fragment_start(enc->frame, enc->fragment_frames, enc->frame_count);
+
+  // Renditions scale the frame while this encoder works on it
+  if(feed_renditions(enc) < 0){
+    return -1;
+  }
+
+  if(enc->sink->write(enc) < 0){
+    return -1;
   }
 
-  frame_count++;
+  enc->frame_count++;
   return 0;
 }
 
-int video_get_frame_count(void){
-  return frame_count;
+int video_write_frame(VideoEncoder *enc, uint8_t r, uint8_t g, uint8_t b){
+  int ret;
+  AVFrame *frame = enc->frame;
+
+  // Make frame writtable
+  ret = av_frame_make_writable(frame);
+  if(ret<0){
+    fprintf(stderr, "Frame not writtable\n");
+    return -1;
+  }
+
+  // Fill frame with solid color (YUV format)
+  uint8_t y, u, v;
+  yuv_from_rgb(enc->color_matrix, r, g, b, &y, &u, &v);
+
+  // Fill Y plane
+  for (int row = 0; row < frame->height; row++){
+    memset(frame->data[0] + row * frame->linesize[0], y, frame->width);
+  }
+
+  // Fill U plane
+  for (int row = 0; row < (frame->height + 1)/2; row++){
+    memset(frame->data[1] + row * frame->linesize[1], u, (frame->width + 1)/2);
+  }
+
+  // Fill V plane
+  for (int row = 0; row < (frame->height + 1)/2; row++){
+    memset(frame->data[2] + row * frame->linesize[2], v, (frame->width + 1)/2);
+  }
+
+  return encode_current_frame(enc);
+}
+
+int video_get_frame_count(const VideoEncoder *enc){
+  return enc->frame_count;
 }
 
-static int rgb_to_yuv_frame(uint8_t *rgb_buffer, int width, int height){
+int video_write_frame_rgb(VideoEncoder *enc, uint8_t *rgb_buffer){
+  AVFrame *frame = enc->frame;
   int ret = av_frame_make_writable(frame);
   if (ret < 0){
     fprintf(stderr, "Frame not writtable\n");
     return -1;
   }
 
-  /* Convert RGB to YUV */
-  for (int y = 0; y < height; y++){
-    for(int x = 0; x < width; x ++){
-      int rgb_index = (y * width + x) * 3;
-      uint8_t r = rgb_buffer[rgb_index + 0];
-      uint8_t g = rgb_buffer[rgb_index + 1];
-      uint8_t b = rgb_buffer[rgb_index + 2];
+  /* Convert RGB to YUV (SIMD kernel selected in video_init) */
+  yuv_convert_rgb24(rgb_buffer, frame->width * 3, frame->data, frame->linesize,
+                    frame->width, frame->height, enc->color_matrix);
+
+  return encode_current_frame(enc);
+}
 
-      int yval = (int)(0.299 * r + 0.587 * g + 0.114 * b);
-      int uval = (int)(-0.169 * r - 0.331 * g + 0.500 * b + 128);
-      int vval = (int)(0.500 * r - 0.419 * g - 0.081 * b + 128);
+int video_write_frame_rgb_rects(VideoEncoder *enc, uint8_t *rgb_buffer,
+                                const CanvasRect *rects, int num_rects){
+  AVFrame *frame = enc->frame;
+  int ret = av_frame_make_writable(frame);
+  if (ret < 0){
+    fprintf(stderr, "Frame not writtable\n");
+    return -1;
+  }
 
-      yval = yval < 0 ? 0 : (yval > 255 ? 255 : yval);
-      uval = uval < 0 ? 0 : (uval > 255 ? 255 : uval);
-      vval = vval < 0 ? 0 : (vval > 255 ? 255 : vval);
+  for (int i = 0; i < num_rects; i++){
+    const CanvasRect *r = &rects[i];
+    yuv_convert_rgb24_rect(rgb_buffer, frame->width * 3, frame->data, frame->linesize,
+                           r->x0, r->y0, r->x1 - r->x0, r->y1 - r->y0, enc->color_matrix);
+  }
 
-      frame->data[0][y * frame->linesize[0] + x] = yval;
+  return encode_current_frame(enc);
+}
 
-      if(y % 2 == 0 && x % 2 == 0){
-        int uv_x = x / 2;
-        int uv_y = y / 2;
-        frame->data[1][uv_y * frame->linesize[1] + uv_x] = uval;
-        frame->data[2][uv_y * frame->linesize[2] + uv_x] = vval;
-      }
+/* Copy YUV420P planes into an encoder frame */
+static int copy_planes(AVFrame *dst, uint8_t *const data[3], const int linesize[3]){
+  int ret = av_frame_make_writable(dst);
+  if (ret < 0){
+    fprintf(stderr, "Frame not writtable\n");
+    return -1;
+  }
+
+  for (int p = 0; p < 3; p++){
+    int rows = p ? (dst->height + 1) / 2 : dst->height;
+    int bytes = p ? (dst->width + 1) / 2 : dst->width;
+    for (int row = 0; row < rows; row++){
+      memcpy(dst->data[p] + row * dst->linesize[p], data[p] + row * linesize[p], bytes);
     }
   }
   return 0;
 }
 
-int video_write_frame_rgb(uint8_t *rgb_buffer){
-  int ret;
+int video_write_frame_planes(VideoEncoder *enc, uint8_t *const data[3],
+                             const int linesize[3]){
+  if (copy_planes(enc->frame, data, linesize) < 0){
+    return -1;
+  }
+
+  return encode_current_frame(enc);
+}
 
-  ret = rgb_to_yuv_frame(rgb_buffer, codec_ctx->width, codec_ctx->height);
+int video_get_canvas(VideoEncoder *enc, Canvas *canvas){
+  // Encoder may still reference the previous frame
+  int ret = av_frame_make_writable(enc->frame);
   if(ret < 0){
-    fprintf(stderr, "Failed convert RGB to YUV\n");
+    fprintf(stderr, "Frame not writtable\n");
     return -1;
   }
 
-  frame->pts = frame_count;
+  canvas_init_yuv(canvas, enc->frame->data, enc->frame->linesize,
+                  enc->frame->width, enc->frame->height, enc->color_matrix);
+  return 0;
+}
 
-  ret = avcodec_send_frame(codec_ctx, frame);
-  if(ret < 0){
-    fprintf(stderr, "Error sending frame\n");
+int video_write_frame_yuv(VideoEncoder *enc){
+  return encode_current_frame(enc);
+}
+
+int video_write_audio(VideoEncoder *enc, const float *samples, int count){
+  if(!enc->audio_ctx){
+    return 0;
+  }
+  if(feed_renditions_audio(enc, samples, count) < 0){
     return -1;
   }
 
-  while (ret >= 0){
-    ret = avcodec_receive_packet(codec_ctx, packet);
-    if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF){
+  AVFrame *frame = enc->audio_frame;
+  while(count > 0){
+    // The encoder may still reference the frame it was last sent
+    if(enc->audio_fill == 0 && av_frame_make_writable(frame) < 0){
+      fprintf(stderr, "Audio frame not writtable\n");
+      return -1;
+    }
+
+    int take = frame->nb_samples - enc->audio_fill;
+    if(take > count) take = count;
+    memcpy((float *)frame->data[0] + enc->audio_fill, samples, take * sizeof(float));
+    enc->audio_fill += take;
+    samples += take;
+    count -= take;
+
+    if(enc->audio_fill == frame->nb_samples){
+      frame->pts = enc->audio_samples;
+      if(send_and_mux(enc, enc->audio_ctx, enc->audio_stream, frame) < 0){
+        return -1;
+      }
+      enc->audio_samples += enc->audio_fill;
+      enc->audio_fill = 0;
+    }
+  }
+  return 0;
+}
+
+/* Scale and encode what the main encoder hands over until told to stop */
+static void *rendition_thread(void *arg){
+  VideoRendition *r = arg;
+  trace_thread_name("rendition");
+
+  for(;;){
+    pthread_mutex_lock(&r->lock);
+    while(!r->stop && !r->source->buf[0] && r->audio_count == 0){
+      pthread_cond_wait(&r->cond, &r->lock);
+    }
+    int have_frame = r->source->buf[0] != NULL;
+    float *audio = NULL;
+    int audio_count = r->audio_count;
+    if(audio_count > 0){
+      // Take the samples; the next ones go into a new buffer
+      audio = r->audio;
+      r->audio = NULL;
+      r->audio_count = 0;
+      r->audio_capacity = 0;
+    }
+    pthread_mutex_unlock(&r->lock);
+    if(!have_frame && !audio){
       break;
-    } else if (ret < 0){
-      fprintf(stderr, "Error encoding frame\n");
+    }
+
+    int ret = 0;
+    if(have_frame){
+      // The source stays untouched until it is released below
+      AVFrame *dst = r->output.frame;
+      ret = av_frame_make_writable(dst);
+      if(ret >= 0){
+        sws_scale(r->scaler, (const uint8_t *const *)r->source->data, r->source->linesize,
+                  0, r->source->height, dst->data, dst->linesize);
+      }
+
+      pthread_mutex_lock(&r->lock);
+      av_frame_unref(r->source);
+      pthread_cond_broadcast(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+
+      if(ret < 0){
+        fprintf(stderr, "Frame not writtable\n");
+      } else {
+        ret = encode_current_frame(&r->output);
+      }
+    }
+    if(ret >= 0 && audio){
+      ret = video_write_audio(&r->output, audio, audio_count);
+    }
+    free(audio);
+
+    if(ret < 0){
+      pthread_mutex_lock(&r->lock);
+      r->failed = 1;
+      pthread_cond_broadcast(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+      break;
+    }
+  }
+  return NULL;
+}
+
+static int open_renditions(VideoEncoder *enc, const VideoConfig *config){
+  if(config->num_renditions <= 0){
+    return 0;
+  }
+  if(config->segmented){
+    fprintf(stderr, "Renditions are scaled from whole frames and cannot be segmented\n");
+    return -1;
+  }
+
+  enc->renditions = calloc(config->num_renditions, sizeof(VideoRendition));
+  if(!enc->renditions){
+    fprintf(stderr, "Could not allocate renditions\n");
+    return -1;
+  }
+  enc->num_renditions = config->num_renditions;
+  for(int i = 0; i < enc->num_renditions; i++){
+    pthread_mutex_init(&enc->renditions[i].lock, NULL);
+    pthread_cond_init(&enc->renditions[i].cond, NULL);
+  }
+
+  for(int i = 0; i < enc->num_renditions; i++){
+    VideoRendition *r = &enc->renditions[i];
+    const RenditionSettings *rendition = &config->renditions[i];
+
+    // Same stream layout, container and audio as the main output
+    VideoConfig settings = *config;
+    settings.width = rendition->width;
+    settings.height = rendition->height;
+    settings.encoder = rendition->encoder;
+    settings.output_filename = rendition->file;
+    settings.renditions = NULL;
+    settings.num_renditions = 0;
+    if(video_init(&r->output, &settings) < 0){
+      return -1;
+    }
+
+    r->scaler = sws_getContext(config->width, config->height, AV_PIX_FMT_YUV420P,
+                               rendition->width, rendition->height, AV_PIX_FMT_YUV420P,
+                               SWS_BICUBIC, NULL, NULL, NULL);
+    r->source = av_frame_alloc();
+    if(!r->scaler || !r->source){
+      fprintf(stderr, "Could not set up scaling to %dx%d\n",
+              rendition->width, rendition->height);
+      return -1;
+    }
+  }
+
+  for(int i = 0; i < enc->num_renditions; i++){
+    VideoRendition *r = &enc->renditions[i];
+    if(pthread_create(&r->thread, NULL, rendition_thread, r) != 0){
+      fprintf(stderr, "Could not start rendition thread\n");
       return -1;
     }
+    r->started = 1;
+  }
+  return 0;
+}
 
-    packet->stream_index = video_stream->index;
-    av_packet_rescale_ts(packet, codec_ctx->time_base, video_stream->time_base);
+/* Hand the current frame to every rendition, once each has let go of
+ * the previous one */
+static int feed_renditions(VideoEncoder *enc){
+  for(int i = 0; i < enc->num_renditions; i++){
+    VideoRendition *r = &enc->renditions[i];
+    pthread_mutex_lock(&r->lock);
+    while(r->source->buf[0] && !r->failed){
+      pthread_cond_wait(&r->cond, &r->lock);
+    }
+    int ret = r->failed ? -1 : av_frame_ref(r->source, enc->frame);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
 
-    ret = av_interleaved_write_frame(format_ctx, packet);
     if(ret < 0){
-      fprintf(stderr, "Error writing frame\n");
+      fprintf(stderr, "Could not write rendition %s\n", r->output.settings.output_filename);
       return -1;
     }
+  }
+  return 0;
+}
+
+/* Queue voiceover samples for every rendition's audio track */
+static int feed_renditions_audio(VideoEncoder *enc, const float *samples, int count){
+  for(int i = 0; i < enc->num_renditions; i++){
+    VideoRendition *r = &enc->renditions[i];
+    pthread_mutex_lock(&r->lock);
+    int ret = r->failed ? -1 : 0;
+    if(ret == 0 && r->audio_count + count > r->audio_capacity){
+      int capacity = r->audio_capacity ? r->audio_capacity : 4096;
+      while(capacity < r->audio_count + count) capacity *= 2;
+      float *audio = realloc(r->audio, capacity * sizeof(float));
+      if(audio){
+        r->audio = audio;
+        r->audio_capacity = capacity;
+      } else {
+        ret = -1;
+      }
+    }
+    if(ret == 0){
+      memcpy(r->audio + r->audio_count, samples, count * sizeof(float));
+      r->audio_count += count;
+      pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
 
-    av_packet_unref(packet);
+    if(ret < 0){
+      fprintf(stderr, "Could not write rendition audio %s\n",
+              r->output.settings.output_filename);
+      return -1;
+    }
   }
-  frame_count++;
   return 0;
 }
 
-/* Fill RGB buffer with solid color */
-void video_fill_rgb_color(uint8_t *rgb_buffer, int width, int height, Color color) {
-    int total_pixels = width * height;
-    for (int i = 0; i < total_pixels; i++) {
-        rgb_buffer[i * 3 + 0] = color.r;
-        rgb_buffer[i * 3 + 1] = color.g;
-        rgb_buffer[i * 3 + 2] = color.b;
+/* Let every rendition finish its queued work, then close its output */
+static void close_renditions(VideoEncoder *enc){
+  for(int i = 0; i < enc->num_renditions; i++){
+    VideoRendition *r = &enc->renditions[i];
+    if(r->started){
+      pthread_mutex_lock(&r->lock);
+      r->stop = 1;
+      pthread_cond_broadcast(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+      pthread_join(r->thread, NULL);
     }
+    if(r->output.sink) video_close(&r->output);
+    if(r->scaler) sws_freeContext(r->scaler);
+    if(r->source) av_frame_free(&r->source);
+    free(r->audio);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+  }
+  free(enc->renditions);
+  enc->renditions = NULL;
+  enc->num_renditions = 0;
 }
 
-/* Keep old function for backward compatibility */
-void video_fill_rgb(uint8_t *rgb_buffer, int width, int height,
-                    uint8_t r, uint8_t g, uint8_t b) {
-    Color c = {r, g, b};
-    video_fill_rgb_color(rgb_buffer, width, height, c);
+int video_segment_init(const VideoEncoder *enc, VideoSegment *seg, int first_frame){
+  memset(seg, 0, sizeof(*seg));
+  seg->first_frame = first_frame;
+  seg->fragment_frames = enc->fragment_frames;
+
+  seg->codec_ctx = open_encoder(&enc->settings);
+  if(!seg->codec_ctx){
+    return -1;
+  }
+
+  seg->frame = av_frame_alloc();
+  if(!seg->frame){
+    fprintf(stderr, "Could not allocate frame\n");
+    video_segment_free(seg);
+    return -1;
+  }
+  seg->frame->format = seg->codec_ctx->pix_fmt;
+  seg->frame->width = seg->codec_ctx->width;
+  seg->frame->height = seg->codec_ctx->height;
+
+  if(av_frame_get_buffer(seg->frame, 0) < 0){
+    fprintf(stderr, "Could not allocate frame buffer\n");
+    video_segment_free(seg);
+    return -1;
+  }
+
+  return 0;
 }
 
-void video_draw_rect(uint8_t *rgb_buffer, int buffer_width, int buffer_height,
-                     int x, int y, int width, int height,
-                     uint8_t r, uint8_t g, uint8_t b) {
-    for (int row = y; row < y + height && row < buffer_height; row++) {
-        for (int col = x; col < x + width && col < buffer_width; col++) {
-            if (row >= 0 && col >= 0) {
-                int index = (row * buffer_width + col) * 3;
-                rgb_buffer[index + 0] = r;
-                rgb_buffer[index + 1] = g;
-                rgb_buffer[index + 2] = b;
-            }
-        }
+/* Drain the segment encoder into its packet list */
+static int segment_receive(VideoSegment *seg){
+  for(;;){
+    if(seg->num_packets == seg->capacity){
+      int capacity = seg->capacity ? seg->capacity * 2 : 64;
+      AVPacket **packets = realloc(seg->packets, capacity * sizeof(AVPacket *));
+      if(!packets){
+        fprintf(stderr, "Could not grow segment packet list\n");
+        return -1;
+      }
+      seg->packets = packets;
+      seg->capacity = capacity;
+    }
+
+    AVPacket *pkt = av_packet_alloc();
+    if(!pkt){
+      fprintf(stderr, "Could not allocate packet\n");
+      return -1;
     }
+
+    uint64_t start = stats_start();
+    int ret = avcodec_receive_packet(seg->codec_ctx, pkt);
+    stats_stop(STATS_ENCODE_RECEIVE, start);
+    if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF){
+      av_packet_free(&pkt);
+      return 0;
+    } else if(ret < 0){
+      fprintf(stderr, "Error encoding frame\n");
+      av_packet_free(&pkt);
+      return -1;
+    }
+
+    seg->packets[seg->num_packets++] = pkt;
+    seg->queued_frames--;
+  }
 }
 
-void video_draw_timer_bar(uint8_t *rgb_buffer, int buffer_width, int buffer_height,
-                          float progress, int bar_height) {
-    const int bar_y = 0;
+int video_segment_write_planes(VideoSegment *seg, uint8_t *const data[3],
+                               const int linesize[3]){
+  if(copy_planes(seg->frame, data, linesize) < 0){
+    return -1;
+  }
 
-    /* Clamp progress to 0.0-1.0 */
-    if (progress < 0.0f) progress = 0.0f;
-    if (progress > 1.0f) progress = 1.0f;
+  // Timestamps are local to the segment until video_write_segment
+  seg->frame->pts = seg->frame_count;
+  mark_fragment_start(seg->frame, seg->fragment_frames,
+                      (int64_t)seg->first_frame + seg->frame_count);
+  uint64_t start = stats_start();
+  int ret = avcodec_send_frame(seg->codec_ctx, seg->frame);
+  stats_stop(STATS_ENCODE_SEND, start);
+  if(ret < 0){
+    fprintf(stderr, "Error sending frame\n");
+    return -1;
+  }
+  seg->frame_count++;
+  seg->queued_frames++;
 
-    int fill_width = (int)(buffer_width * progress);
+  if(segment_receive(seg) < 0){
+    return -1;
+  }
+  stats_encoder_queue(seg->queued_frames);
+  return 0;
+}
 
-    /* Draw background using color scheme */
-    Color bg = active_colors.timer_background;
-    video_draw_rect(rgb_buffer, buffer_width, buffer_height,
-                    0, bar_y, buffer_width, bar_height,
-                    bg.r, bg.g, bg.b);
+int video_segment_finish(VideoSegment *seg){
+  if(avcodec_send_frame(seg->codec_ctx, NULL) < 0){
+    fprintf(stderr, "Error flushing encoder\n");
+    return -1;
+  }
+  return segment_receive(seg);
+}
 
-    /* Draw filled portion using color scheme */
-    if (fill_width > 0) {
-        Color fill = active_colors.timer_fill;
-        video_draw_rect(rgb_buffer, buffer_width, buffer_height,
-                        0, bar_y, fill_width, bar_height,
-                        fill.r, fill.g, fill.b);
+int video_write_segment(VideoEncoder *enc, VideoSegment *seg){
+  for(int i = 0; i < seg->num_packets; i++){
+    AVPacket *pkt = seg->packets[i];
+
+    // Rebase onto the output timeline, then into the stream time base
+    pkt->pts += seg->first_frame;
+    pkt->dts += seg->first_frame;
+    pkt->stream_index = enc->video_stream->index;
+    int ret = mux_packet(enc, pkt, enc->codec_ctx->time_base);
+    av_packet_free(&seg->packets[i]);
+    if(ret < 0){
+      return -1;
+    }
+  }
+
+  seg->num_packets = 0;
+  enc->frame_count += seg->frame_count;
+  return 0;
+}
+
+void video_segment_free(VideoSegment *seg){
+  for(int i = 0; i < seg->num_packets; i++){
+    av_packet_free(&seg->packets[i]);
+  }
+  free(seg->packets);
+  if(seg->frame) av_frame_free(&seg->frame);
+  if(seg->codec_ctx) avcodec_free_context(&seg->codec_ctx);
+  memset(seg, 0, sizeof(*seg));
+}
+
+/* Fill canvas with solid color */
+static void fill_color(Canvas *canvas, Color color) {
+    const CanvasRect *clip = &canvas->clip;
+    if (clip->x0 >= clip->x1 || clip->y0 >= clip->y1) return;
+
+    if (canvas->format == CANVAS_YUV420P) {
+        uint8_t y, u, v;
+        yuv_from_rgb(canvas->matrix, color.r, color.g, color.b, &y, &u, &v);
+
+        for (int row = clip->y0; row < clip->y1; row++) {
+            memset(canvas->data[0] + row * canvas->linesize[0] + clip->x0, y,
+                   clip->x1 - clip->x0);
+        }
+        int chroma_x0 = clip->x0 / 2, chroma_w = (clip->x1 + 1) / 2 - chroma_x0;
+        for (int row = clip->y0 / 2; row < (clip->y1 + 1) / 2; row++) {
+            memset(canvas->data[1] + row * canvas->linesize[1] + chroma_x0, u, chroma_w);
+            memset(canvas->data[2] + row * canvas->linesize[2] + chroma_x0, v, chroma_w);
+        }
+        return;
+    }
+
+    if (canvas->format == CANVAS_RGBA) {
+        video_draw_rect(canvas, 0, 0, canvas->width, canvas->height,
+                        color.r, color.g, color.b);
+        return;
+    }
+
+    for (int row = clip->y0; row < clip->y1; row++) {
+        uint8_t *px = canvas->data[0] + row * canvas->linesize[0];
+        for (int col = clip->x0; col < clip->x1; col++) {
+            px[col * 3 + 0] = color.r;
+            px[col * 3 + 1] = color.g;
+            px[col * 3 + 2] = color.b;
+        }
     }
 }
 
+/* Keep old function for backward compatibility */
+void video_fill_rgb(Canvas *canvas, uint8_t r, uint8_t g, uint8_t b) {
+    Color c = {r, g, b};
+    video_fill_rgb_color(canvas, c);
+}
+
 /* Helper: Blend color with alpha onto buffer */
 static inline void blend_pixel(uint8_t *buffer, int index, Color color, float alpha) {
     if (alpha <= 0.0f) return;
@@ -377,51 +1026,217 @@ static inline void blend_pixel(uint8_t *buffer, int index, Color color, float al
     buffer[index + 2] = (uint8_t)(color.b * alpha + buffer[index + 2] * (1.0f - alpha));
 }
 
-void video_draw_rounded_rect_alpha(uint8_t *rgb_buffer, int buffer_width, int buffer_height,
-                                   int x, int y, int width, int height, int radius,
-                                   Color color, float alpha) {
+/* Integer floor(sqrt(n)) */
+static int isqrt(int n) {
+    int r = (int)sqrt((double)n);
+    while (r * r > n) r--;
+    while ((r + 1) * (r + 1) <= n) r++;
+    return r;
+}
+
+/* Columns [*left, *right] of a rounded rectangle covered on a given row.
+ * Matches the per-pixel corner circle test: a pixel is inside when its
+ * distance to the corner center is at most radius. */
+static void rounded_row_span(int row, int x, int y, int width, int height,
+                             int radius, int *left, int *right) {
+    *left = x;
+    *right = x + width - 1;
+
+    int dy;
+    if (row < y + radius) {
+        dy = row - (y + radius);
+    } else if (row >= y + height - radius) {
+        dy = row - (y + height - radius);
+    } else {
+        return;
+    }
+
+    int d = isqrt(radius * radius - dy * dy);
+    if (x + radius - d > *left) *left = x + radius - d;
+    if (x + width - radius + d < *right) *right = x + width - radius + d;
+}
+
+/* Coverage (0..4) of chroma cell column cx by the pixel span [left, right] */
+static inline int cell_coverage(int cx, int left, int right) {
+    int c0 = 2 * cx, c1 = 2 * cx + 1;
+    return (c0 >= left && c0 <= right) + (c1 >= left && c1 <= right);
+}
+
+/* Draw a rounded rectangle straight into YUV planes. Luma is blended per
+ * pixel; each chroma sample is blended by how many of its 2x2 pixels are
+ * covered. alpha is 0..256. */
+static void yuv_draw_rounded(Canvas *canvas, int x, int y, int width, int height,
+                             int radius, Color color, int alpha) {
+    uint8_t cy, cu, cv;
+    yuv_from_rgb(canvas->matrix, color.r, color.g, color.b, &cy, &cu, &cv);
+
+    const CanvasRect *clip = &canvas->clip;
+    int row_start = y < clip->y0 ? clip->y0 : y;
+    int row_end = y + height < clip->y1 ? y + height : clip->y1;
+    if (row_start >= row_end) return;
+
+    /* Luma */
+    for (int row = row_start; row < row_end; row++) {
+        int left, right;
+        rounded_row_span(row, x, y, width, height, radius, &left, &right);
+        if (left < clip->x0) left = clip->x0;
+        if (right >= clip->x1) right = clip->x1 - 1;
+        if (left > right) continue;
+
+        uint8_t *py = canvas->data[0] + row * canvas->linesize[0];
+        if (alpha >= 256) {
+            memset(py + left, cy, right - left + 1);
+        } else {
+            for (int col = left; col <= right; col++) {
+                canvas_blend_u8(&py[col], cy, alpha);
+            }
+        }
+    }
+
+    /* Chroma, one row of cells per pair of pixel rows */
+    int chroma_x0 = clip->x0 / 2;
+    int chroma_x1 = (clip->x1 + 1) / 2;
+    for (int crow = row_start / 2; crow <= (row_end - 1) / 2; crow++) {
+        int spans[2][2];
+        int num_spans = 0;
+        for (int r = 2 * crow; r <= 2 * crow + 1; r++) {
+            if (r < row_start || r >= row_end) continue;
+            rounded_row_span(r, x, y, width, height, radius,
+                             &spans[num_spans][0], &spans[num_spans][1]);
+            num_spans++;
+        }
+
+        int left = spans[0][0], right = spans[0][1];
+        for (int i = 1; i < num_spans; i++) {
+            if (spans[i][0] < left) left = spans[i][0];
+            if (spans[i][1] > right) right = spans[i][1];
+        }
+        int cx_start = left < 0 ? 0 : left / 2;
+        int cx_end = right / 2;
+        if (cx_start < chroma_x0) cx_start = chroma_x0;
+        if (cx_end >= chroma_x1) cx_end = chroma_x1 - 1;
+
+        uint8_t *pu = canvas->data[1] + crow * canvas->linesize[1];
+        uint8_t *pv = canvas->data[2] + crow * canvas->linesize[2];
+        for (int cx = cx_start; cx <= cx_end; cx++) {
+            int covered = 0;
+            for (int i = 0; i < num_spans; i++) {
+                covered += cell_coverage(cx, spans[i][0], spans[i][1]);
+            }
+            if (covered == 0) continue;
+
+            int a = alpha * covered / 4;
+            canvas_blend_u8(&pu[cx], cu, a);
+            canvas_blend_u8(&pv[cx], cv, a);
+        }
+    }
+}
+
+static void draw_rect(Canvas *canvas, int x, int y, int width, int height,
+                      uint8_t r, uint8_t g, uint8_t b) {
+    if (canvas->format == CANVAS_YUV420P) {
+        yuv_draw_rounded(canvas, x, y, width, height, 0, rgb(r, g, b), 256);
+        return;
+    }
+
+    int bpp = canvas->format == CANVAS_RGBA ? 4 : 3;
+
+    const CanvasRect *clip = &canvas->clip;
+
+    for (int row = y; row < y + height && row < clip->y1; row++) {
+        for (int col = x; col < x + width && col < clip->x1; col++) {
+            if (row >= clip->y0 && col >= clip->x0) {
+                uint8_t *px = canvas->data[0] + row * canvas->linesize[0] + col * bpp;
+                px[0] = r;
+                px[1] = g;
+                px[2] = b;
+                if (bpp == 4) px[3] = 255;
+            }
+        }
+    }
+}
+
+/* Public primitives are traced around static bodies with several exits */
+void video_fill_rgb_color(Canvas *canvas, Color color) {
+    uint64_t start = trace_begin();
+    fill_color(canvas, color);
+    trace_end("video_fill_rgb_color", start);
+}
+
+void video_draw_rect(Canvas *canvas, int x, int y, int width, int height,
+                     uint8_t r, uint8_t g, uint8_t b) {
+    uint64_t start = trace_begin();
+    draw_rect(canvas, x, y, width, height, r, g, b);
+    trace_end("video_draw_rect", start);
+}
+
+void video_draw_timer_bar(Canvas *canvas, float progress, int bar_height,
+                          const ColorScheme *colors) {
+    const int bar_y = 0;
+    uint64_t start = trace_begin();
+
+    /* Clamp progress to 0.0-1.0 */
+    if (progress < 0.0f) progress = 0.0f;
+    if (progress > 1.0f) progress = 1.0f;
+
+    int fill_width = (int)(canvas->width * progress);
+
+    /* Draw background using color scheme */
+    Color bg = colors->timer_background;
+    video_draw_rect(canvas, 0, bar_y, canvas->width, bar_height,
+                    bg.r, bg.g, bg.b);
+
+    /* Draw filled portion using color scheme */
+    if (fill_width > 0) {
+        Color fill = colors->timer_fill;
+        video_draw_rect(canvas, 0, bar_y, fill_width, bar_height,
+                        fill.r, fill.g, fill.b);
+    }
+    trace_end("video_draw_timer_bar", start);
+}
+
+static void draw_rounded_rect(Canvas *canvas,
+                              int x, int y, int width, int height, int radius,
+                              Color color, float alpha) {
     if (radius > width / 2) radius = width / 2;
     if (radius > height / 2) radius = height / 2;
+    if (alpha <= 0.0f) return;
+    if (alpha > 1.0f) alpha = 1.0f;
 
-    /* Draw all pixels in one pass */
-    for (int row = y; row < y + height && row < buffer_height; row++) {
-        for (int col = x; col < x + width && col < buffer_width; col++) {
-            if (row < 0 || col < 0) continue;
-
-            /* Check if pixel is inside rounded rectangle */
-            int in_rect = 0;
-
-            /* Check corners */
-            if ((row < y + radius && col < x + radius) ||
-                (row < y + radius && col >= x + width - radius) ||
-                (row >= y + height - radius && col < x + radius) ||
-                (row >= y + height - radius && col >= x + width - radius)) {
-                /* In corner region - check circle distance */
-                int cx, cy;
-                if (row < y + radius && col < x + radius) {
-                    cx = x + radius; cy = y + radius;
-                } else if (row < y + radius && col >= x + width - radius) {
-                    cx = x + width - radius; cy = y + radius;
-                } else if (row >= y + height - radius && col < x + radius) {
-                    cx = x + radius; cy = y + height - radius;
-                } else {
-                    cx = x + width - radius; cy = y + height - radius;
-                }
-
-                int dx = col - cx;
-                int dy = row - cy;
-                if (dx * dx + dy * dy <= radius * radius) {
-                    in_rect = 1;
-                }
-            } else {
-                /* Not in corner region - always inside */
-                in_rect = 1;
-            }
+    if (canvas->format == CANVAS_YUV420P) {
+        yuv_draw_rounded(canvas, x, y, width, height, radius, color,
+                         (int)(alpha * 256.0f));
+        return;
+    }
 
-            if (in_rect) {
-                int index = (row * buffer_width + col) * 3;
-                blend_pixel(rgb_buffer, index, color, alpha);
+    /* One span per row instead of a corner test per pixel */
+    const CanvasRect *clip = &canvas->clip;
+    for (int row = y; row < y + height && row < clip->y1; row++) {
+        if (row < clip->y0) continue;
+
+        int left, right;
+        rounded_row_span(row, x, y, width, height, radius, &left, &right);
+        if (left < clip->x0) left = clip->x0;
+        if (right >= clip->x1) right = clip->x1 - 1;
+
+        uint8_t *line = canvas->data[0] + row * canvas->linesize[0];
+        if (canvas->format == CANVAS_RGBA) {
+            int alpha_i = (int)(alpha * 256.0f);
+            for (int col = left; col <= right; col++) {
+                canvas_blend_rgba(line + col * 4, color, alpha_i);
             }
+            continue;
+        }
+        for (int col = left; col <= right; col++) {
+            blend_pixel(line, col * 3, color, alpha);
         }
     }
 }
+
+void video_draw_rounded_rect_alpha(Canvas *canvas,
+                                   int x, int y, int width, int height, int radius,
+                                   Color color, float alpha) {
+    uint64_t start = trace_begin();
+    draw_rounded_rect(canvas, x, y, width, height, radius, color, alpha);
+    trace_end("video_draw_rounded_rect_alpha", start);
+}
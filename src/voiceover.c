@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+#include "voiceover.h"
+#include "trace.h"
+
+/* Samples of silence sent per call between clips */
+#define VOICEOVER_SILENCE_CHUNK 4096
+
+static const float silence[VOICEOVER_SILENCE_CHUNK];
+
+/* Downmix and resample a clip to mono float at the track rate */
+static float *resample_mono(const AudioSource *audio, int rate, int *length) {
+    int channels = audio->channels > 0 ? audio->channels : 1;
+    int in_frames = audio->num_samples / channels;
+
+    AVChannelLayout in_layout, out_layout;
+    av_channel_layout_default(&in_layout, channels);
+    av_channel_layout_default(&out_layout, 1);
+
+    /* Sources loaded with AUDIO_LOAD_S16 are int16, synthesized ones float */
+    enum AVSampleFormat in_fmt = audio->samples_s16 ? AV_SAMPLE_FMT_S16 : AV_SAMPLE_FMT_FLT;
+    SwrContext *swr = NULL;
+    if (swr_alloc_set_opts2(&swr, &out_layout, AV_SAMPLE_FMT_FLT, rate,
+                            &in_layout, in_fmt, audio->sample_rate,
+                            0, NULL) < 0 || swr_init(swr) < 0) {
+        fprintf(stderr, "Failed to set up voiceover resampler\n");
+        swr_free(&swr);
+        return NULL;
+    }
+
+    /* Room for the converted input plus what the resampler holds back */
+    int capacity = swr_get_out_samples(swr, in_frames);
+    float *out = capacity > 0 ? malloc(capacity * sizeof(float)) : NULL;
+    if (!out) {
+        fprintf(stderr, "Failed to allocate voiceover clip\n");
+        swr_free(&swr);
+        return NULL;
+    }
+
+    uint8_t *out_ptr = (uint8_t *)out;
+    const uint8_t *in_ptr = audio->samples_s16 ? (const uint8_t *)audio->samples_s16
+                                               : (const uint8_t *)audio->samples;
+    int count = swr_convert(swr, &out_ptr, capacity, &in_ptr, in_frames);
+    if (count >= 0) {
+        out_ptr = (uint8_t *)(out + count);
+        int tail = swr_convert(swr, &out_ptr, capacity - count, NULL, 0);
+        if (tail > 0) count += tail;
+    }
+    swr_free(&swr);
+
+    if (count < 0) {
+        fprintf(stderr, "Failed to resample voiceover clip\n");
+        free(out);
+        return NULL;
+    }
+    *length = count;
+    return out;
+}
+
+/* A file clip being decoded straight into its slot */
+typedef struct {
+    SwrContext *swr;             /* Created for the file's rate and layout */
+    int rate;                    /* Track rate */
+    float *samples;
+    int length;
+    int capacity;                /* Samples in the clip's slot */
+} ClipStream;
+
+/* Downmix and resample one decoded chunk into the slot. Decoding stops
+ * once the slot is full; the rest would be cut off anyway. */
+static int clip_chunk(void *user, const float *samples, int frames,
+                      int sample_rate, int channels) {
+    ClipStream *stream = user;
+    if (!stream->swr) {
+        AVChannelLayout in_layout, out_layout;
+        av_channel_layout_default(&in_layout, channels);
+        av_channel_layout_default(&out_layout, 1);
+        if (swr_alloc_set_opts2(&stream->swr, &out_layout, AV_SAMPLE_FMT_FLT, stream->rate,
+                                &in_layout, AV_SAMPLE_FMT_FLT, sample_rate,
+                                0, NULL) < 0 || swr_init(stream->swr) < 0) {
+            fprintf(stderr, "Failed to set up voiceover resampler\n");
+            return -1;
+        }
+    }
+
+    uint8_t *out = (uint8_t *)(stream->samples + stream->length);
+    const uint8_t *in = (const uint8_t *)samples;
+    int count = swr_convert(stream->swr, &out, stream->capacity - stream->length, &in, frames);
+    if (count < 0) {
+        return -1;
+    }
+    stream->length += count;
+    return stream->length < stream->capacity ? 0 : -1;
+}
+
+/* Decode a file clip chunk by chunk, never holding more of it than fits
+ * its slot */
+static float *stream_clip(const VoiceoverClip *clip, int rate, int *length) {
+    if (clip->max_length <= 0 || clip->max_length > INT_MAX) {
+        return NULL;
+    }
+    ClipStream stream = {.rate = rate, .capacity = (int)clip->max_length};
+    stream.samples = malloc((size_t)stream.capacity * sizeof(float));
+    if (!stream.samples) {
+        fprintf(stderr, "Failed to allocate voiceover clip\n");
+        return NULL;
+    }
+
+    int ret = audio_decode_stream(clip->file, clip_chunk, &stream);
+    int full = stream.length == stream.capacity;
+    if (ret == 0 && stream.swr) {
+        /* What the resampler still holds */
+        uint8_t *out = (uint8_t *)(stream.samples + stream.length);
+        int tail = swr_convert(stream.swr, &out, stream.capacity - stream.length, NULL, 0);
+        if (tail > 0) stream.length += tail;
+    }
+    swr_free(&stream.swr);
+
+    if ((ret < 0 && !full) || stream.length == 0) {
+        free(stream.samples);
+        return NULL;
+    }
+    if (full) {
+        fprintf(stderr, "Voiceover for question %d is longer than its %.1f s slot, cut\n",
+                clip->question + 1, (float)stream.capacity / rate);
+    } else {
+        float *shrunk = realloc(stream.samples, (size_t)stream.length * sizeof(float));
+        if (shrunk) stream.samples = shrunk;
+    }
+    *length = stream.length;
+    return stream.samples;
+}
+
+/* Correct answers as one sentence for Piper */
+static char *answer_text(const QuizQuestion *question) {
+    size_t len = 1;
+    for (int i = 0; i < question->num_correct; i++) {
+        int answer = question->correct_answers[i];
+        if (answer < 0 || answer >= question->num_answers) return NULL;
+        len += strlen(question->answers[answer]) + 2;
+    }
+    char *text = malloc(len);
+    if (!text) {
+        return NULL;
+    }
+    text[0] = '\0';
+    for (int i = 0; i < question->num_correct; i++) {
+        if (i > 0) strcat(text, ", ");
+        strcat(text, question->answers[question->correct_answers[i]]);
+    }
+    return text;
+}
+
+/* Synthesize or load a clip, resample it and cut it to its slot */
+static float *prepare_clip(VoiceoverWorker *worker, const VoiceoverClip *clip,
+                           int *length) {
+    Voiceover *vo = worker->vo;
+    if (clip->file) {
+        float *samples = stream_clip(clip, vo->sample_rate, length);
+        if (!samples) {
+            fprintf(stderr, "Failed to prepare voiceover for question %d\n",
+                    clip->question + 1);
+        }
+        return samples;
+    }
+
+    AudioSource *audio = audio_context_tts(&worker->audio, clip->text);
+    float *samples = NULL;
+    if (audio) {
+        samples = resample_mono(audio, vo->sample_rate, length);
+        audio_free(audio);
+    }
+    if (!samples) {
+        fprintf(stderr, "Failed to prepare voiceover for question %d\n", clip->question + 1);
+        return NULL;
+    }
+
+    /* A clip never runs into the next one */
+    if (*length > clip->max_length) {
+        fprintf(stderr, "Voiceover for question %d is %.1f s, cut to %.1f s\n",
+                clip->question + 1, (float)*length / vo->sample_rate,
+                (float)clip->max_length / vo->sample_rate);
+        *length = (int)clip->max_length;
+    }
+    return samples;
+}
+
+/* Prepare clips in track order until none are left */
+static void *voiceover_worker(void *arg) {
+    VoiceoverWorker *worker = arg;
+    Voiceover *vo = worker->vo;
+    trace_thread_name("voiceover");
+
+    for (;;) {
+        pthread_mutex_lock(&vo->lock);
+        if (vo->stop || vo->next_claim >= vo->num_clips) {
+            pthread_mutex_unlock(&vo->lock);
+            break;
+        }
+        VoiceoverClip *clip = &vo->clips[vo->next_claim++];
+        pthread_mutex_unlock(&vo->lock);
+
+        int length = 0;
+        float *samples = prepare_clip(worker, clip, &length);
+
+        pthread_mutex_lock(&vo->lock);
+        clip->samples = samples;
+        clip->length = length;
+        clip->state = samples ? VOICEOVER_CLIP_READY : VOICEOVER_CLIP_FAILED;
+        pthread_cond_broadcast(&vo->clip_done);
+        pthread_mutex_unlock(&vo->lock);
+    }
+
+    /* Piper is not needed once the clips are done */
+    audio_context_free(&worker->audio);
+    return NULL;
+}
+
+static int add_clip(Voiceover *vo, int question, char *text, const char *file,
+                    int64_t start, int64_t max_length) {
+    if (file == NULL && text == NULL) {
+        return -1;
+    }
+    VoiceoverClip *clip = &vo->clips[vo->num_clips++];
+    clip->question = question;
+    clip->text = text;
+    clip->file = file;
+    clip->start = start;
+    clip->max_length = max_length;
+    clip->state = VOICEOVER_CLIP_PENDING;
+    return 0;
+}
+
+int voiceover_init(Voiceover *vo, const AppConfig *config, const QuizData *quiz) {
+    memset(vo, 0, sizeof(*vo));
+    if (config->audio.source == AUDIO_SOURCE_NONE || quiz->num_questions <= 0) {
+        return 0;
+    }
+
+    AudioConfig audio_config = {
+        .type = config->audio.source,
+        .voice_model = config->audio.voice_model,
+        .speed = config->audio.speed,
+        .sample_rate = config->audio.sample_rate,
+        .cache_dir = config->audio.cache_dir,
+        .cache_max_bytes = (int64_t)config->audio.cache_max_mb * 1024 * 1024
+    };
+
+    vo->enabled = 1;
+    vo->sample_rate = config->audio.sample_rate;
+    vo->fps = config->video.fps;
+    pthread_mutex_init(&vo->lock, NULL);
+    pthread_cond_init(&vo->clip_done, NULL);
+
+    /* Question clips run to the next question, or to the reveal when the
+     * answer is spoken there */
+    int piper = config->audio.source == AUDIO_SOURCE_TTS_PIPER;
+    int speak_answers = piper && config->audio.speak_answers;
+    int64_t question_samples = (int64_t)quiz->question_duration * vo->sample_rate;
+    int64_t reveal_samples = (int64_t)quiz->reveal_duration * vo->sample_rate;
+    int64_t samples_per_question = question_samples + reveal_samples;
+
+    vo->clips = calloc((size_t)quiz->num_questions * 2, sizeof(VoiceoverClip));
+    if (!vo->clips) {
+        fprintf(stderr, "Failed to allocate voiceover\n");
+        voiceover_free(vo);
+        return -1;
+    }
+
+    for (int q = 0; q < quiz->num_questions; q++) {
+        const QuizQuestion *question = &quiz->questions[q];
+        int64_t start = q * samples_per_question;
+
+        if (piper && question->question[0]) {
+            char *text = strdup(question->question);
+            if (add_clip(vo, q, text, NULL, start,
+                         speak_answers ? question_samples : samples_per_question) < 0) {
+                fprintf(stderr, "Failed to allocate voiceover\n");
+                voiceover_free(vo);
+                return -1;
+            }
+        } else if (!piper && question->audio_file[0]) {
+            add_clip(vo, q, NULL, question->audio_file, start, samples_per_question);
+        }
+
+        if (speak_answers && question->num_correct > 0 &&
+            add_clip(vo, q, answer_text(question), NULL,
+                     start + question_samples, reveal_samples) < 0) {
+            fprintf(stderr, "Failed to allocate voiceover\n");
+            voiceover_free(vo);
+            return -1;
+        }
+    }
+
+    /* Each worker gets its own Piper; no more workers than clips */
+    vo->num_workers = config->audio.tts_workers;
+    if (vo->num_workers > vo->num_clips) vo->num_workers = vo->num_clips;
+    if (vo->num_workers > 0) {
+        vo->workers = calloc(vo->num_workers, sizeof(VoiceoverWorker));
+        if (!vo->workers) {
+            fprintf(stderr, "Failed to allocate voiceover workers\n");
+            voiceover_free(vo);
+            return -1;
+        }
+    }
+    for (int i = 0; i < vo->num_workers; i++) {
+        vo->workers[i].vo = vo;
+        if (audio_context_init(&vo->workers[i].audio, &audio_config) < 0) {
+            voiceover_free(vo);
+            return -1;
+        }
+    }
+    for (int i = 0; i < vo->num_workers; i++) {
+        if (pthread_create(&vo->workers[i].thread, NULL, voiceover_worker,
+                           &vo->workers[i]) != 0) {
+            fprintf(stderr, "Failed to start voiceover worker %d\n", i);
+            voiceover_free(vo);
+            return -1;
+        }
+        vo->workers[i].started = 1;
+    }
+
+    printf("Voiceover: preparing %d clip(s) for %d questions on %d thread(s), %d Hz\n",
+           vo->num_clips, quiz->num_questions, vo->num_workers, vo->sample_rate);
+    return 0;
+}
+
+int voiceover_enabled(const Voiceover *vo) {
+    return vo->enabled;
+}
+
+/* Block until a worker has finished the clip */
+static int wait_for_clip(Voiceover *vo, VoiceoverClip *clip) {
+    pthread_mutex_lock(&vo->lock);
+    while (clip->state == VOICEOVER_CLIP_PENDING) {
+        pthread_cond_wait(&vo->clip_done, &vo->lock);
+    }
+    int ready = clip->state == VOICEOVER_CLIP_READY;
+    pthread_mutex_unlock(&vo->lock);
+    return ready ? 0 : -1;
+}
+
+int voiceover_write(Voiceover *vo, VideoEncoder *video, int frames) {
+    if (!vo->enabled) {
+        return 0;
+    }
+
+    int64_t end = (int64_t)frames * vo->sample_rate / vo->fps;
+    while (vo->written < end) {
+        VoiceoverClip *clip = vo->next_clip < vo->num_clips ? &vo->clips[vo->next_clip] : NULL;
+        int64_t count = end - vo->written;
+        const float *samples = silence;
+
+        if (clip && vo->written >= clip->start) {
+            /* A clip that could not be prepared has no samples, so its
+             * slot is filled with silence and the track carries on */
+            if (wait_for_clip(vo, clip) < 0) {
+                fprintf(stderr, "No voiceover for question %d, leaving it silent\n",
+                        clip->question + 1);
+            }
+            int64_t offset = vo->written - clip->start;
+            if (offset >= clip->length) {
+                /* Done with this clip */
+                free(clip->samples);
+                clip->samples = NULL;
+                vo->next_clip++;
+                continue;
+            }
+            samples = clip->samples + offset;
+            if (count > clip->length - offset) count = clip->length - offset;
+        } else {
+            /* Silence up to the next clip */
+            if (clip && count > clip->start - vo->written) count = clip->start - vo->written;
+            if (count > VOICEOVER_SILENCE_CHUNK) count = VOICEOVER_SILENCE_CHUNK;
+        }
+
+        if (video_write_audio(video, samples, (int)count) < 0) {
+            return -1;
+        }
+        vo->written += count;
+    }
+    return 0;
+}
+
+void voiceover_free(Voiceover *vo) {
+    if (!vo->enabled) {
+        return;
+    }
+
+    /* Workers finish the clip they are on and exit */
+    pthread_mutex_lock(&vo->lock);
+    vo->stop = 1;
+    pthread_mutex_unlock(&vo->lock);
+    for (int i = 0; i < vo->num_workers; i++) {
+        if (vo->workers[i].started) {
+            pthread_join(vo->workers[i].thread, NULL);
+        }
+        audio_context_free(&vo->workers[i].audio);
+    }
+    free(vo->workers);
+    vo->workers = NULL;
+
+    for (int i = 0; i < vo->num_clips; i++) {
+        free(vo->clips[i].text);
+        free(vo->clips[i].samples);
+    }
+    free(vo->clips);
+    vo->clips = NULL;
+
+    pthread_mutex_destroy(&vo->lock);
+    pthread_cond_destroy(&vo->clip_done);
+    vo->enabled = 0;
+}
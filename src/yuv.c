@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "yuv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YUV_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Fixed-point limited-range conversion:
+ *   Y  = ((kr*R + kg*G + kb*B + 128) >> 8) + 16
+ *   Cb = (ur*R + ug*G + ub*B + 32896) >> 8      (32896 = 128 << 8 + 128)
+ *   Cr = (vr*R + vg*G + vb*B + 32896) >> 8
+ * Chroma is computed from the rounded average of each 2x2 block.
+ * Every term stays within 16 bits, so the SIMD kernels match the scalar
+ * reference bit for bit.
+ */
+static const YuvCoeffs COEFFS_BT601 = {
+    .y = {66, 129, 25},
+    .u = {-38, -74, 112},
+    .v = {112, -94, -18}
+};
+
+static const YuvCoeffs COEFFS_BT709 = {
+    .y = {47, 157, 16},
+    .u = {-26, -86, 112},
+    .v = {112, -102, -10}
+};
+
+const YuvCoeffs *yuv_coeffs(YuvMatrix matrix) {
+    return matrix == YUV_MATRIX_BT709 ? &COEFFS_BT709 : &COEFFS_BT601;
+}
+
+int yuv_matrix_from_name(const char *name, YuvMatrix *matrix) {
+    if (strcmp(name, "bt601") == 0) {
+        *matrix = YUV_MATRIX_BT601;
+    } else if (strcmp(name, "bt709") == 0) {
+        *matrix = YUV_MATRIX_BT709;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static inline uint8_t luma(const YuvCoeffs *k, int r, int g, int b) {
+    return (uint8_t)(((k->y[0] * r + k->y[1] * g + k->y[2] * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t chroma(const int16_t *c, int r, int g, int b) {
+    return (uint8_t)((c[0] * r + c[1] * g + c[2] * b + 32896) >> 8);
+}
+
+void yuv_from_rgb(YuvMatrix matrix, uint8_t r, uint8_t g, uint8_t b,
+                  uint8_t *y, uint8_t *u, uint8_t *v) {
+    const YuvCoeffs *k = yuv_coeffs(matrix);
+    *y = luma(k, r, g, b);
+    *u = chroma(k->u, r, g, b);
+    *v = chroma(k->v, r, g, b);
+}
+
+/* Scalar reference kernel, also handles the tails of the SIMD kernels */
+static void row_scalar(const uint8_t *rgb0, const uint8_t *rgb1,
+                       uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                       int width, const YuvCoeffs *k) {
+    for (int x = 0; x < width; x += 2) {
+        const uint8_t *a = rgb0 + x * 3;
+        const uint8_t *c = rgb1 + x * 3;
+        /* Odd width: the last column pairs with itself */
+        const uint8_t *b = (x + 1 < width) ? a + 3 : a;
+        const uint8_t *d = (x + 1 < width) ? c + 3 : c;
+
+        y0[x] = luma(k, a[0], a[1], a[2]);
+        y1[x] = luma(k, c[0], c[1], c[2]);
+        if (x + 1 < width) {
+            y0[x + 1] = luma(k, b[0], b[1], b[2]);
+            y1[x + 1] = luma(k, d[0], d[1], d[2]);
+        }
+
+        int r = (a[0] + b[0] + c[0] + d[0] + 2) >> 2;
+        int g = (a[1] + b[1] + c[1] + d[1] + 2) >> 2;
+        int bl = (a[2] + b[2] + c[2] + d[2] + 2) >> 2;
+        u[x / 2] = chroma(k->u, r, g, bl);
+        v[x / 2] = chroma(k->v, r, g, bl);
+    }
+}
+
+#ifdef YUV_HAVE_X86
+
+/* ---- SSE2: 32 pixels x 2 rows per iteration ---- */
+
+/* Split 96 bytes of RGB24 into R, G, B (16 pixels per register).
+ * Five rounds of the same byte interleave turn c[0..5] into
+ * R0-15, R16-31, G0-15, G16-31, B0-15, B16-31. */
+__attribute__((target("sse2")))
+static inline void deinterleave_sse2(__m128i c[6]) {
+    for (int round = 0; round < 5; round++) {
+        __m128i n0 = _mm_unpacklo_epi8(c[0], c[3]);
+        __m128i n1 = _mm_unpackhi_epi8(c[0], c[3]);
+        __m128i n2 = _mm_unpacklo_epi8(c[1], c[4]);
+        __m128i n3 = _mm_unpackhi_epi8(c[1], c[4]);
+        __m128i n4 = _mm_unpacklo_epi8(c[2], c[5]);
+        __m128i n5 = _mm_unpackhi_epi8(c[2], c[5]);
+        c[0] = n0; c[1] = n1; c[2] = n2;
+        c[3] = n3; c[4] = n4; c[5] = n5;
+    }
+}
+
+/* Weighted sum of three u16 vectors, rounded and shifted by 8 */
+__attribute__((target("sse2")))
+static inline __m128i weigh_sse2(__m128i r, __m128i g, __m128i b,
+                                 __m128i kr, __m128i kg, __m128i kb, __m128i bias) {
+    __m128i s = _mm_add_epi16(_mm_mullo_epi16(r, kr), _mm_mullo_epi16(g, kg));
+    s = _mm_add_epi16(s, _mm_add_epi16(_mm_mullo_epi16(b, kb), bias));
+    return _mm_srli_epi16(s, 8);
+}
+
+/* Sum horizontal pairs of two rows and average: 8 u16 -> 4, twice -> 8 */
+__attribute__((target("sse2")))
+static inline __m128i avg2x2_sse2(__m128i top_lo, __m128i top_hi,
+                                  __m128i bot_lo, __m128i bot_hi) {
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i lo = _mm_madd_epi16(_mm_add_epi16(top_lo, bot_lo), ones);
+    __m128i hi = _mm_madd_epi16(_mm_add_epi16(top_hi, bot_hi), ones);
+    __m128i sum = _mm_packs_epi32(lo, hi);
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+__attribute__((target("sse2")))
+static void row_sse2(const uint8_t *rgb0, const uint8_t *rgb1,
+                     uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                     int width, const YuvCoeffs *k) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i y_bias = _mm_set1_epi16(128);
+    const __m128i y_off = _mm_set1_epi16(16);
+    const __m128i c_bias = _mm_set1_epi16((short)32896);
+    const __m128i kyr = _mm_set1_epi16(k->y[0]), kyg = _mm_set1_epi16(k->y[1]), kyb = _mm_set1_epi16(k->y[2]);
+    const __m128i kur = _mm_set1_epi16(k->u[0]), kug = _mm_set1_epi16(k->u[1]), kub = _mm_set1_epi16(k->u[2]);
+    const __m128i kvr = _mm_set1_epi16(k->v[0]), kvg = _mm_set1_epi16(k->v[1]), kvb = _mm_set1_epi16(k->v[2]);
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m128i t[6], b[6];
+        for (int i = 0; i < 6; i++) {
+            t[i] = _mm_loadu_si128((const __m128i *)(rgb0 + x * 3 + i * 16));
+            b[i] = _mm_loadu_si128((const __m128i *)(rgb1 + x * 3 + i * 16));
+        }
+        deinterleave_sse2(t);
+        deinterleave_sse2(b);
+
+        __m128i u_half[2], v_half[2];
+        for (int h = 0; h < 2; h++) {
+            /* 16 pixels: R = t[h], G = t[2 + h], B = t[4 + h] */
+            __m128i tr_lo = _mm_unpacklo_epi8(t[h], zero), tr_hi = _mm_unpackhi_epi8(t[h], zero);
+            __m128i tg_lo = _mm_unpacklo_epi8(t[2 + h], zero), tg_hi = _mm_unpackhi_epi8(t[2 + h], zero);
+            __m128i tb_lo = _mm_unpacklo_epi8(t[4 + h], zero), tb_hi = _mm_unpackhi_epi8(t[4 + h], zero);
+            __m128i br_lo = _mm_unpacklo_epi8(b[h], zero), br_hi = _mm_unpackhi_epi8(b[h], zero);
+            __m128i bg_lo = _mm_unpacklo_epi8(b[2 + h], zero), bg_hi = _mm_unpackhi_epi8(b[2 + h], zero);
+            __m128i bb_lo = _mm_unpacklo_epi8(b[4 + h], zero), bb_hi = _mm_unpackhi_epi8(b[4 + h], zero);
+
+            __m128i yt_lo = _mm_add_epi16(weigh_sse2(tr_lo, tg_lo, tb_lo, kyr, kyg, kyb, y_bias), y_off);
+            __m128i yt_hi = _mm_add_epi16(weigh_sse2(tr_hi, tg_hi, tb_hi, kyr, kyg, kyb, y_bias), y_off);
+            __m128i yb_lo = _mm_add_epi16(weigh_sse2(br_lo, bg_lo, bb_lo, kyr, kyg, kyb, y_bias), y_off);
+            __m128i yb_hi = _mm_add_epi16(weigh_sse2(br_hi, bg_hi, bb_hi, kyr, kyg, kyb, y_bias), y_off);
+            _mm_storeu_si128((__m128i *)(y0 + x + h * 16), _mm_packus_epi16(yt_lo, yt_hi));
+            _mm_storeu_si128((__m128i *)(y1 + x + h * 16), _mm_packus_epi16(yb_lo, yb_hi));
+
+            __m128i ar = avg2x2_sse2(tr_lo, tr_hi, br_lo, br_hi);
+            __m128i ag = avg2x2_sse2(tg_lo, tg_hi, bg_lo, bg_hi);
+            __m128i ab = avg2x2_sse2(tb_lo, tb_hi, bb_lo, bb_hi);
+            u_half[h] = weigh_sse2(ar, ag, ab, kur, kug, kub, c_bias);
+            v_half[h] = weigh_sse2(ar, ag, ab, kvr, kvg, kvb, c_bias);
+        }
+        _mm_storeu_si128((__m128i *)(u + x / 2), _mm_packus_epi16(u_half[0], u_half[1]));
+        _mm_storeu_si128((__m128i *)(v + x / 2), _mm_packus_epi16(v_half[0], v_half[1]));
+    }
+
+    if (x < width) {
+        row_scalar(rgb0 + x * 3, rgb1 + x * 3, y0 + x, y1 + x, u + x / 2, v + x / 2,
+                   width - x, k);
+    }
+}
+
+/* ---- AVX2: 64 pixels x 2 rows per iteration ----
+ * Lane 0 holds pixels 0-31 and lane 1 pixels 32-63, so the in-lane
+ * unpacks deinterleave both halves at once. After deinterleaving,
+ * c[h] holds pixels [16h..16h+15 | 32+16h..32+16h+15]. */
+
+__attribute__((target("avx2")))
+static inline void deinterleave_avx2(__m256i c[6]) {
+    for (int round = 0; round < 5; round++) {
+        __m256i n0 = _mm256_unpacklo_epi8(c[0], c[3]);
+        __m256i n1 = _mm256_unpackhi_epi8(c[0], c[3]);
+        __m256i n2 = _mm256_unpacklo_epi8(c[1], c[4]);
+        __m256i n3 = _mm256_unpackhi_epi8(c[1], c[4]);
+        __m256i n4 = _mm256_unpacklo_epi8(c[2], c[5]);
+        __m256i n5 = _mm256_unpackhi_epi8(c[2], c[5]);
+        c[0] = n0; c[1] = n1; c[2] = n2;
+        c[3] = n3; c[4] = n4; c[5] = n5;
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i weigh_avx2(__m256i r, __m256i g, __m256i b,
+                                 __m256i kr, __m256i kg, __m256i kb, __m256i bias) {
+    __m256i s = _mm256_add_epi16(_mm256_mullo_epi16(r, kr), _mm256_mullo_epi16(g, kg));
+    s = _mm256_add_epi16(s, _mm256_add_epi16(_mm256_mullo_epi16(b, kb), bias));
+    return _mm256_srli_epi16(s, 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avg2x2_avx2(__m256i top_lo, __m256i top_hi,
+                                  __m256i bot_lo, __m256i bot_hi) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i lo = _mm256_madd_epi16(_mm256_add_epi16(top_lo, bot_lo), ones);
+    __m256i hi = _mm256_madd_epi16(_mm256_add_epi16(top_hi, bot_hi), ones);
+    __m256i sum = _mm256_packs_epi32(lo, hi);
+    return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load_split_avx2(const uint8_t *p) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)p);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(p + 96));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+__attribute__((target("avx2")))
+static void row_avx2(const uint8_t *rgb0, const uint8_t *rgb1,
+                     uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                     int width, const YuvCoeffs *k) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i y_bias = _mm256_set1_epi16(128);
+    const __m256i y_off = _mm256_set1_epi16(16);
+    const __m256i c_bias = _mm256_set1_epi16((short)32896);
+    const __m256i kyr = _mm256_set1_epi16(k->y[0]), kyg = _mm256_set1_epi16(k->y[1]), kyb = _mm256_set1_epi16(k->y[2]);
+    const __m256i kur = _mm256_set1_epi16(k->u[0]), kug = _mm256_set1_epi16(k->u[1]), kub = _mm256_set1_epi16(k->u[2]);
+    const __m256i kvr = _mm256_set1_epi16(k->v[0]), kvg = _mm256_set1_epi16(k->v[1]), kvb = _mm256_set1_epi16(k->v[2]);
+
+    int x = 0;
+    for (; x + 64 <= width; x += 64) {
+        __m256i t[6], b[6];
+        for (int i = 0; i < 6; i++) {
+            t[i] = load_split_avx2(rgb0 + x * 3 + i * 16);
+            b[i] = load_split_avx2(rgb1 + x * 3 + i * 16);
+        }
+        deinterleave_avx2(t);
+        deinterleave_avx2(b);
+
+        __m256i yt[2], yb[2], u_half[2], v_half[2];
+        for (int h = 0; h < 2; h++) {
+            __m256i tr_lo = _mm256_unpacklo_epi8(t[h], zero), tr_hi = _mm256_unpackhi_epi8(t[h], zero);
+            __m256i tg_lo = _mm256_unpacklo_epi8(t[2 + h], zero), tg_hi = _mm256_unpackhi_epi8(t[2 + h], zero);
+            __m256i tb_lo = _mm256_unpacklo_epi8(t[4 + h], zero), tb_hi = _mm256_unpackhi_epi8(t[4 + h], zero);
+            __m256i br_lo = _mm256_unpacklo_epi8(b[h], zero), br_hi = _mm256_unpackhi_epi8(b[h], zero);
+            __m256i bg_lo = _mm256_unpacklo_epi8(b[2 + h], zero), bg_hi = _mm256_unpackhi_epi8(b[2 + h], zero);
+            __m256i bb_lo = _mm256_unpacklo_epi8(b[4 + h], zero), bb_hi = _mm256_unpackhi_epi8(b[4 + h], zero);
+
+            __m256i yt_lo = _mm256_add_epi16(weigh_avx2(tr_lo, tg_lo, tb_lo, kyr, kyg, kyb, y_bias), y_off);
+            __m256i yt_hi = _mm256_add_epi16(weigh_avx2(tr_hi, tg_hi, tb_hi, kyr, kyg, kyb, y_bias), y_off);
+            __m256i yb_lo = _mm256_add_epi16(weigh_avx2(br_lo, bg_lo, bb_lo, kyr, kyg, kyb, y_bias), y_off);
+            __m256i yb_hi = _mm256_add_epi16(weigh_avx2(br_hi, bg_hi, bb_hi, kyr, kyg, kyb, y_bias), y_off);
+            yt[h] = _mm256_packus_epi16(yt_lo, yt_hi);
+            yb[h] = _mm256_packus_epi16(yb_lo, yb_hi);
+
+            __m256i ar = avg2x2_avx2(tr_lo, tr_hi, br_lo, br_hi);
+            __m256i ag = avg2x2_avx2(tg_lo, tg_hi, bg_lo, bg_hi);
+            __m256i ab = avg2x2_avx2(tb_lo, tb_hi, bb_lo, bb_hi);
+            u_half[h] = weigh_avx2(ar, ag, ab, kur, kug, kub, c_bias);
+            v_half[h] = weigh_avx2(ar, ag, ab, kvr, kvg, kvb, c_bias);
+        }
+
+        /* Put lanes back into pixel order */
+        _mm256_storeu_si256((__m256i *)(y0 + x), _mm256_permute2x128_si256(yt[0], yt[1], 0x20));
+        _mm256_storeu_si256((__m256i *)(y0 + x + 32), _mm256_permute2x128_si256(yt[0], yt[1], 0x31));
+        _mm256_storeu_si256((__m256i *)(y1 + x), _mm256_permute2x128_si256(yb[0], yb[1], 0x20));
+        _mm256_storeu_si256((__m256i *)(y1 + x + 32), _mm256_permute2x128_si256(yb[0], yb[1], 0x31));
+        _mm256_storeu_si256((__m256i *)(u + x / 2), _mm256_packus_epi16(u_half[0], u_half[1]));
+        _mm256_storeu_si256((__m256i *)(v + x / 2), _mm256_packus_epi16(v_half[0], v_half[1]));
+    }
+
+    if (x < width) {
+        row_sse2(rgb0 + x * 3, rgb1 + x * 3, y0 + x, y1 + x, u + x / 2, v + x / 2,
+                 width - x, k);
+    }
+}
+
+const yuv_row_fn yuv_row_sse2 = row_sse2;
+const yuv_row_fn yuv_row_avx2 = row_avx2;
+
+#else
+
+const yuv_row_fn yuv_row_sse2 = NULL;
+const yuv_row_fn yuv_row_avx2 = NULL;
+
+#endif /* YUV_HAVE_X86 */
+
+const yuv_row_fn yuv_row_scalar = row_scalar;
+
+/* Selected kernel */
+static yuv_row_fn active_row = row_scalar;
+static const char *active_name = "scalar";
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void) {
+#ifdef YUV_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        active_row = row_avx2;
+        active_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        active_row = row_sse2;
+        active_name = "sse2";
+    }
+#endif
+}
+
+/* Batch workers open outputs, and so call this, concurrently */
+void yuv_init(void) {
+    pthread_once(&select_once, select_kernel);
+}
+
+const char *yuv_kernel_name(void) {
+    return active_name;
+}
+
+void yuv_convert_rgb24_with(yuv_row_fn row_fn,
+                            const uint8_t *rgb, int rgb_stride,
+                            uint8_t *const dst[3], const int dst_stride[3],
+                            int width, int height, YuvMatrix matrix) {
+    const YuvCoeffs *k = yuv_coeffs(matrix);
+
+    for (int y = 0; y < height; y += 2) {
+        /* Odd height: the last row pairs with itself */
+        int y_next = (y + 1 < height) ? y + 1 : y;
+        row_fn(rgb + y * rgb_stride, rgb + y_next * rgb_stride,
+               dst[0] + y * dst_stride[0], dst[0] + y_next * dst_stride[0],
+               dst[1] + (y / 2) * dst_stride[1], dst[2] + (y / 2) * dst_stride[2],
+               width, k);
+    }
+}
+
+void yuv_convert_rgb24(const uint8_t *rgb, int rgb_stride,
+                       uint8_t *const dst[3], const int dst_stride[3],
+                       int width, int height, YuvMatrix matrix) {
+    yuv_convert_rgb24_with(active_row, rgb, rgb_stride, dst, dst_stride,
+                           width, height, matrix);
+}
+
+void yuv_convert_rgb24_rect(const uint8_t *rgb, int rgb_stride,
+                            uint8_t *const dst[3], const int dst_stride[3],
+                            int x, int y, int width, int height, YuvMatrix matrix) {
+    uint8_t *sub[3] = {
+        dst[0] + y * dst_stride[0] + x,
+        dst[1] + (y / 2) * dst_stride[1] + x / 2,
+        dst[2] + (y / 2) * dst_stride[2] + x / 2
+    };
+    yuv_convert_rgb24_with(active_row, rgb + y * rgb_stride + x * 3, rgb_stride,
+                           sub, dst_stride, width, height, matrix);
+}
@@ -0,0 +1,64 @@
+/* Smoke test against a real Piper: synthesizes a few sentences through one
+ * context, with the cache off so every one goes to the process.
+ * Needs piper on PATH and PIPER_MODEL set to a voice model. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "audio.h"
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+    const char *model = getenv("PIPER_MODEL");
+    if (!model || !*model) {
+        fprintf(stderr, "Set PIPER_MODEL to a Piper voice model\n");
+        return 1;
+    }
+
+    AudioConfig config = {
+        .type = AUDIO_SOURCE_TTS_PIPER,
+        .voice_model = model,
+        .speed = 1.0f,
+        .sample_rate = 22050,
+        .cache_dir = NULL,
+    };
+    AudioContext ctx = {0};
+    if (audio_context_init(&ctx, &config) < 0) {
+        return 1;
+    }
+
+    /* The second sentence checks the process answers more than once
+     * without seeing EOF; the last one needs escaping */
+    const char *sentences[] = {
+        "What is the capital of France?",
+        "Paris.",
+        "She said \"yes\"\nand left.",
+    };
+    size_t count = sizeof(sentences) / sizeof(sentences[0]);
+    int failures = 0;
+    for (size_t i = 0; i < count; i++) {
+        double start = now_seconds();
+        AudioSource *audio = audio_context_tts(&ctx, sentences[i]);
+        double elapsed = now_seconds() - start;
+        if (!audio || audio->num_samples <= 0) {
+            fprintf(stderr, "FAIL sentence %zu: no audio after %.2f s\n", i, elapsed);
+            failures++;
+        } else {
+            printf("ok sentence %zu: %.2f s of audio at %d Hz in %.2f s\n",
+                   i, audio->duration, audio->sample_rate, elapsed);
+        }
+        audio_free(audio);
+    }
+    audio_context_free(&ctx);
+
+    if (failures) {
+        fprintf(stderr, "%d of %zu sentences failed\n", failures, count);
+        return 1;
+    }
+    printf("Piper smoke test passed\n");
+    return 0;
+}
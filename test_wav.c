@@ -0,0 +1,311 @@
+/* Checks that every way of reading a WAV agrees: the header probe, whole
+ * loads as float and as int16, and chunked decoding must see the same
+ * sample count, rate and channels, and the loads and the stream the same
+ * samples. Fixtures cover the header variations the mapped PCM path parses
+ * itself, plus formats it leaves to libavformat. They are written to a
+ * temporary directory, removed afterwards. Exits non-zero on any mismatch. */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "audio.h"
+
+typedef enum {
+    DATA_SIZE_EXACT,
+    DATA_SIZE_ZERO,        /* Streamed: size left as 0 */
+    DATA_SIZE_UNSET,       /* Streamed: size left as 0xFFFFFFFF */
+} DataSize;
+
+typedef struct {
+    const char *name;
+    int format;            /* 1 = PCM, 3 = IEEE float */
+    int bits;
+    int channels;
+    int sample_rate;
+    int frames;
+    int extensible;        /* WAVE_FORMAT_EXTENSIBLE fmt chunk */
+    DataSize data_size;
+    int odd_chunk;         /* Odd-sized chunk and its pad byte before data */
+    int trailing_chunk;    /* Chunk after data that must not be read as audio */
+    int au;                /* Sun .au instead of WAV: no header probe of ours */
+} WavCase;
+
+static const WavCase cases[] = {
+    {"pcm16_mono", 1, 16, 1, 22050, 1000, 0, DATA_SIZE_EXACT, 0, 0, 0},
+    /* More frames than one streamed chunk */
+    {"pcm16_stereo", 1, 16, 2, 44100, 4097, 0, DATA_SIZE_EXACT, 0, 0, 0},
+    {"extensible_pcm16", 1, 16, 2, 48000, 2000, 1, DATA_SIZE_EXACT, 0, 0, 0},
+    {"streamed_size_zero", 1, 16, 1, 22050, 1500, 0, DATA_SIZE_ZERO, 0, 0, 0},
+    {"streamed_size_unset", 1, 16, 2, 22050, 1500, 0, DATA_SIZE_UNSET, 0, 0, 0},
+    {"odd_chunk", 1, 16, 2, 16000, 800, 0, DATA_SIZE_EXACT, 1, 1, 0},
+    /* Left to libavformat when loading and streaming */
+    {"float32_stereo", 3, 32, 2, 44100, 3000, 0, DATA_SIZE_EXACT, 0, 0, 0},
+    {"extensible_float32", 3, 32, 1, 24000, 1200, 1, DATA_SIZE_EXACT, 0, 0, 0},
+    /* Odd frame count: the data chunk itself is padded */
+    {"pcm8_odd_data", 1, 8, 1, 8000, 1001, 0, DATA_SIZE_EXACT, 0, 1, 0},
+    /* Left to libavformat for probing too */
+    {"au_pcm16", 1, 16, 2, 22050, 1000, 0, DATA_SIZE_EXACT, 0, 0, 1},
+};
+
+/* Deterministic full-range test signal */
+static int16_t sample_at(size_t i) {
+    return (int16_t)(((uint32_t)i * 2654435761u) >> 16);
+}
+
+static void put_le16(FILE *file, uint32_t value) {
+    fputc(value & 0xFF, file);
+    fputc((value >> 8) & 0xFF, file);
+}
+
+static void put_le32(FILE *file, uint32_t value) {
+    put_le16(file, value & 0xFFFF);
+    put_le16(file, value >> 16);
+}
+
+static void put_be32(FILE *file, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        fputc((value >> shift) & 0xFF, file);
+    }
+}
+
+static void put_sample(FILE *file, const WavCase *c, size_t i) {
+    int16_t value = sample_at(i);
+    if (c->au) {
+        fputc(((uint16_t)value >> 8) & 0xFF, file);
+        fputc(value & 0xFF, file);
+    } else if (c->format == 3) {
+        float f = value / 32768.0f;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        put_le32(file, bits);
+    } else if (c->bits == 8) {
+        fputc((value >> 8) + 128, file);
+    } else {
+        put_le16(file, (uint16_t)value);
+    }
+}
+
+static int write_fixture(const char *path, const WavCase *c) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    uint32_t block_align = c->channels * c->bits / 8;
+    uint32_t data_bytes = c->frames * block_align;
+    size_t count = (size_t)c->frames * c->channels;
+
+    if (c->au) {
+        fwrite(".snd", 1, 4, file);
+        put_be32(file, 24);              /* Header size */
+        put_be32(file, data_bytes);
+        put_be32(file, 3);               /* 16-bit linear PCM */
+        put_be32(file, c->sample_rate);
+        put_be32(file, c->channels);
+        for (size_t i = 0; i < count; i++) {
+            put_sample(file, c, i);
+        }
+        return fclose(file) == 0 ? 0 : -1;
+    }
+
+    uint32_t fmt_size = c->extensible ? 40 : 16;
+    uint32_t riff_size = 4 + 8 + fmt_size + 8 + data_bytes + (data_bytes & 1);
+    riff_size += c->odd_chunk ? 8 + 3 + 1 : 0;
+    riff_size += c->trailing_chunk ? 8 + 4 : 0;
+    uint32_t unset = c->data_size == DATA_SIZE_ZERO ? 0 : 0xFFFFFFFF;
+
+    fwrite("RIFF", 1, 4, file);
+    put_le32(file, c->data_size == DATA_SIZE_EXACT ? riff_size : unset);
+    fwrite("WAVE", 1, 4, file);
+
+    fwrite("fmt ", 1, 4, file);
+    put_le32(file, fmt_size);
+    put_le16(file, c->extensible ? 0xFFFE : c->format);
+    put_le16(file, c->channels);
+    put_le32(file, c->sample_rate);
+    put_le32(file, c->sample_rate * block_align);
+    put_le16(file, block_align);
+    put_le16(file, c->bits);
+    if (c->extensible) {
+        put_le16(file, 22);              /* Extension size */
+        put_le16(file, c->bits);         /* Valid bits per sample */
+        put_le32(file, c->channels == 2 ? 0x3 : 0x4);
+        /* Subformat GUID: the format tag, then the fixed KSDATAFORMAT tail */
+        put_le32(file, c->format);
+        put_le16(file, 0x0000);
+        put_le16(file, 0x0010);
+        fwrite("\x80\x00\x00\xAA\x00\x38\x9B\x71", 1, 8, file);
+    }
+
+    if (c->odd_chunk) {
+        fwrite("odd ", 1, 4, file);
+        put_le32(file, 3);
+        fwrite("abc\0", 1, 4, file);     /* Body and pad byte */
+    }
+
+    fwrite("data", 1, 4, file);
+    put_le32(file, c->data_size == DATA_SIZE_EXACT ? data_bytes : unset);
+    for (size_t i = 0; i < count; i++) {
+        put_sample(file, c, i);
+    }
+    if (data_bytes & 1) {
+        fputc(0, file);
+    }
+
+    if (c->trailing_chunk) {
+        fwrite("tail", 1, 4, file);
+        put_le32(file, 4);
+        fwrite("\x7F\x7F\x7F\x7F", 1, 4, file);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+/* Chunks from audio_decode_stream, gathered into one buffer */
+typedef struct {
+    float *samples;
+    size_t count;
+    size_t capacity;
+    int sample_rate;
+    int channels;
+    int changed;           /* A chunk's rate or channels differed from the first */
+} Collected;
+
+static int collect(void *user, const float *samples, int frames,
+                   int sample_rate, int channels) {
+    Collected *out = user;
+    if (out->count == 0) {
+        out->sample_rate = sample_rate;
+        out->channels = channels;
+    } else if (sample_rate != out->sample_rate || channels != out->channels) {
+        out->changed = 1;
+    }
+    size_t needed = out->count + (size_t)frames * channels;
+    if (needed > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 4096;
+        while (capacity < needed) capacity *= 2;
+        float *grown = realloc(out->samples, capacity * sizeof(float));
+        if (!grown) {
+            return -1;
+        }
+        out->samples = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->samples + out->count, samples, (size_t)frames * channels * sizeof(float));
+    out->count = needed;
+    return 0;
+}
+
+/* 0 if a reading has the fixture's sample count, rate and channels */
+static int check_format(const WavCase *c, const char *reader, long count,
+                        int sample_rate, int channels) {
+    long expected = (long)c->frames * c->channels;
+    if (count != expected || sample_rate != c->sample_rate || channels != c->channels) {
+        fprintf(stderr, "FAIL %s: %s read %ld samples at %d Hz, %d channels; "
+                "expected %ld at %d Hz, %d channels\n", c->name, reader, count,
+                sample_rate, channels, expected, c->sample_rate, c->channels);
+        return -1;
+    }
+    return 0;
+}
+
+/* 0 if a reading's samples match the float load; int16 and float sources
+ * may round differently by one step */
+static int check_samples(const WavCase *c, const char *reader, const float *expected,
+                         const float *samples, const int16_t *samples_s16, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        float value = samples ? samples[i] : samples_s16[i] / 32768.0f;
+        if (fabsf(value - expected[i]) > 1.0f / 32768.0f) {
+            fprintf(stderr, "FAIL %s: %s sample %zu is %f, float load has %f\n",
+                    c->name, reader, i, value, expected[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int check_case(const char *path, const WavCase *c) {
+    int ret = 0;
+    float expected_duration = (float)c->frames / c->sample_rate;
+    float duration = audio_probe_duration(path);
+    if (fabsf(duration - expected_duration) > 0.5f / c->sample_rate) {
+        fprintf(stderr, "FAIL %s: probe gave %f s, expected %f s\n",
+                c->name, duration, expected_duration);
+        ret = -1;
+    }
+
+    AudioSource *f32 = audio_load_wav_ex(path, 0);
+    AudioSource *s16 = audio_load_wav_ex(path, AUDIO_LOAD_S16);
+    Collected stream = {0};
+    int streamed = audio_decode_stream(path, collect, &stream);
+
+    if (!f32 || !f32->samples) {
+        fprintf(stderr, "FAIL %s: float load failed\n", c->name);
+        ret = -1;
+    } else if (check_format(c, "float load", f32->num_samples, f32->sample_rate,
+                            f32->channels) < 0) {
+        ret = -1;
+    }
+    if (!s16 || !s16->samples_s16) {
+        fprintf(stderr, "FAIL %s: int16 load failed\n", c->name);
+        ret = -1;
+    } else if (check_format(c, "int16 load", s16->num_samples, s16->sample_rate,
+                            s16->channels) < 0) {
+        ret = -1;
+    }
+    if (streamed < 0 || stream.changed) {
+        fprintf(stderr, "FAIL %s: stream %s\n", c->name,
+                streamed < 0 ? "failed" : "changed format between chunks");
+        ret = -1;
+    } else if (check_format(c, "stream", (long)stream.count, stream.sample_rate,
+                            stream.channels) < 0) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        size_t count = (size_t)f32->num_samples;
+        if (check_samples(c, "int16 load", f32->samples, NULL, s16->samples_s16, count) < 0 ||
+            check_samples(c, "stream", f32->samples, stream.samples, NULL, count) < 0) {
+            ret = -1;
+        }
+    }
+
+    audio_free(f32);
+    audio_free(s16);
+    free(stream.samples);
+    return ret;
+}
+
+int main(void) {
+    char dir[] = "/tmp/test_wav_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    size_t count = sizeof(cases) / sizeof(cases[0]);
+    int failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s.%s", dir, cases[i].name,
+                 cases[i].au ? "au" : "wav");
+        if (write_fixture(path, &cases[i]) < 0) {
+            fprintf(stderr, "FAIL %s: could not write fixture\n", cases[i].name);
+            failed++;
+        } else if (check_case(path, &cases[i]) < 0) {
+            failed++;
+        } else {
+            printf("ok %s\n", cases[i].name);
+        }
+        unlink(path);
+    }
+    rmdir(dir);
+
+    if (failed) {
+        fprintf(stderr, "%d of %zu fixtures read inconsistently\n", failed, count);
+        return 1;
+    }
+    printf("All %zu fixtures read consistently\n", count);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/* Checks the SIMD RGB24 -> YUV420P row kernels against the scalar one on
+ * random images at odd and even sizes. Destination planes are padded and
+ * filled with a marker first, so writes past the image count as
+ * mismatches too. Exits non-zero if any conversion differs. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "yuv.h"
+
+#define PAD 32
+#define MARKER 0xA5
+
+typedef struct {
+    uint8_t *planes[3];
+    int stride[3];
+    size_t size[3];
+} Planes;
+
+static int planes_alloc(Planes *p, int width, int height) {
+    int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+    p->stride[0] = width + PAD;
+    p->stride[1] = p->stride[2] = chroma_width + PAD;
+    p->size[0] = (size_t)p->stride[0] * height;
+    p->size[1] = p->size[2] = (size_t)p->stride[1] * chroma_height;
+    for (int i = 0; i < 3; i++) {
+        p->planes[i] = malloc(p->size[i]);
+        if (!p->planes[i]) {
+            return -1;
+        }
+        memset(p->planes[i], MARKER, p->size[i]);
+    }
+    return 0;
+}
+
+static void planes_free(Planes *p) {
+    for (int i = 0; i < 3; i++) {
+        free(p->planes[i]);
+    }
+}
+
+/* Compare one kernel against the scalar reference; 0 if identical */
+static int check(const char *name, yuv_row_fn row_fn, int width, int height,
+                 YuvMatrix matrix) {
+    int rgb_stride = width * 3 + PAD;
+    uint8_t *rgb = malloc((size_t)rgb_stride * height);
+    Planes ref, out;
+    if (!rgb || planes_alloc(&ref, width, height) < 0 ||
+        planes_alloc(&out, width, height) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < (size_t)rgb_stride * height; i++) {
+        rgb[i] = (uint8_t)rand();
+    }
+
+    yuv_convert_rgb24_with(yuv_row_scalar, rgb, rgb_stride, ref.planes, ref.stride,
+                           width, height, matrix);
+    yuv_convert_rgb24_with(row_fn, rgb, rgb_stride, out.planes, out.stride,
+                           width, height, matrix);
+
+    int ret = 0;
+    static const char *plane_names[3] = {"Y", "U", "V"};
+    for (int i = 0; i < 3 && ret == 0; i++) {
+        for (size_t j = 0; j < ref.size[i]; j++) {
+            if (ref.planes[i][j] != out.planes[i][j]) {
+                fprintf(stderr, "FAIL %s %dx%d %s: %s plane at (%zu, %zu): "
+                        "scalar %d, %s %d\n", name, width, height,
+                        matrix == YUV_MATRIX_BT601 ? "bt601" : "bt709",
+                        plane_names[i], j % ref.stride[i], j / ref.stride[i],
+                        ref.planes[i][j], name, out.planes[i][j]);
+                ret = -1;
+                break;
+            }
+        }
+    }
+
+    planes_free(&ref);
+    planes_free(&out);
+    free(rgb);
+    return ret;
+}
+
+int main(void) {
+    struct {
+        const char *name;
+        yuv_row_fn fn;
+        int supported;
+    } kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+        {"sse2", yuv_row_sse2, __builtin_cpu_supports("sse2")},
+        {"avx2", yuv_row_avx2, __builtin_cpu_supports("avx2")},
+#else
+        {"sse2", yuv_row_sse2, 0},
+        {"avx2", yuv_row_avx2, 0},
+#endif
+    };
+    /* Around the 16 and 32 pixel SIMD blocks, plus real frame sizes */
+    static const int widths[] = {1, 2, 3, 7, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65,
+                                 99, 100, 719, 720, 1079, 1080};
+    static const int heights[] = {1, 2, 3, 4, 5, 17, 64};
+
+    srand(12345);
+    int checked = 0, failed = 0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!kernels[k].fn || !kernels[k].supported) {
+            printf("skip %s: not available on this CPU or build\n", kernels[k].name);
+            continue;
+        }
+        int failed_before = failed;
+        for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+            for (size_t h = 0; h < sizeof(heights) / sizeof(heights[0]); h++) {
+                for (int m = YUV_MATRIX_BT601; m <= YUV_MATRIX_BT709; m++) {
+                    if (check(kernels[k].name, kernels[k].fn, widths[w], heights[h],
+                              (YuvMatrix)m) < 0) {
+                        failed++;
+                    }
+                    checked++;
+                }
+            }
+        }
+        if (failed == failed_before) {
+            printf("%s matches scalar\n", kernels[k].name);
+        }
+    }
+
+    if (failed) {
+        fprintf(stderr, "%d of %d conversions differ from scalar\n", failed, checked);
+        return 1;
+    }
+    printf("%d conversions match\n", checked);
+    return 0;
+}